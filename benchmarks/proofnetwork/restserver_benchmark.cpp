@@ -0,0 +1,367 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+// Loopback load test for AbstractRestServer.
+// Server with a few representative routes is started in-process and is loaded by blocking clients, one thread and
+// one connection per client. Each run reports throughput, latency percentiles and CPU time per request.
+
+#include "proofcore/coreapplication.h"
+
+#include "proofnetwork/abstractrestserver.h"
+
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QTcpSocket>
+#include <QThread>
+#include <QUrlQuery>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#if defined Q_OS_WIN
+#    include <windows.h>
+#else
+#    include <sys/resource.h>
+#endif
+
+static constexpr int IO_TIMEOUT = 10000;
+static constexpr int STRUCTURED_ITEM_SIZE = 64;
+
+namespace {
+
+struct Options
+{
+    QString route;
+    int concurrency = 8;
+    int durationMsecs = 10000;
+    int payloadSize = 0;
+    int serverThreads = 0;
+    quint16 port = 9200;
+    bool keepAlive = true;
+    bool cbor = false;
+};
+
+struct ClientResult
+{
+    QVector<qint64> latencies;
+    qint64 errors = 0;
+    qint64 cpuTime = 0;
+};
+
+class BenchmarkRestServer : public Proof::AbstractRestServer
+{
+    Q_OBJECT
+public:
+    explicit BenchmarkRestServer(quint16 port) : Proof::AbstractRestServer(port) {}
+
+public slots:
+    // Smallest possible answer, mostly parser, dispatch and write path
+    void rest_get_Ping(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                       const QUrlQuery &, const QByteArray &)
+    {
+        sendAnswer(connection, "pong", QStringLiteral("text/plain"));
+    }
+
+    void rest_get_Payload(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                          const QUrlQuery &query, const QByteArray &)
+    {
+        sendAnswer(connection, QByteArray(query.queryItemValue(QStringLiteral("size")).toInt(), 'x'),
+                   QStringLiteral("application/octet-stream"));
+    }
+
+    void rest_post_Echo(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                        const QUrlQuery &, const QByteArray &body)
+    {
+        sendAnswer(connection, body, QStringLiteral("application/octet-stream"));
+    }
+
+    // Status-like object, serialized to json or CBOR according to Accept
+    void rest_get_Structured(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                             const QUrlQuery &query, const QByteArray &)
+    {
+        const int itemsCount = query.queryItemValue(QStringLiteral("items")).toInt();
+        QJsonArray items;
+        for (int i = 0; i < itemsCount; ++i) {
+            items.append(QJsonObject{{QStringLiteral("name"), QStringLiteral("item_%1").arg(i)},
+                                     {QStringLiteral("value"), i * 1.5},
+                                     {QStringLiteral("updated_at"), QStringLiteral("2018-01-01T00:00:00Z")}});
+        }
+        QJsonObject answer{{QStringLiteral("app_type"), QStringLiteral("restserver_benchmark")},
+                           {QStringLiteral("uptime"), 12345},
+                           {QStringLiteral("health"), items}};
+        sendJsonAnswer(connection, QJsonDocument(answer));
+    }
+};
+
+qint64 processCpuTime()
+{
+#if defined Q_OS_WIN
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+        return 0;
+    auto toUsecs = [](const FILETIME &time) {
+        return static_cast<qint64>((static_cast<quint64>(time.dwHighDateTime) << 32) | time.dwLowDateTime) / 10;
+    };
+    return toUsecs(kernelTime) + toUsecs(userTime);
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ll + usage.ru_utime.tv_usec
+           + usage.ru_stime.tv_usec;
+#endif
+}
+
+// -1 if not supported, client time is subtracted from process time to get server share of it
+qint64 threadCpuTime()
+{
+#if defined Q_OS_LINUX
+    rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage))
+        return -1;
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ll + usage.ru_utime.tv_usec
+           + usage.ru_stime.tv_usec;
+#else
+    return -1;
+#endif
+}
+
+QByteArray buildRequest(const Options &options)
+{
+    QByteArray startLine;
+    QByteArray body;
+    QByteArray extraHeaders;
+    if (options.route == QLatin1String("ping")) {
+        startLine = "GET /ping HTTP/1.1";
+    } else if (options.route == QLatin1String("payload")) {
+        startLine = "GET /payload?size=" + QByteArray::number(options.payloadSize) + " HTTP/1.1";
+    } else if (options.route == QLatin1String("echo")) {
+        startLine = "POST /echo HTTP/1.1";
+        body = QByteArray(options.payloadSize, 'x');
+        extraHeaders = "Content-Type: application/octet-stream\r\nContent-Length: "
+                       + QByteArray::number(body.size()) + "\r\n";
+    } else if (options.route == QLatin1String("status")) {
+        // Built-in endpoint, shows encoding cost of real status answer
+        startLine = "GET /system/status HTTP/1.1";
+        extraHeaders = options.cbor ? "Accept: application/cbor\r\n" : "Accept: application/json\r\n";
+    } else {
+        const int itemsCount = qMax(1, options.payloadSize / STRUCTURED_ITEM_SIZE);
+        startLine = "GET /structured?items=" + QByteArray::number(itemsCount) + " HTTP/1.1";
+        extraHeaders = options.cbor ? "Accept: application/cbor\r\n" : "Accept: application/json\r\n";
+    }
+    return startLine + "\r\nHost: 127.0.0.1\r\n" + extraHeaders
+           + (options.keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n") + "\r\n" + body;
+}
+
+// Reads one answer, bytes of next answer (if any) are left in buffer
+bool readResponse(QTcpSocket &socket, QByteArray &buffer)
+{
+    int headersEnd = buffer.indexOf("\r\n\r\n");
+    while (headersEnd < 0) {
+        if (!socket.waitForReadyRead(IO_TIMEOUT))
+            return false;
+        buffer.append(socket.readAll());
+        headersEnd = buffer.indexOf("\r\n\r\n");
+    }
+    if (!buffer.startsWith("HTTP/1.1 200"))
+        return false;
+
+    const QByteArray headers = buffer.left(headersEnd).toLower();
+    const int contentLengthIndex = headers.indexOf("\r\ncontent-length:");
+    if (contentLengthIndex < 0) {
+        // Answer without body is finished by server closing connection
+        while (socket.waitForReadyRead(IO_TIMEOUT))
+            socket.readAll();
+        buffer.clear();
+        return true;
+    }
+    const int valueStart = contentLengthIndex + static_cast<int>(qstrlen("\r\ncontent-length:"));
+    const int valueEnd = headers.indexOf("\r\n", valueStart);
+    const qint64 contentLength =
+        headers.mid(valueStart, valueEnd < 0 ? -1 : valueEnd - valueStart).trimmed().toLongLong();
+    const qint64 answerSize = headersEnd + 4 + contentLength;
+    while (buffer.size() < answerSize) {
+        if (!socket.waitForReadyRead(IO_TIMEOUT))
+            return false;
+        buffer.append(socket.readAll());
+    }
+    buffer.remove(0, static_cast<int>(answerSize));
+    return true;
+}
+
+ClientResult runClient(const Options &options, const QByteArray &request)
+{
+    ClientResult result;
+    const qint64 cpuTimeAtStart = threadCpuTime();
+    QTcpSocket socket;
+    QByteArray buffer;
+    QElapsedTimer runTimer;
+    runTimer.start();
+    while (runTimer.elapsed() < options.durationMsecs) {
+        // Connection time is part of latency if connections are not reused
+        QElapsedTimer latencyTimer;
+        latencyTimer.start();
+        if (socket.state() != QAbstractSocket::ConnectedState) {
+            socket.abort();
+            buffer.clear();
+            socket.connectToHost(QHostAddress::LocalHost, options.port);
+            if (!socket.waitForConnected(IO_TIMEOUT)) {
+                ++result.errors;
+                continue;
+            }
+        }
+        socket.write(request);
+        if (!readResponse(socket, buffer)) {
+            ++result.errors;
+            socket.abort();
+            continue;
+        }
+        result.latencies << latencyTimer.nsecsElapsed() / 1000;
+        if (!options.keepAlive)
+            socket.abort();
+    }
+    socket.abort();
+    result.cpuTime = cpuTimeAtStart < 0 ? -1 : threadCpuTime() - cpuTimeAtStart;
+    return result;
+}
+
+qint64 percentile(const QVector<qint64> &sortedValues, double fraction)
+{
+    if (sortedValues.isEmpty())
+        return 0;
+    const int index = static_cast<int>(std::ceil(fraction * sortedValues.count())) - 1;
+    return sortedValues[qBound(0, index, sortedValues.count() - 1)];
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Proof::CoreApplication app(argc, argv, QStringLiteral("Opensoft"), QStringLiteral("restserver_benchmark"));
+    // Per-request debug output would dominate measurements
+    QLoggingCategory::setFilterRules(QStringLiteral("proof.*=false"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("AbstractRestServer loopback benchmark"));
+    parser.addHelpOption();
+    parser.addOptions(
+        {{QStringLiteral("route"), QStringLiteral("ping, payload, echo, structured or status."),
+          QStringLiteral("route"), QStringLiteral("ping")},
+         {QStringLiteral("concurrency"), QStringLiteral("Number of client connections."), QStringLiteral("count"),
+          QStringLiteral("8")},
+         {QStringLiteral("duration"), QStringLiteral("Run duration in seconds."), QStringLiteral("seconds"),
+          QStringLiteral("10")},
+         {QStringLiteral("payload-size"),
+          QStringLiteral("Answer size for payload, request size for echo, approximate answer size for structured."),
+          QStringLiteral("bytes"), QStringLiteral("0")},
+         {QStringLiteral("no-keep-alive"), QStringLiteral("New connection for each request.")},
+         {QStringLiteral("cbor"), QStringLiteral("Ask structured and status routes for CBOR instead of json.")},
+         {QStringLiteral("server-threads"), QStringLiteral("Server workers count, ideal thread count by default."),
+          QStringLiteral("count"), QStringLiteral("0")},
+         {QStringLiteral("port"), QStringLiteral("Loopback port."), QStringLiteral("port"), QStringLiteral("9200")}});
+    parser.process(QCoreApplication::arguments());
+
+    Options options;
+    options.route = parser.value(QStringLiteral("route"));
+    options.concurrency = qMax(1, parser.value(QStringLiteral("concurrency")).toInt());
+    options.durationMsecs = qMax(1, parser.value(QStringLiteral("duration")).toInt()) * 1000;
+    options.payloadSize = qMax(0, parser.value(QStringLiteral("payload-size")).toInt());
+    options.keepAlive = !parser.isSet(QStringLiteral("no-keep-alive"));
+    options.cbor = parser.isSet(QStringLiteral("cbor"));
+    options.serverThreads = parser.value(QStringLiteral("server-threads")).toInt();
+    options.port = static_cast<quint16>(parser.value(QStringLiteral("port")).toUInt());
+    const QStringList routes = {QStringLiteral("ping"), QStringLiteral("payload"), QStringLiteral("echo"),
+                                QStringLiteral("structured"), QStringLiteral("status")};
+    if (!routes.contains(options.route)) {
+        fprintf(stderr, "Unknown route %s\n", qPrintable(options.route));
+        return 1;
+    }
+
+    BenchmarkRestServer server(options.port);
+    const int serverThreads = options.serverThreads > 0 ? options.serverThreads : QThread::idealThreadCount();
+    server.setSuggestedMaxThreadsCount(serverThreads);
+    server.setMinThreadsCount(serverThreads);
+    server.setKeepAliveEnabled(true);
+    server.startListen();
+    QElapsedTimer startTimer;
+    startTimer.start();
+    while (!server.isListening() && startTimer.elapsed() < IO_TIMEOUT)
+        QThread::msleep(10);
+    if (!server.isListening()) {
+        fprintf(stderr, "Server can't listen on port %d\n", options.port);
+        return 1;
+    }
+
+    const QByteArray request = buildRequest(options);
+    QVector<ClientResult> results(options.concurrency);
+    QVector<QThread *> clients;
+    const qint64 cpuTimeAtStart = processCpuTime();
+    QElapsedTimer runTimer;
+    runTimer.start();
+    for (int i = 0; i < options.concurrency; ++i) {
+        ClientResult *result = &results[i];
+        clients << QThread::create([result, &options, &request] { *result = runClient(options, request); });
+        clients.last()->start();
+    }
+    for (QThread *client : qAsConst(clients)) {
+        client->wait();
+        delete client;
+    }
+    const qint64 elapsed = runTimer.elapsed();
+    const qint64 processCpu = processCpuTime() - cpuTimeAtStart;
+    server.stopListen();
+
+    QVector<qint64> latencies;
+    qint64 errors = 0;
+    qint64 clientsCpu = 0;
+    for (const ClientResult &result : qAsConst(results)) {
+        latencies += result.latencies;
+        errors += result.errors;
+        clientsCpu = (clientsCpu < 0 || result.cpuTime < 0) ? -1 : clientsCpu + result.cpuTime;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    const qint64 requestsCount = latencies.count();
+
+    printf("route: %s, concurrency: %d, keep-alive: %s, payload size: %d, cbor: %s, server threads: %d\n",
+           qPrintable(options.route), options.concurrency, options.keepAlive ? "on" : "off", options.payloadSize,
+           options.cbor ? "on" : "off", serverThreads);
+    printf("requests: %lld, errors: %lld, duration: %.2f s\n", requestsCount, errors, elapsed / 1000.0);
+    printf("requests/sec: %.1f\n", elapsed ? requestsCount * 1000.0 / elapsed : 0.0);
+    printf("latency us: p50 %lld, p99 %lld, p999 %lld, max %lld\n", percentile(latencies, 0.5),
+           percentile(latencies, 0.99), percentile(latencies, 0.999), latencies.isEmpty() ? 0ll : latencies.last());
+    if (requestsCount) {
+        printf("cpu us per request: process %.1f", static_cast<double>(processCpu) / requestsCount);
+        if (clientsCpu >= 0)
+            printf(", server %.1f", static_cast<double>(processCpu - clientsCpu) / requestsCount);
+        printf("\n");
+    }
+    return errors ? 2 : 0;
+}
+
+#include "restserver_benchmark.moc"
@@ -0,0 +1,256 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+// Replays traffic captured by AbstractRestServer::setTrafficCapture() against a server.
+// Requests are sent at original pace scaled by speed factor, each over its own connection. HTTP/2 requests are
+// replayed as HTTP/1.1 ones.
+
+#include "proofcore/coreapplication.h"
+
+#include "proofnetwork/trafficcapture.h"
+
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QMap>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+static constexpr int REQUEST_TIMEOUT = 30000;
+
+namespace {
+
+struct Options
+{
+    QString host;
+    quint16 port = 80;
+    double speed = 1.0;
+    int maxInFlight = 64;
+    QStringList overriddenHeaders;
+};
+
+class Replayer : public QObject
+{
+    Q_OBJECT
+public:
+    Replayer(const Options &options, const QVector<Proof::TrafficCaptureRecord> &records)
+        : m_options(options), m_records(records)
+    {}
+
+    void start()
+    {
+        m_timer.start();
+        sendDueRequests();
+    }
+
+    void printReport() const
+    {
+        QVector<qint64> latencies = m_latencies;
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double fraction) -> qint64 {
+            if (latencies.isEmpty())
+                return 0;
+            const int index = static_cast<int>(std::ceil(fraction * latencies.count())) - 1;
+            return latencies[qBound(0, index, latencies.count() - 1)];
+        };
+        const qint64 elapsed = m_timer.elapsed();
+        printf("requests: %d, answered: %d, errors: %d, duration: %.2f s\n", m_records.count(), latencies.count(),
+               m_errors, elapsed / 1000.0);
+        printf("requests/sec: %.1f, max send lag: %lld ms\n", elapsed ? latencies.count() * 1000.0 / elapsed : 0.0,
+               m_maxLag);
+        printf("latency ms: p50 %lld, p99 %lld, p999 %lld\n", percentile(0.5), percentile(0.99), percentile(0.999));
+        for (auto it = m_statuses.cbegin(); it != m_statuses.cend(); ++it)
+            printf("status %d: %d\n", it.key(), it.value());
+    }
+
+signals:
+    void finished();
+
+private:
+    void sendDueRequests()
+    {
+        while (m_next < m_records.count() && m_inFlight < m_options.maxInFlight) {
+            const qint64 due = m_options.speed > 0
+                                   ? static_cast<qint64>((m_records[m_next].timestamp - m_records[0].timestamp)
+                                                         / m_options.speed)
+                                   : 0;
+            const qint64 delay = due - m_timer.elapsed();
+            if (delay > 0) {
+                if (!m_waiting) {
+                    m_waiting = true;
+                    QTimer::singleShot(static_cast<int>(delay), this, [this] {
+                        m_waiting = false;
+                        sendDueRequests();
+                    });
+                }
+                return;
+            }
+            m_maxLag = qMax(m_maxLag, -delay);
+            send(m_records[m_next++]);
+        }
+        if (m_next == m_records.count() && !m_inFlight)
+            emit finished();
+    }
+
+    QByteArray buildRequest(const Proof::TrafficCaptureRecord &record) const
+    {
+        auto headerName = [](const QString &header) { return header.section(':', 0, 0).trimmed().toLower(); };
+        QStringList skippedHeaders = {QStringLiteral("connection"), QStringLiteral("content-length"),
+                                      QStringLiteral("host")};
+        for (const QString &header : m_options.overriddenHeaders)
+            skippedHeaders << headerName(header);
+
+        QByteArray result = QStringLiteral("%1 %2 HTTP/1.1\r\nHost: %3:%4\r\n")
+                                .arg(record.method, record.uri, m_options.host, QString::number(m_options.port))
+                                .toUtf8();
+        for (const QString &header : record.headers) {
+            // HTTP/2 pseudo headers
+            if (!header.startsWith(':') && !skippedHeaders.contains(headerName(header)))
+                result += header.toUtf8() + "\r\n";
+        }
+        for (const QString &header : m_options.overriddenHeaders)
+            result += header.toUtf8() + "\r\n";
+        if (!record.body.isEmpty())
+            result += "Content-Length: " + QByteArray::number(record.body.size()) + "\r\n";
+        return result + "Connection: close\r\n\r\n" + record.body;
+    }
+
+    void send(const Proof::TrafficCaptureRecord &record)
+    {
+        ++m_inFlight;
+        auto socket = new QTcpSocket(this);
+        auto answer = QSharedPointer<QByteArray>::create();
+        auto done = QSharedPointer<bool>::create(false);
+        QElapsedTimer latencyTimer;
+        latencyTimer.start();
+        const QByteArray request = buildRequest(record);
+
+        auto finish = [this, socket, answer, done, latencyTimer]() {
+            if (*done)
+                return;
+            *done = true;
+            answer->append(socket->readAll());
+            bool ok = false;
+            const int status = answer->startsWith("HTTP/1.") ? answer->mid(9, 3).toInt(&ok) : 0;
+            if (ok) {
+                ++m_statuses[status];
+                m_latencies << latencyTimer.elapsed();
+            } else {
+                ++m_errors;
+            }
+            socket->deleteLater();
+            --m_inFlight;
+            QTimer::singleShot(0, this, [this] { sendDueRequests(); });
+        };
+
+        connect(socket, &QTcpSocket::connected, socket, [socket, request] { socket->write(request); });
+        connect(socket, &QTcpSocket::readyRead, socket, [socket, answer] { answer->append(socket->readAll()); });
+        connect(socket, &QTcpSocket::disconnected, this, finish);
+        connect(socket, qOverload<QAbstractSocket::SocketError>(&QAbstractSocket::error), this, finish);
+        QTimer::singleShot(REQUEST_TIMEOUT, socket, [socket, finish] {
+            socket->abort();
+            finish();
+        });
+        socket->connectToHost(m_options.host, m_options.port);
+    }
+
+    Options m_options;
+    QVector<Proof::TrafficCaptureRecord> m_records;
+    QElapsedTimer m_timer;
+    QVector<qint64> m_latencies;
+    QMap<int, int> m_statuses;
+    int m_next = 0;
+    int m_inFlight = 0;
+    int m_errors = 0;
+    qint64 m_maxLag = 0;
+    bool m_waiting = false;
+};
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Proof::CoreApplication app(argc, argv, QStringLiteral("Opensoft"), QStringLiteral("restserver_replay"));
+    QLoggingCategory::setFilterRules(QStringLiteral("proof.*=false"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Replays traffic captured by AbstractRestServer"));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("capture"), QStringLiteral("Capture file."));
+    parser.addOptions(
+        {{QStringLiteral("host"), QStringLiteral("Server host."), QStringLiteral("host"), QStringLiteral("127.0.0.1")},
+         {QStringLiteral("port"), QStringLiteral("Server port."), QStringLiteral("port"), QStringLiteral("80")},
+         {QStringLiteral("speed"), QStringLiteral("Pace multiplier, 0 sends everything at once."),
+          QStringLiteral("factor"), QStringLiteral("1")},
+         {QStringLiteral("max-in-flight"), QStringLiteral("Max number of concurrent requests."),
+          QStringLiteral("count"), QStringLiteral("64")},
+         {QStringLiteral("header"),
+          QStringLiteral("Header to send instead of captured one with the same name (e.g. for redacted auth), "
+                         "can be repeated."),
+          QStringLiteral("header")}});
+    parser.process(QCoreApplication::arguments());
+    if (parser.positionalArguments().count() != 1)
+        parser.showHelp(1);
+
+    Options options;
+    options.host = parser.value(QStringLiteral("host"));
+    options.port = static_cast<quint16>(parser.value(QStringLiteral("port")).toUInt());
+    options.speed = qMax(0.0, parser.value(QStringLiteral("speed")).toDouble());
+    options.maxInFlight = qMax(1, parser.value(QStringLiteral("max-in-flight")).toInt());
+    options.overriddenHeaders = parser.values(QStringLiteral("header"));
+
+    QFile file(parser.positionalArguments().constFirst());
+    if (!file.open(QIODevice::ReadOnly) || !Proof::TrafficCapture::readFileHeader(&file)) {
+        fprintf(stderr, "Can't read capture file %s\n", qPrintable(file.fileName()));
+        return 1;
+    }
+    QVector<Proof::TrafficCaptureRecord> records;
+    Proof::TrafficCaptureRecord record;
+    while (Proof::TrafficCapture::readRecord(&file, record))
+        records << record;
+    if (!file.atEnd())
+        fprintf(stderr, "Capture file has truncated record at the end, it is skipped\n");
+    if (records.isEmpty()) {
+        fprintf(stderr, "Capture file is empty\n");
+        return 1;
+    }
+    // Several runs can be appended to the same file and the order of concurrent requests is not strict
+    std::stable_sort(records.begin(), records.end(),
+                     [](const auto &left, const auto &right) { return left.timestamp < right.timestamp; });
+
+    Replayer replayer(options, records);
+    QObject::connect(&replayer, &Replayer::finished, qApp, [&replayer] {
+        replayer.printReport();
+        QCoreApplication::quit();
+    });
+    QTimer::singleShot(0, &replayer, [&replayer] { replayer.start(); });
+    return QCoreApplication::exec();
+}
+
+#include "restserver_replay.moc"
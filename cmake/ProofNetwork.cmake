@@ -6,8 +6,17 @@ proof_add_target_sources(Network
     src/proofnetwork/qmlwrappers/networkdataentityqmlwrapper.cpp
     src/proofnetwork/proofnetwork_init.cpp
     src/proofnetwork/abstractrestserver.cpp
+    src/proofnetwork/accesslog.cpp
+    src/proofnetwork/httpcache.cpp
     src/proofnetwork/urlquerybuilder.cpp
     src/proofnetwork/httpparser.cpp
+    src/proofnetwork/multipartparser.cpp
+    src/proofnetwork/hpack.cpp
+    src/proofnetwork/http2session.cpp
+    src/proofnetwork/localsocketreply.cpp
+    src/proofnetwork/ratelimiter.cpp
+    src/proofnetwork/requestcancellation.cpp
+    src/proofnetwork/trafficcapture.cpp
     src/proofnetwork/proofservicerestapi.cpp
     src/proofnetwork/abstractamqpclient.cpp
     src/proofnetwork/jsonamqpclient.cpp
@@ -32,6 +41,7 @@ proof_add_target_headers(Network
     include/proofnetwork/proofnetwork_types.h
     include/proofnetwork/qmlwrappers/networkdataentityqmlwrapper.h
     include/proofnetwork/abstractrestserver.h
+    include/proofnetwork/trafficcapture.h
     include/proofnetwork/urlquerybuilder.h
     include/proofnetwork/proofservicerestapi.h
     include/proofnetwork/abstractamqpclient.h
@@ -56,7 +66,16 @@ proof_add_target_private_headers(Network
     include/private/proofnetwork/user_p.h
     include/private/proofnetwork/qmlwrappers/userqmlwrapper_p.h
     include/private/proofnetwork/urlquerybuilder_p.h
+    include/private/proofnetwork/accesslog_p.h
+    include/private/proofnetwork/httpcache_p.h
     include/private/proofnetwork/httpparser_p.h
+    include/private/proofnetwork/multipartparser_p.h
+    include/private/proofnetwork/hpack_p.h
+    include/private/proofnetwork/http2session_p.h
+    include/private/proofnetwork/localsocketreply_p.h
+    include/private/proofnetwork/ratelimiter_p.h
+    include/private/proofnetwork/requestcancellation_p.h
+    include/private/proofnetwork/trafficcapture_p.h
     include/private/proofnetwork/proofservicerestapi_p.h
     include/private/proofnetwork/abstractamqpclient_p.h
     include/private/proofnetwork/jsonamqpclient_p.h
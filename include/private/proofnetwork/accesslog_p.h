@@ -0,0 +1,112 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef PROOF_ACCESSLOG_P_H
+#define PROOF_ACCESSLOG_P_H
+
+#include <QFile>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QThread>
+#include <QVector>
+
+#include <atomic>
+#include <vector>
+
+namespace Proof {
+
+struct AccessLogRecord
+{
+    // Msecs since epoch when request started
+    qint64 time = 0;
+    QString peer;
+    QString method;
+    QString path;
+    int status = 0;
+    qint64 bytes = 0;
+    // Usecs
+    qint64 latency = 0;
+    QString requestId;
+};
+
+// Ring buffer with single producer (worker thread) and single consumer (writer thread), neither of them blocks.
+// Records are dropped if buffer is full
+class AccessLogBuffer
+{
+public:
+    // Capacity is rounded up to power of two
+    explicit AccessLogBuffer(int capacity);
+    AccessLogBuffer(const AccessLogBuffer &other) = delete;
+    AccessLogBuffer &operator=(const AccessLogBuffer &other) = delete;
+
+    bool push(AccessLogRecord &&record);
+    bool pop(AccessLogRecord &record);
+
+    // Producer is gone, buffer is removed after it is drained
+    void close();
+    bool isClosed() const;
+    qint64 droppedCount() const;
+
+private:
+    std::vector<AccessLogRecord> m_records;
+    quint64 m_mask = 0;
+    // Written only by consumer
+    std::atomic<quint64> m_head{0};
+    // Written only by producer
+    std::atomic<quint64> m_tail{0};
+    std::atomic_llong m_droppedCount{0};
+    std::atomic_bool m_closed{false};
+};
+
+// Drains all buffers periodically in its own thread and appends records to file as json lines, one write per batch
+class AccessLogWriter : public QThread
+{
+public:
+    explicit AccessLogWriter(const QString &filePath);
+    ~AccessLogWriter();
+
+    bool open();
+    QString errorString() const;
+    QSharedPointer<AccessLogBuffer> createBuffer();
+    // Remaining records are written before thread finishes
+    void stop();
+    qint64 droppedCount() const;
+
+protected:
+    void run() override;
+
+private:
+    void drain();
+
+    QFile m_file;
+    mutable QMutex m_buffersMutex;
+    QVector<QSharedPointer<AccessLogBuffer>> m_buffers;
+    qint64 m_closedBuffersDroppedCount = 0;
+    std::atomic_bool m_stopRequested{false};
+};
+
+} // namespace Proof
+
+#endif // PROOF_ACCESSLOG_P_H
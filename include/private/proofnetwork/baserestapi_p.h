@@ -39,6 +39,9 @@
 #include <QJsonObject>
 #include <QJsonParseError>
 
+#include <atomic>
+#include <functional>
+
 namespace Proof {
 
 class BaseRestApi;
@@ -48,17 +51,49 @@ class PROOF_NETWORK_EXPORT BaseRestApiPrivate : public ProofObjectPrivate
 public:
     BaseRestApiPrivate() : ProofObjectPrivate() {}
 
+    struct RetryState
+    {
+        std::function<CancelableFuture<QNetworkReply *>()> send;
+        RestRetryPolicy policy;
+        QString host;
+        int retries = 0;
+    };
+
     CancelableFuture<RestApiReply> configureReply(CancelableFuture<QNetworkReply *> replyFuture);
+    // send is called again for each retry
+    CancelableFuture<RestApiReply>
+    configureRetriableReply(const std::function<CancelableFuture<QNetworkReply *>()> &send, bool idempotent);
+    void handleReplyFuture(const CancelableFuture<QNetworkReply *> &replyFuture, const PromiseSP<RestApiReply> &promise,
+                           const QSharedPointer<RetryState> &retryState);
+    bool retryIfNeeded(QNetworkReply *reply, const PromiseSP<RestApiReply> &promise,
+                       const QSharedPointer<RetryState> &retryState);
+    qint64 retryDelay(QNetworkReply *reply, const QSharedPointer<RetryState> &retryState) const;
     bool replyShouldBeHandledByError(QNetworkReply *reply) const;
     Failure buildReplyFailure(QNetworkReply *reply);
     bool pingExternalResource(const QString &address);
     void rememberReply(const CancelableFuture<RestApiReply> &reply);
 
+    struct InFlightRequest
+    {
+        PromiseSP<RestApiReply> promise = PromiseSP<RestApiReply>::create();
+        std::function<void()> cancelUpstream;
+        int waiters = 0;
+    };
+    CancelableFuture<RestApiReply> coalescedGet(const QString &method, const QUrlQuery &query,
+                                                RestRequestPriority priority);
+    QByteArray coalescingKey(const QString &method, const QUrlQuery &query) const;
+    void forgetInFlightRequest(const QByteArray &key, const QSharedPointer<InFlightRequest> &flight);
+    void releaseInFlightRequest(const QByteArray &key, const QSharedPointer<InFlightRequest> &flight);
+
     RestClientSP restClient;
+    std::atomic_bool requestCoalescingEnabled{false};
+    RestRetryPolicy retryPolicy;
 
 private:
     QHash<qint64, CancelableFuture<RestApiReply>> allReplies;
     SpinLock allRepliesLock;
+    QHash<QByteArray, QSharedPointer<InFlightRequest>> inFlightRequests;
+    SpinLock inFlightRequestsLock;
 };
 } // namespace Proof
 #endif // BASERESTAPI_P_H
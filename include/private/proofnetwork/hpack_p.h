@@ -0,0 +1,106 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef PROOF_HPACK_P_H
+#define PROOF_HPACK_P_H
+
+#include <QByteArray>
+#include <QPair>
+#include <QVector>
+
+#include <deque>
+
+namespace Proof {
+
+using HpackHeader = QPair<QByteArray, QByteArray>;
+using HpackHeaders = QVector<HpackHeader>;
+
+// Static and dynamic header tables from RFC 7541 addressed with single index space
+class HpackTable
+{
+public:
+    explicit HpackTable(quint32 maxSize = 4096);
+
+    bool entry(quint32 index, HpackHeader &result) const;
+    // Returns index of full match, or negated index of name-only match, or 0 if nothing found
+    int find(const HpackHeader &header) const;
+    void add(const HpackHeader &header);
+
+    quint32 maxSize() const;
+    void setMaxSize(quint32 maxSize);
+
+    static quint32 entrySize(const HpackHeader &header);
+
+private:
+    void evict(quint32 neededSpace);
+
+    // Newest entries are at the front, they have lowest dynamic indices
+    std::deque<HpackHeader> m_entries;
+    quint32 m_size = 0;
+    quint32 m_maxSize = 0;
+};
+
+class HpackDecoder
+{
+public:
+    explicit HpackDecoder(quint32 maxTableSize = 4096);
+
+    // Header block must be decoded as a whole, even for refused streams, to keep dynamic table in sync
+    bool decode(const QByteArray &block, HpackHeaders &headers);
+
+private:
+    HpackTable m_table;
+    quint32 m_maxAllowedTableSize;
+};
+
+class HpackEncoder
+{
+public:
+    explicit HpackEncoder(quint32 maxTableSize = 4096);
+
+    QByteArray encode(const HpackHeaders &headers);
+    // Called when peer changes SETTINGS_HEADER_TABLE_SIZE, update is signalled at start of next header block
+    void setMaxTableSize(quint32 maxTableSize);
+
+private:
+    HpackTable m_table;
+    quint32 m_tableSizeLimit;
+    quint32 m_pendingTableSize = 0;
+    quint32 m_smallestPendingTableSize = 0;
+    bool m_tableSizeChanged = false;
+};
+
+namespace hpack {
+void encodeInteger(QByteArray &out, quint32 value, int prefixBits, quint8 firstByteFlags);
+bool decodeInteger(const char *&data, const char *end, int prefixBits, quint32 &value);
+void encodeString(QByteArray &out, const QByteArray &value);
+bool decodeString(const char *&data, const char *end, QByteArray &value);
+QByteArray huffmanEncode(const QByteArray &data);
+bool huffmanDecode(const char *data, int size, QByteArray &result);
+int huffmanEncodedSize(const QByteArray &data);
+} // namespace hpack
+
+} // namespace Proof
+
+#endif // PROOF_HPACK_P_H
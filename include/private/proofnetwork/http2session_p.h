@@ -0,0 +1,130 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef PROOF_HTTP2SESSION_P_H
+#define PROOF_HTTP2SESSION_P_H
+
+#include "proofnetwork/hpack_p.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+namespace Proof {
+
+struct Http2Request
+{
+    quint32 streamId = 0;
+    QString method;
+    QString path;
+    QStringList headers;
+    QByteArray body;
+};
+
+// Server side of HTTP/2 connection with prior knowledge (RFC 7540), it doesn't touch sockets itself.
+// Received bytes are fed to processIncoming(), bytes that should be sent are collected with takeOutgoing().
+class Http2Session
+{
+public:
+    static QByteArray connectionPreface();
+
+    explicit Http2Session(quint32 maxConcurrentStreams);
+    Http2Session(const Http2Session &other) = delete;
+    Http2Session &operator=(const Http2Session &other) = delete;
+
+    // Returns false on connection error, GOAWAY is queued to outgoing data in this case
+    bool processIncoming(const QByteArray &data);
+    QVector<Http2Request> takeRequests();
+    // Streams reset by client, work started for their requests is not needed anymore
+    QVector<quint32> takeResetStreams();
+    QByteArray takeOutgoing();
+
+    // Headers names must be lowercase. Responses to reset streams are dropped
+    void sendResponse(quint32 streamId, int status, const HpackHeaders &headers, const QByteArray &body);
+
+    // Connection can be closed once everything is sent
+    bool isFinished() const;
+    QString error() const;
+
+private:
+    struct Stream
+    {
+        QString method;
+        QString path;
+        QStringList headers;
+        QByteArray body;
+        qint64 sendWindow = 0;
+        qint64 receiveWindowConsumed = 0;
+        bool requestReceived = false;
+        bool responseSent = false;
+        QByteArray pendingData;
+        int pendingDataOffset = 0;
+    };
+
+    bool handleFrame(quint8 type, quint8 flags, quint32 streamId, const QByteArray &payload);
+    bool handleData(quint8 flags, quint32 streamId, const QByteArray &payload);
+    bool handleHeaders(quint8 flags, quint32 streamId, const QByteArray &payload);
+    bool handleContinuation(quint8 flags, quint32 streamId, const QByteArray &payload);
+    bool handleSettings(quint8 flags, quint32 streamId, const QByteArray &payload);
+    bool handleWindowUpdate(quint32 streamId, const QByteArray &payload);
+    bool handleHeaderBlock();
+    bool stripPadding(quint8 flags, QByteArray &payload);
+    void completeRequest(quint32 streamId, Stream &stream);
+    void flushStream(quint32 streamId);
+    void flushAllStreams();
+
+    void writeFrame(quint8 type, quint8 flags, quint32 streamId, const char *payload, int size);
+    void writeFrame(quint8 type, quint8 flags, quint32 streamId, const QByteArray &payload = QByteArray());
+    void writeWindowUpdate(quint32 streamId, quint32 increment);
+    void resetStream(quint32 streamId, quint32 errorCode);
+    bool connectionError(quint32 errorCode, const QString &message);
+
+    HpackDecoder m_decoder;
+    HpackEncoder m_encoder;
+    QHash<quint32, Stream> m_streams;
+    QVector<Http2Request> m_requests;
+    QVector<quint32> m_resetStreams;
+    QByteArray m_incoming;
+    QByteArray m_outgoing;
+    QByteArray m_headerBlock;
+    QString m_error;
+
+    quint32 m_maxConcurrentStreams;
+    quint32 m_lastStreamId = 0;
+    quint32 m_headerBlockStreamId = 0;
+    quint8 m_headerBlockFlags = 0;
+    quint32 m_peerMaxFrameSize;
+    qint64 m_peerInitialWindowSize;
+    qint64 m_sendWindow;
+    qint64 m_receiveWindowConsumed = 0;
+    bool m_prefaceReceived = false;
+    bool m_settingsReceived = false;
+    bool m_goAwayReceived = false;
+    bool m_goAwaySent = false;
+};
+
+} // namespace Proof
+
+#endif // PROOF_HTTP2SESSION_P_H
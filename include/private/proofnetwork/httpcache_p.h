@@ -0,0 +1,108 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef PROOF_HTTPCACHE_P_H
+#define PROOF_HTTPCACHE_P_H
+
+#include <QAbstractNetworkCache>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QNetworkDiskCache>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QUrl>
+#include <QVariantMap>
+
+#include <atomic>
+
+namespace Proof {
+
+// Storage shared by caches of all network threads. Memory tier is LRU with size budget, optional disk tier is
+// QNetworkDiskCache used as write-through second level, entries read from it are promoted back to memory
+class HttpCacheStorage
+{
+public:
+    HttpCacheStorage(qint64 memoryBudget, const QString &diskDirectory, qint64 diskBudget);
+    HttpCacheStorage(const HttpCacheStorage &other) = delete;
+    HttpCacheStorage &operator=(const HttpCacheStorage &other) = delete;
+
+    QNetworkCacheMetaData metaData(const QUrl &url);
+    void updateMetaData(const QNetworkCacheMetaData &metaData);
+    // False if there is no such entry
+    bool data(const QUrl &url, QByteArray &result);
+    void insert(const QNetworkCacheMetaData &metaData, const QByteArray &data);
+    bool remove(const QUrl &url);
+    qint64 cacheSize() const;
+    void clear();
+
+    void countReply(bool fromCache);
+    QVariantMap statistics() const;
+
+private:
+    struct MemoryEntry
+    {
+        QNetworkCacheMetaData metaData;
+        QByteArray data;
+    };
+
+    void insertToMemory(const QNetworkCacheMetaData &metaData, const QByteArray &data);
+
+    mutable QMutex m_mutex;
+    QCache<QUrl, MemoryEntry> m_memory;
+    QScopedPointer<QNetworkDiskCache> m_disk;
+
+    std::atomic_llong m_hits{0};
+    std::atomic_llong m_misses{0};
+    std::atomic_llong m_revalidations{0};
+    std::atomic_llong m_diskHits{0};
+};
+
+// Per-thread facade for QNetworkAccessManager, it can't be shared because cache is owned by manager
+class HttpCache : public QAbstractNetworkCache
+{
+    Q_OBJECT
+public:
+    explicit HttpCache(const QSharedPointer<HttpCacheStorage> &storage, QObject *parent = nullptr);
+    ~HttpCache();
+
+    QNetworkCacheMetaData metaData(const QUrl &url) override;
+    void updateMetaData(const QNetworkCacheMetaData &metaData) override;
+    QIODevice *data(const QUrl &url) override;
+    bool remove(const QUrl &url) override;
+    qint64 cacheSize() const override;
+    QIODevice *prepare(const QNetworkCacheMetaData &metaData) override;
+    void insert(QIODevice *device) override;
+
+public slots:
+    void clear() override;
+
+private:
+    QSharedPointer<HttpCacheStorage> m_storage;
+    QHash<QIODevice *, QNetworkCacheMetaData> m_preparedDevices;
+};
+
+} // namespace Proof
+
+#endif // PROOF_HTTPCACHE_P_H
@@ -25,11 +25,16 @@
 #ifndef PROOF_HTTPPARSER_P_H
 #define PROOF_HTTPPARSER_P_H
 
+#include "proofnetwork/abstractrestserver.h"
+
 #include <QByteArray>
+#include <QSharedPointer>
 #include <QStringList>
 
 namespace Proof {
 
+class MultipartParser;
+
 class HttpParser
 {
 public:
@@ -42,11 +47,18 @@ public:
 
     HttpParser();
     Result parseNextPart(QByteArray data);
+    // Bytes received after complete request (pipelined requests), they belong to next request
+    QByteArray takeUnparsedData();
+    // multipart/form-data bodies are passed to multipart parser chunk by chunk instead of being accumulated
+    void setFormDataStreaming(qint64 maxPartSize, qint64 inMemoryPartSize);
 
     QString method() const;
     QString uri() const;
+    // 0 for HTTP/1.0 and 1 for HTTP/1.1
+    int httpMinorVersion() const;
     QStringList headers() const;
     QByteArray body() const;
+    QVector<RestFormDataPart> formDataParts() const;
 
     QString error() const;
 
@@ -61,9 +73,16 @@ private:
     State m_state = &HttpParser::initialState;
     QByteArray m_data;
     qulonglong m_contentLength = 0;
+    qulonglong m_bodyReceived = 0;
+    QString m_contentType;
+    qint64 m_formDataMaxPartSize = 0;
+    qint64 m_formDataInMemoryPartSize = 0;
+    QSharedPointer<MultipartParser> m_multipartParser;
     QString m_method;
     QString m_uri;
+    int m_httpMinorVersion = 1;
     QStringList m_headers;
+    QByteArray m_unparsedData;
     QString m_error;
 };
 
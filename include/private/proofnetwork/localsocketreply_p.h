@@ -0,0 +1,69 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef PROOF_LOCALSOCKETREPLY_P_H
+#define PROOF_LOCALSOCKETREPLY_P_H
+
+#include <QLocalSocket>
+#include <QNetworkReply>
+
+namespace Proof {
+
+// Minimal HTTP/1.1 client over QLocalSocket, used by RestClient for services on the same host
+class LocalSocketReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    LocalSocketReply(const QString &socketPath, const QNetworkRequest &request, const QByteArray &verb,
+                     const QByteArray &body, QObject *parent = nullptr);
+    ~LocalSocketReply();
+
+    void abort() override;
+    qint64 bytesAvailable() const override;
+    bool isSequential() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+
+private:
+    void onConnected();
+    void onReadyRead();
+    void onDisconnected();
+    void onSocketError();
+    bool parseHead();
+    void finishReply();
+    void failReply(QNetworkReply::NetworkError code, const QString &message);
+
+    QLocalSocket *m_socket = nullptr;
+    QByteArray m_requestData;
+    QByteArray m_incoming;
+    QByteArray m_content;
+    qint64 m_readPosition = 0;
+    qint64 m_contentLength = -1;
+    bool m_headParsed = false;
+};
+
+} // namespace Proof
+
+#endif // PROOF_LOCALSOCKETREPLY_P_H
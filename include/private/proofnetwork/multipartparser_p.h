@@ -0,0 +1,93 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef PROOF_MULTIPARTPARSER_P_H
+#define PROOF_MULTIPARTPARSER_P_H
+
+#include "proofnetwork/abstractrestserver.h"
+
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+namespace Proof {
+
+// Incremental multipart/form-data parser (RFC 7578).
+// Keeps in memory only a tail that can be a beginning of delimiter, part data goes to QBuffer until it grows
+// bigger than inMemoryPartSize and to temporary file after that. Parts are also spilled to temporary files
+// once all parts kept in memory together would exceed IN_MEMORY_PARTS_BUDGET_FACTOR * inMemoryPartSize.
+// Bodies with more than MAX_PARTS_COUNT parts are rejected.
+class MultipartParser
+{
+public:
+    enum class Result
+    {
+        NeedMore,
+        Error,
+        Finished
+    };
+
+    static constexpr int MAX_PARTS_COUNT = 128;
+    static constexpr qint64 IN_MEMORY_PARTS_BUDGET_FACTOR = 16;
+
+    MultipartParser(const QByteArray &boundary, qint64 maxPartSize, qint64 inMemoryPartSize);
+    MultipartParser(const MultipartParser &other) = delete;
+    MultipartParser &operator=(const MultipartParser &other) = delete;
+
+    Result feed(const QByteArray &data);
+
+    QVector<RestFormDataPart> parts() const;
+    QString error() const;
+
+    // Empty if content type is not multipart/form-data or has no boundary
+    static QByteArray boundaryFromContentType(const QString &contentType);
+
+private:
+    Result preambleState();
+    Result delimiterEndState();
+    Result headersState();
+    Result dataState();
+    Result finishedState();
+    Result errorState();
+    Result fail(const QString &error);
+    bool writePartData(const char *data, int size);
+    bool finishPart();
+
+    using State = Result (MultipartParser::*)();
+
+    State m_state = &MultipartParser::preambleState;
+    const QByteArray m_delimiter;
+    const qint64 m_maxPartSize;
+    const qint64 m_inMemoryPartSize;
+    qint64 m_inMemoryPartsSize = 0;
+    QByteArray m_buffer;
+    RestFormDataPart m_currentPart;
+    QVector<RestFormDataPart> m_parts;
+    QString m_error;
+};
+
+} // namespace Proof
+
+#endif // PROOF_MULTIPARTPARSER_P_H
@@ -0,0 +1,76 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef PROOF_RATELIMITER_P_H
+#define PROOF_RATELIMITER_P_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QtGlobal>
+
+#include <array>
+#include <atomic>
+
+namespace Proof {
+
+// Token buckets stored in open-addressed hash table of atomics, keyed by full 64-bit key.
+// When all slots near the key are taken the least recently used of them is given to the new key,
+// so only keys idle for longest lose their state under high cardinality.
+class RateLimiter
+{
+public:
+    RateLimiter();
+    RateLimiter(const RateLimiter &other) = delete;
+    RateLimiter &operator=(const RateLimiter &other) = delete;
+
+    // Returns 0 if request can be processed or amount of msecs before next token will be available
+    qint64 acquire(quint64 key, double requestsPerSecond, int burst);
+
+    template <typename T>
+    static quint64 key(const T &value, uint seed = 0)
+    {
+        return (static_cast<quint64>(qHash(value, seed)) << 32) | qHash(value, ~seed);
+    }
+
+private:
+    static constexpr int BUCKETS_COUNT = 4096;
+    static constexpr int PROBES_COUNT = 16;
+
+    struct Bucket
+    {
+        // Zero is reserved for empty slot
+        std::atomic<quint64> key;
+        // Higher 32 bits - msecs since limiter creation, lower 32 bits - tokens count multiplied by 1000
+        std::atomic<quint64> state;
+    };
+
+    std::atomic<quint64> &findState(quint64 key, quint32 now);
+
+    std::array<Bucket, BUCKETS_COUNT> m_buckets;
+    QElapsedTimer m_timer;
+};
+
+} // namespace Proof
+
+#endif // PROOF_RATELIMITER_P_H
@@ -0,0 +1,79 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef PROOF_REQUESTCANCELLATION_P_H
+#define PROOF_REQUESTCANCELLATION_P_H
+
+#include "proofseed/spinlock.h"
+
+#include <QSharedPointer>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace Proof {
+
+// Shared by all copies of RestConnection handle of one request.
+// Canceled by connection owner if client disconnects before answer is sent, finished once answer is sent.
+class RequestCancellation
+{
+public:
+    // Makes request current for calling thread while rest method is called synchronously
+    class Scope
+    {
+    public:
+        explicit Scope(const QSharedPointer<RequestCancellation> &cancellation);
+        ~Scope();
+        Scope(const Scope &other) = delete;
+        Scope &operator=(const Scope &other) = delete;
+
+    private:
+        QSharedPointer<RequestCancellation> m_previous;
+    };
+
+    RequestCancellation() = default;
+    RequestCancellation(const RequestCancellation &other) = delete;
+    RequestCancellation &operator=(const RequestCancellation &other) = delete;
+
+    bool isCanceled() const;
+    // Callback is called right away if request is canceled already and dropped if it is finished
+    void addCallback(std::function<void()> &&callback);
+    // Returns false if request was already canceled or finished
+    bool cancel();
+    void finish();
+
+    // Null if no rest method is being called in current thread
+    static QSharedPointer<RequestCancellation> current();
+
+private:
+    SpinLock m_lock;
+    std::vector<std::function<void()>> m_callbacks;
+    std::atomic_bool m_canceled{false};
+    bool m_finished = false;
+};
+
+} // namespace Proof
+
+#endif // PROOF_REQUESTCANCELLATION_P_H
@@ -0,0 +1,75 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef PROOF_TRAFFICCAPTURE_P_H
+#define PROOF_TRAFFICCAPTURE_P_H
+
+#include "proofnetwork/trafficcapture.h"
+
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QVector>
+
+#include <atomic>
+#include <functional>
+
+namespace Proof {
+
+// Collects records from worker threads and appends them to capture file in its own thread, one write per batch.
+// Redactor is called in writer thread. Records are dropped if writer can't keep up and too many records or bytes
+// are pending
+class TrafficCaptureWriter : public QThread
+{
+public:
+    TrafficCaptureWriter(const QString &filePath, const std::function<void(TrafficCaptureRecord &)> &redactor);
+    ~TrafficCaptureWriter();
+
+    bool open();
+    QString errorString() const;
+    void push(TrafficCaptureRecord &&record);
+    // Remaining records are written before thread finishes
+    void stop();
+    qint64 droppedCount() const;
+
+protected:
+    void run() override;
+
+private:
+    void drain();
+
+    QFile m_file;
+    std::function<void(TrafficCaptureRecord &)> m_redactor;
+    QMutex m_pendingMutex;
+    QVector<TrafficCaptureRecord> m_pending;
+    // Approximate size of pending records, guarded by m_pendingMutex
+    qint64 m_pendingBytes = 0;
+    std::atomic_llong m_droppedCount{0};
+    std::atomic_bool m_stopRequested{false};
+};
+
+} // namespace Proof
+
+#endif // PROOF_TRAFFICCAPTURE_P_H
@@ -31,6 +31,7 @@
 #include <QDateTime>
 #include <QMultiMap>
 #include <QString>
+#include <QVector>
 
 namespace Proof {
 class MemoryStorageNotificationHandlerPrivate;
@@ -39,9 +40,20 @@ class PROOF_CORE_EXPORT MemoryStorageNotificationHandler : public AbstractNotifi
     Q_OBJECT
     Q_DECLARE_PRIVATE(MemoryStorageNotificationHandler)
 public:
+    struct Message
+    {
+        // Sequential number of message, never reused
+        qint64 id = 0;
+        QDateTime time;
+        QString text;
+    };
+
     MemoryStorageNotificationHandler(const QString &appId);
 
     QMultiMap<QDateTime, QString> messages() const;
+    // Messages with id greater than sinceId, newest first. If limit is positive only that many messages right after
+    // sinceId are returned (newest ones if sinceId is zero), so next call with biggest received id has no gaps
+    QVector<Message> messagesSince(qint64 sinceId, int limit = -1) const;
     QPair<QDateTime, QString> lastMessage() const;
 
     void notify(const QString &message, ErrorNotifier::Severity severity, const QString &packId) override;
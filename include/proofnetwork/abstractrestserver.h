@@ -30,10 +30,20 @@
 #include "proofnetwork/proofnetwork_global.h"
 #include "proofnetwork/proofnetwork_types.h"
 
+#include <QDebug>
+#include <QHostAddress>
+#include <QIODevice>
+#include <QJsonDocument>
 #include <QScopedPointer>
+#include <QSharedPointer>
+#include <QSslConfiguration>
 #include <QStringList>
 #include <QTcpServer>
 #include <QUrlQuery>
+#include <QVariantMap>
+#include <QWeakPointer>
+
+#include <functional>
 
 #ifndef Q_MOC_RUN
 #    define NO_AUTH_REQUIRED
@@ -43,6 +53,76 @@ namespace Proof {
 using HealthStatusMap = QMap<QString, QPair<QDateTime, QVariant>>;
 
 class AbstractRestServerPrivate;
+class RestConnectionOwner;
+class RequestCancellation;
+struct TrafficCaptureRecord;
+
+// Part of multipart/form-data body, small parts are kept in memory and big ones in temporary files.
+// Data device is opened for reading and positioned at the beginning
+struct PROOF_NETWORK_EXPORT RestFormDataPart
+{
+    QString name;
+    QString fileName;
+    QString contentType;
+    QStringList headers;
+    qint64 size = 0;
+    QSharedPointer<QIODevice> data;
+};
+
+// Handle of the client connection that rest method should reply to.
+// It is safe to keep it after connection is closed, answers to such stale handles are just dropped.
+class PROOF_NETWORK_EXPORT RestConnection
+{
+public:
+    RestConnection();
+
+    bool isValid() const;
+    // Null for local socket connections
+    QHostAddress peerAddress() const;
+
+    // True if client closed connection before answer was sent
+    bool isCanceled() const;
+    // Callback is called (from worker thread) if client closes connection before answer is sent
+    void addCancelCallback(std::function<void()> &&callback) const;
+    // RestClient requests started directly from rest method are canceled automatically,
+    // this one is for other futures and for requests started later in continuations
+    template <typename T>
+    void cancelOnDisconnect(const CancelableFuture<T> &future) const
+    {
+        addCancelCallback([future]() { future.cancel(); });
+    }
+
+    // Filled only if form data streaming is enabled and request body is multipart/form-data, body is empty then
+    QVector<RestFormDataPart> formDataParts() const;
+
+    // Request Accept header lists application/cbor, sendJsonAnswer() uses CBOR then. Always false before Qt 5.12
+    bool acceptsCbor() const;
+    // Request body is application/cbor, parseJsonBody() decodes it instead of json
+    bool hasCborBody() const;
+
+    bool operator==(const RestConnection &other) const;
+    bool operator!=(const RestConnection &other) const;
+
+private:
+    friend class AbstractRestServerPrivate;
+    friend QDebug operator<<(QDebug dbg, const RestConnection &connection);
+    RestConnection(const QWeakPointer<RestConnectionOwner> &owner, quint32 slot, quint32 generation, quint32 stream,
+                   const QHostAddress &peer, const QSharedPointer<RequestCancellation> &cancellation);
+
+    QWeakPointer<RestConnectionOwner> m_owner;
+    quint32 m_slot = 0;
+    quint32 m_generation = 0;
+    // HTTP/2 stream id or sequence number of request on persistent HTTP/1.1 connection
+    quint32 m_stream = 0;
+    QHostAddress m_peer;
+    QSharedPointer<RequestCancellation> m_cancellation;
+    QVector<RestFormDataPart> m_formDataParts;
+    bool m_acceptsCbor = false;
+    bool m_cborBody = false;
+};
+
+PROOF_NETWORK_EXPORT QDebug operator<<(QDebug dbg, const RestConnection &connection);
+
 class PROOF_NETWORK_EXPORT AbstractRestServer : public QTcpServer
 {
     Q_OBJECT
@@ -57,15 +137,77 @@ public:
     QString password() const;
     QString pathPrefix() const;
     int port() const;
+    QString localSocketPath() const;
+    bool tcpListeningEnabled() const;
+    bool http2Enabled() const;
+    QSslConfiguration sslConfiguration() const;
     RestAuthType authType() const;
 
     void setUserName(const QString &userName);
     void setPassword(const QString &password);
     void setPathPrefix(const QString &pathPrefix);
     void setPort(quint16 port);
+    // Server listens on unix domain socket (or named pipe on Windows) if path is set, in addition to tcp port
+    void setLocalSocketPath(const QString &localSocketPath);
+    // Disabling tcp makes sense only with local socket path set
+    void setTcpListeningEnabled(bool enabled);
+    // Connections that start with HTTP/2 preface (prior knowledge, h2c) are served with HTTP/2, others with HTTP/1.1
+    void setHttp2Enabled(bool enabled);
+    void setHttp2MaxConcurrentStreams(int count);
+    // Tcp connections are served over TLS if configuration has both local certificate and private key.
+    // TLS connections are kept alive between requests to not pay for handshake each time.
+    // Must be set before startListen() is called
+    void setSslConfiguration(const QSslConfiguration &configuration);
+    // Plain tcp and local socket connections are kept alive too unless client sends "Connection: close".
+    // Disabled by default, such connections are closed after each answer
+    void setKeepAliveEnabled(bool enabled);
     void setSuggestedMaxThreadsCount(int count = -1);
+    // Workers are kept running even without connections, they are started by startListen()
+    void setMinThreadsCount(int count);
+    // Workers without connections for this long are stopped while pool is bigger than min threads count, 0 disables it
+    void setIdleThreadTimeout(int msecs);
+    // Each new worker is pinned to the least used of these masks (bit N is cpu N), empty list disables pinning.
+    // Not supported on macOS. Must be set before startListen() is called
+    void setWorkerCpuAffinity(const QVector<quint64> &masks);
     void setAuthType(RestAuthType authType);
 
+    // Token bucket limits, zero or negative rate disables limiting.
+    // Limits are read by workers without locking, so both must be set before startListen() is called
+    void setPeerRateLimit(double requestsPerSecond, int burst = 1);
+    // restMethod is a name of slot, i.e. rest_get_System_Status. Limit is applied to each peer separately,
+    // local socket connections are limited each on its own
+    void setRouteRateLimit(const QString &restMethod, double requestsPerSecond, int burst = 1);
+
+    // Rest method must answer in this time or client gets 504 and connection is released, zero disables it.
+    // Route timeout overrides default one, restMethod is a name of slot
+    void setHandlerTimeout(int msecs);
+    void setRouteHandlerTimeout(const QString &restMethod, int msecs);
+
+    // multipart/form-data bodies are parsed while they are received and passed to rest method as
+    // RestConnection::formDataParts() instead of body. Parts bigger than maxPartSize are rejected with 400,
+    // parts bigger than inMemoryPartSize are stored in temporary files. All parts kept in memory together are
+    // limited by 16 * inMemoryPartSize, next ones go to temporary files. Bodies with more than 128 parts are
+    // rejected with 400. Zero maxPartSize disables it (default).
+    // HTTP/2 requests are not affected
+    void setFormDataStreaming(qint64 maxPartSize, qint64 inMemoryPartSize = 64 * 1024);
+
+    // Each received request is appended to file for later replay with restserver_replay, empty path disables it.
+    // Values of Authorization, Proxy-Authorization and Cookie headers are redacted, redactor can change record further.
+    // Bodies of streamed multipart/form-data requests are not captured. Records are written by background thread
+    // every 200 msecs and redactor is called there, records are dropped if writer can't keep up (more than 8192 records
+    // or 64MB pending)
+    void setTrafficCapture(const QString &filePath,
+                           const std::function<void(Proof::TrafficCaptureRecord &)> &redactor = nullptr);
+
+    // Json line per request (time, peer, method, path, status, bytes, latency, request id) is appended to file.
+    // Workers only put records to their own lock-free buffers, file is written in batches by background thread.
+    // Records are dropped if writer can't keep up. Request id is taken from X-Request-Id header or generated.
+    // Empty path disables it. Must be set before startListen() is called
+    void setAccessLog(const QString &filePath);
+
+    // Limits for /system/batch, batches with more than maxRequests sub-requests are rejected
+    void setBatchLimits(int maxRequests, int maxConcurrentRequests);
+
     void setCustomHeader(const QString &header, const QString &value);
     QString customHeader(const QString &header) const;
     bool containsCustomHeader(const QString &header) const;
@@ -73,50 +215,77 @@ public:
 
     void startListen();
     void stopListen();
+    bool isListeningLocally() const;
+
+    // Server counters, available also through /system/metrics
+    QVariantMap metrics() const;
 
 signals:
     void userNameChanged(const QString &arg);
     void passwordChanged(const QString &arg);
     void pathPrefixChanged(const QString &arg);
     void portChanged(int arg);
+    void localSocketPathChanged(const QString &arg);
     void authTypeChanged(Proof::RestAuthType arg);
 
 protected slots:
-    NO_AUTH_REQUIRED void rest_get_System_Status(QTcpSocket *socket, const QStringList &headers,
+    NO_AUTH_REQUIRED void rest_get_System_Status(const Proof::RestConnection &connection, const QStringList &headers,
                                                  const QStringList &methodVariableParts, const QUrlQuery &query,
                                                  const QByteArray &body);
-    NO_AUTH_REQUIRED void rest_get_System_RecentErrors(QTcpSocket *socket, const QStringList &headers,
+    // Newest first, each error has id. Optional query params: since - only errors with bigger id are returned,
+    // limit - max number of errors returned, must be positive if set
+    NO_AUTH_REQUIRED void rest_get_System_RecentErrors(const Proof::RestConnection &connection,
+                                                       const QStringList &headers,
                                                        const QStringList &methodVariableParts, const QUrlQuery &query,
                                                        const QByteArray &body);
+    NO_AUTH_REQUIRED void rest_get_System_Metrics(const Proof::RestConnection &connection, const QStringList &headers,
+                                                  const QStringList &methodVariableParts, const QUrlQuery &query,
+                                                  const QByteArray &body);
+    // Body is a json array of sub-requests: {"method": "GET", "path": "/some/path?a=b", "headers": {}, "body": ""}
+    // Each of them goes through usual routing and auth, headers not set explicitly are taken from batch request itself.
+    // Answer is a json array of {"status", "reason", "content_type", "headers", "body"} in the same order.
+    // Non-text bodies (i.e. CBOR) are base64 encoded and marked with "body_encoding": "base64".
+    // Route handler timeouts are applied to sub-requests, batch stops waiting for them once it is canceled.
+    NO_AUTH_REQUIRED void rest_post_System_Batch(const Proof::RestConnection &connection, const QStringList &headers,
+                                                 const QStringList &methodVariableParts, const QUrlQuery &query,
+                                                 const QByteArray &body);
 
 protected:
     virtual FutureSP<HealthStatusMap> healthStatus(bool quick) const;
 
     void incomingConnection(qintptr socketDescriptor) override;
 
-    void sendAnswer(QTcpSocket *socket, const QByteArray &body, const QString &contentType, int returnCode = 200,
-                    const QString &reason = QString());
-    void sendAnswer(QTcpSocket *socket, const QByteArray &body, const QString &contentType,
+    void sendAnswer(const RestConnection &connection, const QByteArray &body, const QString &contentType,
+                    int returnCode = 200, const QString &reason = QString());
+    void sendAnswer(const RestConnection &connection, const QByteArray &body, const QString &contentType,
                     const QHash<QString, QString> &headers, int returnCode = 200, const QString &reason = QString());
-    void sendErrorCode(QTcpSocket *socket, int returnCode, const QString &reason, int errorCode,
+    // Serialized to CBOR if client accepts it and to compact json otherwise
+    void sendJsonAnswer(const RestConnection &connection, const QJsonDocument &body, int returnCode = 200,
+                        const QString &reason = QString());
+    // Body is decoded from json or CBOR according to request content type, scalar values are not accepted
+    QJsonDocument parseJsonBody(const RestConnection &connection, const QByteArray &body, bool *ok = nullptr) const;
+    void sendErrorCode(const RestConnection &connection, int returnCode, const QString &reason, int errorCode,
                        const QStringList &args = QStringList());
     template <class Enum>
-    void sendErrorCode(QTcpSocket *socket, int returnCode, const QString &reason, Enum errorCode,
+    void sendErrorCode(const RestConnection &connection, int returnCode, const QString &reason, Enum errorCode,
                        const QStringList &args = QStringList())
     {
-        sendErrorCode(socket, returnCode, reason, static_cast<int>(errorCode), args);
+        sendErrorCode(connection, returnCode, reason, static_cast<int>(errorCode), args);
     }
-    void sendBadRequest(QTcpSocket *socket, const QString &reason = QStringLiteral("Bad Request"));
-    void sendNotFound(QTcpSocket *socket, const QString &reason = QStringLiteral("Not Found"));
-    void sendNotAuthorized(QTcpSocket *socket, const QString &reason = QStringLiteral("Unauthorized"));
-    void sendConflict(QTcpSocket *socket, const QString &reason = QStringLiteral("Conflict"));
-    void sendInternalError(QTcpSocket *socket);
+    void sendBadRequest(const RestConnection &connection, const QString &reason = QStringLiteral("Bad Request"));
+    void sendNotFound(const RestConnection &connection, const QString &reason = QStringLiteral("Not Found"));
+    void sendNotAuthorized(const RestConnection &connection, const QString &reason = QStringLiteral("Unauthorized"));
+    void sendConflict(const RestConnection &connection, const QString &reason = QStringLiteral("Conflict"));
+    void sendInternalError(const RestConnection &connection);
     bool checkBasicAuth(const QString &encryptedAuth) const;
-    QString parseAuth(QTcpSocket *socket, const QString &header);
+    QString parseAuth(const RestConnection &connection, const QString &header);
 
     AbstractRestServer(AbstractRestServerPrivate &dd, const QString &pathPrefix, quint16 port);
     QScopedPointer<AbstractRestServerPrivate> d_ptr;
 };
 
 } // namespace Proof
+
+Q_DECLARE_METATYPE(Proof::RestConnection)
+
 #endif // ABSTRACTRESTSERVER_H
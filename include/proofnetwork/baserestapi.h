@@ -51,6 +51,24 @@ struct PROOF_NETWORK_EXPORT RestApiReply
     int httpStatus = 0;
 };
 
+// Transient failures (refused, closed or timed out connections, replies aborted by RestClient timeout, 429, 502,
+// 503 and 504 replies) are retried up to maxRetries times, other aborted replies are not. Delay before n-th retry
+// is random in [delay / 2, delay], where delay is initialBackoffMsecs * backoffMultiplier ^ (n - 1) limited by
+// maxBackoffMsecs. Retry-After header is respected, if it asks to wait longer than maxBackoffMsecs request is not
+// retried. Retries to each host are also limited by budget shared by all apis: not more than
+// minRetriesPerWindow + budgetRatio * requests in 10 seconds window
+struct PROOF_NETWORK_EXPORT RestRetryPolicy
+{
+    int maxRetries = 0;
+    qint64 initialBackoffMsecs = 100;
+    qint64 maxBackoffMsecs = 10000;
+    double backoffMultiplier = 2.0;
+    double budgetRatio = 0.1;
+    int minRetriesPerWindow = 10;
+    // POST and PATCH are retried only if enabled, multipart requests are never retried
+    bool retryNonIdempotent = false;
+};
+
 class BaseRestApiPrivate;
 class PROOF_NETWORK_EXPORT BaseRestApi : public ProofObject
 {
@@ -66,19 +84,36 @@ public:
 
     void abortAllRequests();
 
+    // When enabled, concurrent identical GET requests (same url, query, vendor and credentials) made through this api
+    // share one network round trip and all get the same reply. Canceling one of them (also by disconnect of client
+    // whose rest method made it) doesn't affect others, network request is aborted only when all of them are
+    // canceled. Disabled by default
+    bool requestCoalescingEnabled() const;
+    void setRequestCoalescingEnabled(bool enabled);
+
+    // Retries are disabled by default (maxRetries is 0)
+    RestRetryPolicy retryPolicy() const;
+    void setRetryPolicy(const RestRetryPolicy &policy);
+
 protected:
     BaseRestApi(const RestClientSP &restClient, QObject *parent = nullptr);
     BaseRestApi(const RestClientSP &restClient, BaseRestApiPrivate &dd, QObject *parent = nullptr);
 
-    CancelableFuture<RestApiReply> get(const QString &method, const QUrlQuery &query = QUrlQuery());
+    CancelableFuture<RestApiReply> get(const QString &method, const QUrlQuery &query = QUrlQuery(),
+                                       RestRequestPriority priority = RestRequestPriority::Normal);
     CancelableFuture<RestApiReply> post(const QString &method, const QUrlQuery &query = QUrlQuery(),
-                                        const QByteArray &body = "");
-    CancelableFuture<RestApiReply> post(const QString &method, const QUrlQuery &query, QHttpMultiPart *multiParts);
+                                        const RestRequestBody &body = RestRequestBody(),
+                                        RestRequestPriority priority = RestRequestPriority::Normal);
+    CancelableFuture<RestApiReply> post(const QString &method, const QUrlQuery &query, QHttpMultiPart *multiParts,
+                                        RestRequestPriority priority = RestRequestPriority::Normal);
     CancelableFuture<RestApiReply> put(const QString &method, const QUrlQuery &query = QUrlQuery(),
-                                       const QByteArray &body = "");
+                                       const RestRequestBody &body = RestRequestBody(),
+                                       RestRequestPriority priority = RestRequestPriority::Normal);
     CancelableFuture<RestApiReply> patch(const QString &method, const QUrlQuery &query = QUrlQuery(),
-                                         const QByteArray &body = "");
-    CancelableFuture<RestApiReply> deleteResource(const QString &method, const QUrlQuery &query = QUrlQuery());
+                                         const RestRequestBody &body = RestRequestBody(),
+                                         RestRequestPriority priority = RestRequestPriority::Normal);
+    CancelableFuture<RestApiReply> deleteResource(const QString &method, const QUrlQuery &query = QUrlQuery(),
+                                                  RestRequestPriority priority = RestRequestPriority::Normal);
 
     virtual void processSuccessfulReply(QNetworkReply *reply, const PromiseSP<RestApiReply> &promise);
     virtual void processErroredReply(QNetworkReply *reply, const PromiseSP<RestApiReply> &promise);
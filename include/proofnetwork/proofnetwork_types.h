@@ -57,7 +57,16 @@ enum class RestAuthType
     Wsse,
     BearerToken
 };
+
+// Higher priority requests to the same host are sent first, lower ones are still sent from time to time
+enum class RestRequestPriority
+{
+    Background,
+    Normal,
+    Interactive
+};
 } // namespace Proof
 
 Q_DECLARE_METATYPE(Proof::RestAuthType)
+Q_DECLARE_METATYPE(Proof::RestRequestPriority)
 #endif // PROOFNETWORK_TYPES_H
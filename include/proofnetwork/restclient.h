@@ -36,11 +36,38 @@
 #include <QNetworkAccessManager>
 #include <QNetworkCookie>
 #include <QUrlQuery>
+#include <QVariantMap>
 
 class QNetworkReply;
 
 namespace Proof {
 
+// Request body with content type. Raw data converts to it implicitly, content type of such body is guessed by its
+// leading bytes: json for objects and arrays, xml for <?xml prolog and url encoded form otherwise.
+// Json, Xml and UrlEncoded respect vendor passed to request, Custom content type is used as is
+struct PROOF_NETWORK_EXPORT RestRequestBody
+{
+    enum class Type
+    {
+        Auto,
+        Json,
+        Xml,
+        UrlEncoded,
+        Custom
+    };
+
+    RestRequestBody() {}
+    RestRequestBody(const QByteArray &data, Type type = Type::Auto) : data(data), type(type) {}
+    RestRequestBody(const char *data) : data(data) {}
+    RestRequestBody(const QByteArray &data, const QString &contentType)
+        : data(data), contentType(contentType), type(Type::Custom)
+    {}
+
+    QByteArray data;
+    QString contentType;
+    Type type = Type::Auto;
+};
+
 class RestClientPrivate;
 
 class PROOF_NETWORK_EXPORT RestClient : public ProofObject
@@ -80,10 +107,20 @@ public:
 
     int msecsForTimeout() const;
     void setMsecsForTimeout(int arg);
+    // True if reply was aborted by its client because msecsForTimeout passed, not by anyone else
+    static bool replyTimedOut(const QNetworkReply *reply);
+
+    // When set, requests are sent over this local socket instead of TCP, host is used only for the Host header
+    QString localSocketPath() const;
+    void setLocalSocketPath(const QString &arg);
 
     bool followRedirects() const;
     void setFollowRedirects(bool arg);
 
+    // GET replies are cached only if client has it enabled and cache is set up with setupHttpCache()
+    bool httpCacheEnabled() const;
+    void setHttpCacheEnabled(bool arg);
+
     void setCustomHeader(const QByteArray &header, const QByteArray &value);
     QByteArray customHeader(const QByteArray &header) const;
     bool containsCustomHeader(const QByteArray &header) const;
@@ -94,18 +131,60 @@ public:
     bool containsCookie(const QString &name) const;
     void unsetCookie(const QString &name);
 
+    // Max number of concurrent requests to one host (or local socket), shared by all clients. Requests over the limit
+    // are queued. Default is 6, it and per-host overrides can be set also in network settings group with
+    // default_host_concurrency value and host_concurrency subgroup (host = limit)
+    static int defaultHostConcurrencyLimit();
+    static void setDefaultHostConcurrencyLimit(int limit);
+    static int hostConcurrencyLimit(const QString &host);
+    // Zero or negative limit removes override
+    static void setHostConcurrencyLimit(const QString &host, int limit);
+    // Host -> {"usage": running requests, "queued": waiting requests, "limit"} for hosts with any activity
+    static QVariantMap schedulerStatistics();
+    // Adaptive mode adjusts limit of each host without explicit override from observed replies (AIMD):
+    // limit grows by one per window of fast replies and shrinks on latency growth over baseline or on overload
+    // errors (refused/closed connections, timeouts, 429, 502, 503, 504), always staying in [minLimit, maxLimit].
+    // Baseline is smoothed median latency. Host starts from default limit again after 10 minutes without requests
+    static bool adaptiveConcurrencyEnabled();
+    static void setAdaptiveConcurrencyEnabled(bool enabled, int minLimit = 1, int maxLimit = 64);
+    // Number of network threads, each with its own QNetworkAccessManager. New clients are spread among them
+    // round-robin, already created clients stay in their threads. Default is 1, can be set also in network
+    // settings group with threads value
+    static int networkThreadsCount();
+    static void setNetworkThreadsCount(int count);
+    // Process-wide HTTP cache with RFC 7234 semantics of QNetworkAccessManager (Cache-Control, Expires, conditional
+    // revalidation with ETag and Last-Modified). Memory tier keeps up to memoryBudget bytes, disk tier is used if
+    // directory is set. Zero budget and empty directory turn cache off. Entries are shared between clients by url,
+    // so replies to requests with Authorization header (auth type or custom header) are never stored, such requests
+    // can still be answered from entries stored without credentials. Requests over local socket are not cached.
+    // Can be set up also in network settings group with http_cache_memory_budget, http_cache_directory and
+    // http_cache_disk_budget values
+    static void setupHttpCache(qint64 memoryBudget, const QString &diskDirectory = QString(),
+                               qint64 diskBudget = 50 * 1024 * 1024);
+    // {"hits", "misses", "revalidations", "disk_hits", "memory_entries", "memory_size", "memory_budget", "disk_size"}
+    static QVariantMap httpCacheStatistics();
+
     CancelableFuture<QNetworkReply *> get(const QString &method, const QUrlQuery &query = QUrlQuery(),
-                                          const QString &vendor = QString());
+                                          const QString &vendor = QString(),
+                                          RestRequestPriority priority = RestRequestPriority::Normal);
     CancelableFuture<QNetworkReply *> post(const QString &method, const QUrlQuery &query = QUrlQuery(),
-                                           const QByteArray &body = "", const QString &vendor = QString());
-    CancelableFuture<QNetworkReply *> post(const QString &method, const QUrlQuery &query, QHttpMultiPart *multiParts);
+                                           const RestRequestBody &body = RestRequestBody(),
+                                           const QString &vendor = QString(),
+                                           RestRequestPriority priority = RestRequestPriority::Normal);
+    CancelableFuture<QNetworkReply *> post(const QString &method, const QUrlQuery &query, QHttpMultiPart *multiParts,
+                                           RestRequestPriority priority = RestRequestPriority::Normal);
     CancelableFuture<QNetworkReply *> put(const QString &method, const QUrlQuery &query = QUrlQuery(),
-                                          const QByteArray &body = "", const QString &vendor = QString());
+                                          const RestRequestBody &body = RestRequestBody(),
+                                          const QString &vendor = QString(),
+                                          RestRequestPriority priority = RestRequestPriority::Normal);
     CancelableFuture<QNetworkReply *> patch(const QString &method, const QUrlQuery &query = QUrlQuery(),
-                                            const QByteArray &body = "", const QString &vendor = QString());
+                                            const RestRequestBody &body = RestRequestBody(),
+                                            const QString &vendor = QString(),
+                                            RestRequestPriority priority = RestRequestPriority::Normal);
     CancelableFuture<QNetworkReply *> deleteResource(const QString &method, const QUrlQuery &query = QUrlQuery(),
-                                                     const QString &vendor = QString());
-    CancelableFuture<QNetworkReply *> get(const QUrl &url);
+                                                     const QString &vendor = QString(),
+                                                     RestRequestPriority priority = RestRequestPriority::Normal);
+    CancelableFuture<QNetworkReply *> get(const QUrl &url, RestRequestPriority priority = RestRequestPriority::Normal);
 
 signals:
     void userNameChanged(const QString &arg);
@@ -119,6 +198,8 @@ signals:
     void authTypeChanged(Proof::RestAuthType arg);
     void msecsForTimeoutChanged(qlonglong arg);
     void followRedirectsChanged(bool arg);
+    void httpCacheEnabledChanged(bool arg);
+    void localSocketPathChanged(const QString &arg);
 };
 
 } // namespace Proof
@@ -0,0 +1,62 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef PROOF_TRAFFICCAPTURE_H
+#define PROOF_TRAFFICCAPTURE_H
+
+#include "proofnetwork/proofnetwork_global.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+class QIODevice;
+
+namespace Proof {
+
+// Request received by AbstractRestServer, timestamp is in msecs since epoch
+struct PROOF_NETWORK_EXPORT TrafficCaptureRecord
+{
+    qint64 timestamp = 0;
+    QString peer;
+    QString method;
+    QString uri;
+    QStringList headers;
+    QByteArray body;
+};
+
+// Capture file is a magic header followed by length-prefixed records. File is only appended,
+// so truncated record at the end (e.g. after crash) is skipped by reader
+struct PROOF_NETWORK_EXPORT TrafficCapture
+{
+    static QByteArray fileHeader();
+    static QByteArray serialize(const TrafficCaptureRecord &record);
+    static bool readFileHeader(QIODevice *device);
+    // False at the end of device and on truncated or corrupted record
+    static bool readRecord(QIODevice *device, TrafficCaptureRecord &record);
+};
+
+} // namespace Proof
+
+#endif // PROOF_TRAFFICCAPTURE_H
@@ -30,6 +30,8 @@
 #include <QMutexLocker>
 #include <QTimer>
 
+#include <deque>
+
 static const qlonglong MSECS_TO_KEEP = 1000 * 60 * 60 * 24; //24 hours
 
 namespace Proof {
@@ -37,7 +39,9 @@ class MemoryStorageNotificationHandlerPrivate : public AbstractNotificationHandl
 {
     Q_DECLARE_PUBLIC(MemoryStorageNotificationHandler)
 
-    QMultiMap<QDateTime, QString> messages;
+    // Ordered by id, ids are consecutive so position of any id is known without search
+    std::deque<MemoryStorageNotificationHandler::Message> messages;
+    qint64 lastId = 0;
     QPair<QDateTime, QString> lastMessage;
     mutable QMutex mutex;
     QTimer *cleanupTimer = nullptr;
@@ -58,8 +62,8 @@ MemoryStorageNotificationHandler::MemoryStorageNotificationHandler(const QString
     connect(d->cleanupTimer, &QTimer::timeout, this, [d]() {
         QDateTime limiter = QDateTime::currentDateTimeUtc().addMSecs(-MSECS_TO_KEEP);
         d->mutex.lock();
-        while (!d->messages.isEmpty() && d->messages.firstKey() < limiter)
-            d->messages.remove(d->messages.firstKey());
+        while (!d->messages.empty() && d->messages.front().time < limiter)
+            d->messages.pop_front();
         d->mutex.unlock();
     });
     d->cleanupTimer->start();
@@ -69,7 +73,34 @@ QMultiMap<QDateTime, QString> MemoryStorageNotificationHandler::messages() const
 {
     Q_D_CONST(MemoryStorageNotificationHandler);
     QMutexLocker locker(&d->mutex);
-    return d->messages;
+    QMultiMap<QDateTime, QString> result;
+    for (const auto &message : d->messages)
+        result.insert(message.time, message.text);
+    return result;
+}
+
+QVector<MemoryStorageNotificationHandler::Message> MemoryStorageNotificationHandler::messagesSince(qint64 sinceId,
+                                                                                                   int limit) const
+{
+    Q_D_CONST(MemoryStorageNotificationHandler);
+    QVector<Message> result;
+    QMutexLocker locker(&d->mutex);
+    if (d->messages.empty())
+        return result;
+    const qint64 firstId = d->messages.front().id;
+    auto from = d->messages.cbegin()
+                + qBound<qint64>(0, sinceId - firstId + 1, static_cast<qint64>(d->messages.size()));
+    auto to = d->messages.cend();
+    if (limit > 0 && to - from > limit) {
+        if (sinceId > 0)
+            to = from + limit;
+        else
+            from = to - limit;
+    }
+    result.reserve(static_cast<int>(to - from));
+    while (to != from)
+        result << *--to;
+    return result;
 }
 
 QPair<QDateTime, QString> MemoryStorageNotificationHandler::lastMessage() const
@@ -87,7 +118,7 @@ void MemoryStorageNotificationHandler::notify(const QString &message, ErrorNotif
     Q_D(MemoryStorageNotificationHandler);
     d->mutex.lock();
     d->lastMessage = qMakePair(QDateTime::currentDateTimeUtc(), message);
-    d->messages.insert(d->lastMessage.first, message);
+    d->messages.push_back({++d->lastId, d->lastMessage.first, message});
     d->mutex.unlock();
 }
 
@@ -30,29 +30,135 @@
 #include "proofcore/proofglobal.h"
 #include "proofcore/proofobject.h"
 
+#include "proofnetwork/accesslog_p.h"
+#include "proofnetwork/http2session_p.h"
 #include "proofnetwork/httpparser_p.h"
+#include "proofnetwork/ratelimiter_p.h"
+#include "proofnetwork/requestcancellation_p.h"
+#include "proofnetwork/trafficcapture_p.h"
 
 #include <QDir>
+#include <QElapsedTimer>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
 #include <QMetaMethod>
 #include <QMetaObject>
-#include <QMutex>
 #include <QNetworkInterface>
 #include <QReadWriteLock>
 #include <QSet>
+#include <QSharedPointer>
+#include <QSslSocket>
 #include <QSysInfo>
 #include <QTcpSocket>
+#include <QTextCodec>
+#include <QTimer>
 #include <QUrlQuery>
 
 #include <algorithm>
+#include <limits>
+
+#if defined Q_OS_WIN
+#    include <windows.h>
+#elif defined Q_OS_LINUX
+#    include <sched.h>
+#endif
+
+// CBOR support is available only since Qt 5.12, older Qt always talks json
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+#    define PROOF_REST_SERVER_CBOR
+#    include <QCborArray>
+#    include <QCborMap>
+#    include <QCborValue>
+#endif
 
 static constexpr int MIN_THREADS_COUNT = 5;
+static constexpr int DEFAULT_MAX_BATCH_REQUESTS = 100;
+static constexpr int DEFAULT_MAX_CONCURRENT_BATCH_REQUESTS = 8;
+static constexpr int DEFAULT_HTTP2_MAX_CONCURRENT_STREAMS = 100;
+static constexpr qint64 KEEP_ALIVE_TIMEOUT = 15000;
+static constexpr int KEEP_ALIVE_CHECK_INTERVAL = 1000;
+static constexpr int IDLE_WORKERS_CHECK_INTERVAL = 1000;
+
+namespace Proof {
+class RestConnectionOwner
+{
+public:
+    virtual ~RestConnectionOwner() {}
+    virtual void sendAnswer(quint32 slot, quint32 generation, quint32 stream, const QByteArray &body,
+                            const QString &contentType, const QHash<QString, QString> &headers, int returnCode,
+                            const QString &reason) = 0;
+    // Owner answers with 504 if request is still not answered after msecs
+    virtual void startDeadline(quint32 slot, quint32 generation, quint32 stream, int msecs)
+    {
+        Q_UNUSED(slot)
+        Q_UNUSED(generation)
+        Q_UNUSED(stream)
+        Q_UNUSED(msecs)
+    }
+};
+
+// Updated from worker threads, read by metrics()
+struct ServerMetrics
+{
+    void addTlsHandshake(qint64 usecs);
+
+    std::atomic_llong tlsHandshakesCount{0};
+    std::atomic_llong tlsHandshakeFailuresCount{0};
+    std::atomic_llong tlsHandshakesTotalTime{0};
+    std::atomic_llong tlsHandshakeMaxTime{0};
+    std::atomic_llong tlsReusedConnectionRequestsCount{0};
+    std::atomic_llong retiredWorkerThreadsCount{0};
+    std::atomic_llong canceledRequestsCount{0};
+    std::atomic_llong handlerTimeoutsCount{0};
+};
+} // namespace Proof
 
 namespace {
 class WorkerThread;
 
+// Checks only media type, parameters and quality values are ignored
+bool headerListsMediaType(const QStringList &headers, QLatin1String header, QLatin1String mediaType)
+{
+    for (const QString &line : headers) {
+        const int colonIndex = line.indexOf(':');
+        if (colonIndex < 0 || line.leftRef(colonIndex).trimmed().compare(header, Qt::CaseInsensitive) != 0)
+            continue;
+        const auto values = line.midRef(colonIndex + 1).split(',');
+        for (const QStringRef &value : values) {
+            if (value.split(';').first().trimmed().compare(mediaType, Qt::CaseInsensitive) == 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+// Connection header is a comma separated list of case-insensitive tokens, same as media types list
+bool headerListsToken(const QStringList &headers, QLatin1String header, QLatin1String token)
+{
+    return headerListsMediaType(headers, header, token);
+}
+
+bool setCurrentThreadAffinity(quint64 mask)
+{
+#if defined Q_OS_WIN
+    return SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(mask)) != 0;
+#elif defined Q_OS_LINUX
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (int cpu = 0; cpu < 64; ++cpu) {
+        if (mask & (Q_UINT64_C(1) << cpu))
+            CPU_SET(cpu, &cpuSet);
+    }
+    return sched_setaffinity(0, sizeof(cpuSet), &cpuSet) == 0;
+#else
+    Q_UNUSED(mask)
+    return false;
+#endif
+}
+
 class MethodNode
 {
 public:
@@ -73,55 +179,167 @@ private:
     QString m_tag;
 };
 
-struct WorkerThreadInfo
+// Request that is not answered yet, filled only if access log is enabled
+struct AccessLogEntry
 {
-    WorkerThreadInfo() {}
-    ~WorkerThreadInfo() {}
-    explicit WorkerThreadInfo(WorkerThread *thread, long long socketCount) : thread(thread)
-    {
-        this->socketCount = socketCount;
-    }
-
-    WorkerThreadInfo(const WorkerThreadInfo &other) { *this = other; }
-
-    WorkerThreadInfo &operator=(const WorkerThreadInfo &other)
-    {
-        thread = other.thread;
-        socketCount.store(other.socketCount);
-        return *this;
-    }
-
-    WorkerThread *thread = nullptr;
-    std::atomic_llong socketCount{0};
+    QElapsedTimer timer;
+    qint64 time = 0;
+    QString method;
+    QString path;
+    QString requestId;
 };
 
 struct SocketInfo
 {
     SocketInfo() {}
 
+    // Either QTcpSocket or QLocalSocket
+    QIODevice *socket = nullptr;
+    quint32 generation = 0;
+    // Incremented after each answer on persistent connection, answers with older numbers are stale
+    quint32 requestNumber = 0;
+    bool answered = false;
+    bool protocolDetected = false;
+    // First bytes are kept here until it is clear whether they are HTTP/2 preface or not
+    QByteArray protocolDetectionData;
+    bool keepAlive = false;
+    // Pipelined bytes read together with previous request, they are parsed before reading socket again
+    QByteArray pipelinedData;
+    // Valid while TLS handshake is in progress
+    QElapsedTimer handshakeTimer;
+    // Valid while persistent connection waits for next request
+    QElapsedTimer idleTimer;
     Proof::HttpParser parser;
+    // Set only for HTTP/2 connections
+    QSharedPointer<Proof::Http2Session> http2;
+    // Requests that are not answered yet, canceled if connection is closed
+    QSharedPointer<Proof::RequestCancellation> cancellation;
+    QHash<quint32, QSharedPointer<Proof::RequestCancellation>> streamCancellations;
+    AccessLogEntry accessLogEntry;
+    QHash<quint32, AccessLogEntry> streamAccessLogEntries;
     QMetaObject::Connection readyReadConnection;
     QMetaObject::Connection disconnectConnection;
     QMetaObject::Connection errorConnection;
 };
 
-class WorkerThread : public QThread
+class WorkerThread : public QThread, public Proof::RestConnectionOwner, public QEnableSharedFromThis<WorkerThread>
 {
     Q_OBJECT
 public:
-    WorkerThread(Proof::AbstractRestServerPrivate *const _serverD);
+    WorkerThread(Proof::AbstractRestServerPrivate *const _serverD, quint64 cpuAffinity,
+                 const QSharedPointer<Proof::AccessLogBuffer> &accessLogBuffer);
     ~WorkerThread();
 
-    void sendAnswer(QTcpSocket *socket, const QByteArray &body, const QString &contentType,
-                    const QHash<QString, QString> &headers, int returnCode, const QString &reason);
-    void handleNewConnection(qintptr socketDescriptor);
-    void deleteSocket(QTcpSocket *socket);
-    void onReadyRead(QTcpSocket *socket);
+    void sendAnswer(quint32 slot, quint32 generation, quint32 stream, const QByteArray &body,
+                    const QString &contentType, const QHash<QString, QString> &headers, int returnCode,
+                    const QString &reason) override;
+    void startDeadline(quint32 slot, quint32 generation, quint32 stream, int msecs) override;
+    void handleNewConnection(qintptr socketDescriptor, bool isLocal);
+    void deleteSocket(quint32 slot);
+    void onReadyRead(quint32 slot);
+    void onHttp2ReadyRead(quint32 slot, const QByteArray &data);
     void stop();
+    // Worker is destroyed in server thread after it is released. Detached one is destroyed in place
+    void detachFromServer();
+    static void destroy(WorkerThread *worker);
+
+    long long socketCount() const;
+    void increaseSocketCount();
+    quint64 cpuAffinity() const;
+    // Msecs since epoch when connection was last added or removed
+    qint64 lastActivityTime() const;
+
+protected:
+    void run() override;
 
 private:
+    bool isAlive(quint32 slot, quint32 generation) const;
+    void cancelRequests(SocketInfo &info);
+    void watchReadyRead(quint32 slot);
+    void waitForNextRequest(quint32 slot);
+    void closeIdleSockets();
+    void flushHttp2(quint32 slot);
+    void startAccessLogEntry(AccessLogEntry &entry, const QString &method, const QString &uri,
+                             const QStringList &headers);
+    void writeAccessLogEntry(const AccessLogEntry &entry, QIODevice *socket, int returnCode, qint64 bytes);
+    QVector<QPair<QString, QString>> responseHeaders(const QHash<QString, QString> &headers) const;
+    static bool isConnected(QIODevice *socket);
+    static void closeSocket(QIODevice *socket);
+
+    Proof::AbstractRestServerPrivate *const serverD;
+    std::atomic<QThread *> m_serverThread;
+    // Sockets are owned and touched only by worker thread itself, no locking is needed
+    QVector<SocketInfo> sockets;
+    QVector<quint32> freeSlots;
+    QTimer *keepAliveTimer = nullptr;
+    const quint64 m_cpuAffinity;
+    const QSharedPointer<Proof::AccessLogBuffer> m_accessLogBuffer;
+    std::atomic_llong m_socketCount{0};
+    std::atomic_llong m_lastActivityTime;
+};
+
+class LocalServer : public QLocalServer
+{
+    Q_OBJECT
+public:
+    LocalServer(Proof::AbstractRestServerPrivate *const _serverD, QObject *parent);
+
+protected:
+    void incomingConnection(quintptr socketDescriptor) override;
+
+private:
+    Proof::AbstractRestServerPrivate *const serverD;
+};
+
+// Runs sub-requests of /system/batch and captures their answers instead of writing them to socket.
+// Lives in thread of worker that received batch request, answers from other threads are routed to it.
+class BatchRequest : public QObject, public Proof::RestConnectionOwner
+{
+    Q_OBJECT
+public:
+    struct SubRequest
+    {
+        QString method;
+        QString path;
+        QStringList headers;
+        QByteArray body;
+    };
+
+    BatchRequest(Proof::AbstractRestServerPrivate *const _serverD, const Proof::RestConnection &connection,
+                 const QVector<SubRequest> &requests, int maxConcurrentRequests);
+
+    void start(const QSharedPointer<BatchRequest> &self);
+    void sendAnswer(quint32 slot, quint32 generation, quint32 stream, const QByteArray &body,
+                    const QString &contentType, const QHash<QString, QString> &headers, int returnCode,
+                    const QString &reason) override;
+    void startDeadline(quint32 slot, quint32 generation, quint32 stream, int msecs) override;
+
+private:
+    struct SubResponse
+    {
+        bool answered = false;
+        int returnCode = 0;
+        QString reason;
+        QString contentType;
+        QHash<QString, QString> headers;
+        QByteArray body;
+    };
+
+    void dispatch();
+    void finish();
+    void abandon();
+    static bool isTextBody(const QString &contentType, const QByteArray &body);
+
     Proof::AbstractRestServerPrivate *const serverD;
-    QHash<QTcpSocket *, SocketInfo> sockets;
+    const Proof::RestConnection connection;
+    QVector<SubRequest> requests;
+    QVector<SubResponse> responses;
+    QSharedPointer<BatchRequest> self;
+    int maxConcurrentRequests;
+    int nextRequest = 0;
+    int inFlightCount = 0;
+    int answeredCount = 0;
+    bool dispatching = false;
 };
 } // anonymous namespace
 
@@ -131,26 +349,48 @@ class AbstractRestServerPrivate
 {
     Q_DECLARE_PUBLIC(AbstractRestServer)
     friend WorkerThread;
+    friend LocalServer;
+    friend BatchRequest;
     AbstractRestServerPrivate() = default;
     AbstractRestServerPrivate(const AbstractRestServerPrivate &other) = delete;
     AbstractRestServerPrivate &operator=(const AbstractRestServerPrivate &other) = delete;
     AbstractRestServerPrivate(const AbstractRestServerPrivate &&other) = delete;
     AbstractRestServerPrivate &operator=(const AbstractRestServerPrivate &&other) = delete;
 
-    void tryToCallMethod(QTcpSocket *socket, const QString &type, const QString &method, const QStringList &headers,
-                         const QByteArray &body);
+    struct RateLimit
+    {
+        double requestsPerSecond = 0.0;
+        int burst = 0;
+    };
+
+    void dispatchConnection(qintptr socketDescriptor, bool isLocal);
+    QSharedPointer<WorkerThread> createWorker();
+    void retireIdleWorkers();
+    void tryToCallMethod(RestConnection connection, const QHostAddress &peer, const QString &type,
+                         const QString &method, const QStringList &headers, const QByteArray &body);
     QStringList makeMethodName(const QString &type, const QString &name);
     MethodNode *findMethod(const QStringList &splittedMethod, QStringList &methodVariableParts);
     void fillMethods();
     void addMethodToTree(const QString &realMethod, const QString &tag);
 
-    void sendAnswer(QTcpSocket *socket, const QByteArray &body, const QString &contentType,
+    void sendAnswer(const RestConnection &connection, const QByteArray &body, const QString &contentType,
                     const QHash<QString, QString> &headers, int returnCode = 200, const QString &reason = QString());
-    void registerSocket(QTcpSocket *socket);
-    void deleteSocket(QTcpSocket *socket, WorkerThread *worker);
+    void sendJsonAnswer(const RestConnection &connection, const QJsonDocument &body, int returnCode = 200,
+                        const QString &reason = QString());
+    qint64 peerThrottleTime(const QHostAddress &peer);
+    qint64 routeThrottleTime(const RestConnection &connection, const QString &methodName);
+    void sendTooManyRequests(const RestConnection &connection, qint64 throttleTime);
+    void captureRequest(const QHostAddress &peer, const QString &method, const QString &uri, const QStringList &headers,
+                        const QByteArray &body);
+    static RestConnection createConnection(const QWeakPointer<RestConnectionOwner> &owner, quint32 slot,
+                                           quint32 generation, quint32 stream, const QHostAddress &peer,
+                                           const QSharedPointer<RequestCancellation> &cancellation);
+    static QSharedPointer<RequestCancellation> cancellation(const RestConnection &connection);
+    static void setFormDataParts(RestConnection &connection, const QVector<RestFormDataPart> &parts);
 
     const QString restMethodPrefix = QStringLiteral("rest_");
     const QString noAuthTag = QStringLiteral("NO_AUTH_REQUIRED");
+    const QString batchMethodName = QStringLiteral("rest_post_System_Batch");
 
     AbstractRestServer *q_ptr = nullptr;
     quint16 port = 0;
@@ -158,15 +398,43 @@ class AbstractRestServerPrivate
     QString password;
     QString pathPrefix;
     QStringList splittedPathPrefix;
+    QString localSocketPath;
+    bool tcpListeningEnabled = true;
+    bool http2Enabled = false;
+    int http2MaxConcurrentStreams = DEFAULT_HTTP2_MAX_CONCURRENT_STREAMS;
+    QSslConfiguration sslConfiguration;
+    bool sslEnabled = false;
+    bool keepAliveEnabled = false;
+    ServerMetrics metrics;
+    LocalServer *localServer = nullptr;
     QThread *serverThread = nullptr;
-    QVector<WorkerThreadInfo> threadPool;
-    QReadWriteLock threadPoolLock;
-    QSet<QTcpSocket *> sockets;
-    QMutex socketsMutex;
+    QVector<QSharedPointer<WorkerThread>> threadPool;
+    mutable QReadWriteLock threadPoolLock;
     MethodNode methodsTreeRoot;
     int suggestedMaxThreadsCount = MIN_THREADS_COUNT;
+    int minThreadsCount = 0;
+    int idleThreadTimeout = 0;
+    QVector<quint64> workerCpuAffinity;
+    QTimer *idleWorkersTimer = nullptr;
     RestAuthType authType = RestAuthType::NoAuth;
     QHash<QString, QString> customHeaders;
+    RateLimit peerRateLimit;
+    QHash<QString, RateLimit> routeRateLimits;
+    RateLimiter peerRateLimiter;
+    RateLimiter routeRateLimiter;
+    int handlerTimeout = 0;
+    QHash<QString, int> routeHandlerTimeouts;
+    QScopedPointer<AccessLogWriter> accessLog;
+    const QString requestIdPrefix = QString::number(QDateTime::currentMSecsSinceEpoch(), 36);
+    std::atomic_llong requestIdCounter{0};
+    // Write lock is taken only to replace writer, workers push records under read lock
+    mutable QReadWriteLock trafficCaptureLock;
+    QScopedPointer<TrafficCaptureWriter> trafficCapture;
+    std::atomic_bool captureEnabled{false};
+    qint64 formDataMaxPartSize = 0;
+    qint64 formDataInMemoryPartSize = 0;
+    int maxBatchRequests = DEFAULT_MAX_BATCH_REQUESTS;
+    int maxConcurrentBatchRequests = DEFAULT_MAX_CONCURRENT_BATCH_REQUESTS;
 };
 
 } // namespace Proof
@@ -206,13 +474,20 @@ AbstractRestServer::~AbstractRestServer()
     Q_D(AbstractRestServer);
     stopListen();
     d->threadPoolLock.lockForWrite();
-    for (const WorkerThreadInfo &workerInfo : qAsConst(d->threadPool)) {
-        workerInfo.thread->stop();
-        workerInfo.thread->quit();
-        workerInfo.thread->wait(1000);
-        delete workerInfo.thread;
+    for (const auto &worker : qAsConst(d->threadPool)) {
+        worker->stop();
+        worker->quit();
+        worker->wait(1000);
+        worker->detachFromServer();
     }
+    d->threadPool.clear();
     d->threadPoolLock.unlock();
+    if (d->accessLog)
+        d->accessLog->stop();
+    d->trafficCaptureLock.lockForWrite();
+    if (d->trafficCapture)
+        d->trafficCapture->stop();
+    d->trafficCaptureLock.unlock();
 
     d->serverThread->quit();
     d->serverThread->wait(1000);
@@ -244,6 +519,30 @@ int AbstractRestServer::port() const
     return d->port;
 }
 
+QString AbstractRestServer::localSocketPath() const
+{
+    Q_D_CONST(AbstractRestServer);
+    return d->localSocketPath;
+}
+
+bool AbstractRestServer::tcpListeningEnabled() const
+{
+    Q_D_CONST(AbstractRestServer);
+    return d->tcpListeningEnabled;
+}
+
+bool AbstractRestServer::http2Enabled() const
+{
+    Q_D_CONST(AbstractRestServer);
+    return d->http2Enabled;
+}
+
+QSslConfiguration AbstractRestServer::sslConfiguration() const
+{
+    Q_D_CONST(AbstractRestServer);
+    return d->sslConfiguration;
+}
+
 RestAuthType AbstractRestServer::authType() const
 {
     Q_D_CONST(AbstractRestServer);
@@ -288,6 +587,46 @@ void AbstractRestServer::setPort(quint16 port)
     }
 }
 
+void AbstractRestServer::setLocalSocketPath(const QString &localSocketPath)
+{
+    Q_D(AbstractRestServer);
+    if (d->localSocketPath != localSocketPath) {
+        d->localSocketPath = localSocketPath;
+        emit localSocketPathChanged(d->localSocketPath);
+    }
+}
+
+void AbstractRestServer::setTcpListeningEnabled(bool enabled)
+{
+    Q_D(AbstractRestServer);
+    d->tcpListeningEnabled = enabled;
+}
+
+void AbstractRestServer::setHttp2Enabled(bool enabled)
+{
+    Q_D(AbstractRestServer);
+    d->http2Enabled = enabled;
+}
+
+void AbstractRestServer::setHttp2MaxConcurrentStreams(int count)
+{
+    Q_D(AbstractRestServer);
+    d->http2MaxConcurrentStreams = qMax(1, count);
+}
+
+void AbstractRestServer::setSslConfiguration(const QSslConfiguration &configuration)
+{
+    Q_D(AbstractRestServer);
+    d->sslConfiguration = configuration;
+    d->sslEnabled = !configuration.localCertificate().isNull() && !configuration.privateKey().isNull();
+}
+
+void AbstractRestServer::setKeepAliveEnabled(bool enabled)
+{
+    Q_D(AbstractRestServer);
+    d->keepAliveEnabled = enabled;
+}
+
 void AbstractRestServer::setSuggestedMaxThreadsCount(int count)
 {
     Q_D(AbstractRestServer);
@@ -301,6 +640,112 @@ void AbstractRestServer::setSuggestedMaxThreadsCount(int count)
     d->suggestedMaxThreadsCount = count;
 }
 
+void AbstractRestServer::setMinThreadsCount(int count)
+{
+    Q_D(AbstractRestServer);
+    d->minThreadsCount = qMax(0, count);
+}
+
+void AbstractRestServer::setIdleThreadTimeout(int msecs)
+{
+    Q_D(AbstractRestServer);
+    d->idleThreadTimeout = qMax(0, msecs);
+}
+
+void AbstractRestServer::setWorkerCpuAffinity(const QVector<quint64> &masks)
+{
+    Q_D(AbstractRestServer);
+    d->workerCpuAffinity = masks;
+    d->workerCpuAffinity.removeAll(0);
+}
+
+void AbstractRestServer::setPeerRateLimit(double requestsPerSecond, int burst)
+{
+    Q_D(AbstractRestServer);
+    d->peerRateLimit.requestsPerSecond = requestsPerSecond;
+    d->peerRateLimit.burst = qMax(1, burst);
+}
+
+void AbstractRestServer::setRouteRateLimit(const QString &restMethod, double requestsPerSecond, int burst)
+{
+    Q_D(AbstractRestServer);
+    if (requestsPerSecond <= 0.0) {
+        d->routeRateLimits.remove(restMethod);
+        return;
+    }
+    AbstractRestServerPrivate::RateLimit limit;
+    limit.requestsPerSecond = requestsPerSecond;
+    limit.burst = qMax(1, burst);
+    d->routeRateLimits[restMethod] = limit;
+}
+
+void AbstractRestServer::setHandlerTimeout(int msecs)
+{
+    Q_D(AbstractRestServer);
+    d->handlerTimeout = qMax(0, msecs);
+}
+
+void AbstractRestServer::setRouteHandlerTimeout(const QString &restMethod, int msecs)
+{
+    Q_D(AbstractRestServer);
+    d->routeHandlerTimeouts[restMethod] = qMax(0, msecs);
+}
+
+void AbstractRestServer::setFormDataStreaming(qint64 maxPartSize, qint64 inMemoryPartSize)
+{
+    Q_D(AbstractRestServer);
+    d->formDataMaxPartSize = qMax(0ll, maxPartSize);
+    d->formDataInMemoryPartSize = qMax(0ll, inMemoryPartSize);
+}
+
+void AbstractRestServer::setTrafficCapture(const QString &filePath,
+                                           const std::function<void(TrafficCaptureRecord &)> &redactor)
+{
+    Q_D(AbstractRestServer);
+    d->trafficCaptureLock.lockForWrite();
+    d->captureEnabled = false;
+    if (d->trafficCapture)
+        d->trafficCapture->stop();
+    d->trafficCapture.reset();
+    if (!filePath.isEmpty()) {
+        d->trafficCapture.reset(new TrafficCaptureWriter(filePath, redactor));
+        if (d->trafficCapture->open()) {
+            d->trafficCapture->start();
+            d->captureEnabled = true;
+        } else {
+            qCWarning(proofNetworkMiscLog) << "RestServer: can't open traffic capture file" << filePath << ":"
+                                           << d->trafficCapture->errorString();
+            d->trafficCapture.reset();
+        }
+    }
+    d->trafficCaptureLock.unlock();
+}
+
+void AbstractRestServer::setAccessLog(const QString &filePath)
+{
+    Q_D(AbstractRestServer);
+    if (d->accessLog)
+        d->accessLog->stop();
+    d->accessLog.reset();
+    if (filePath.isEmpty())
+        return;
+    d->accessLog.reset(new AccessLogWriter(filePath));
+    if (!d->accessLog->open()) {
+        qCWarning(proofNetworkMiscLog) << "RestServer: can't open access log" << filePath << ":"
+                                       << d->accessLog->errorString();
+        d->accessLog.reset();
+        return;
+    }
+    d->accessLog->start();
+}
+
+void AbstractRestServer::setBatchLimits(int maxRequests, int maxConcurrentRequests)
+{
+    Q_D(AbstractRestServer);
+    d->maxBatchRequests = qMax(1, maxRequests);
+    d->maxConcurrentBatchRequests = qMax(1, maxConcurrentRequests);
+}
+
 void AbstractRestServer::setAuthType(RestAuthType authType)
 {
     Q_ASSERT(authType == RestAuthType::NoAuth || authType == RestAuthType::Basic);
@@ -340,20 +785,79 @@ void AbstractRestServer::startListen()
     Q_D(AbstractRestServer);
     if (!ProofObject::call(this, &AbstractRestServer::startListen)) {
         d->fillMethods();
-        bool isListen = listen(QHostAddress::Any, d->port);
-        if (!isListen)
-            qCCritical(proofNetworkMiscLog) << "Server can't start on port" << d->port;
+        d->threadPoolLock.lockForWrite();
+        while (d->threadPool.count() < d->minThreadsCount)
+            d->threadPool << d->createWorker();
+        d->threadPoolLock.unlock();
+        if (d->idleThreadTimeout && !d->idleWorkersTimer) {
+            d->idleWorkersTimer = new QTimer(this);
+            connect(d->idleWorkersTimer, &QTimer::timeout, this, [d] { d->retireIdleWorkers(); });
+            d->idleWorkersTimer->start(IDLE_WORKERS_CHECK_INTERVAL);
+        }
+        if (d->tcpListeningEnabled) {
+            bool isListen = listen(QHostAddress::Any, d->port);
+            if (!isListen)
+                qCCritical(proofNetworkMiscLog) << "Server can't start on port" << d->port;
+        }
+        if (!d->localSocketPath.isEmpty()) {
+            if (!d->localServer)
+                d->localServer = new LocalServer(d, this);
+            // Socket file can be left after previous run if it wasn't finished properly
+            QLocalServer::removeServer(d->localSocketPath);
+            bool isListen = d->localServer->listen(d->localSocketPath);
+            if (!isListen) {
+                qCCritical(proofNetworkMiscLog) << "Server can't start on local socket" << d->localSocketPath << ":"
+                                                << d->localServer->errorString();
+            }
+        }
     }
 }
 
 void AbstractRestServer::stopListen()
 {
-    if (!ProofObject::call(this, &AbstractRestServer::stopListen, Proof::Call::Block))
+    Q_D(AbstractRestServer);
+    if (!ProofObject::call(this, &AbstractRestServer::stopListen, Proof::Call::Block)) {
         close();
+        if (d->localServer)
+            d->localServer->close();
+    }
+}
+
+bool AbstractRestServer::isListeningLocally() const
+{
+    Q_D_CONST(AbstractRestServer);
+    return d->localServer && d->localServer->isListening();
 }
 
-void AbstractRestServer::rest_get_System_Status(QTcpSocket *socket, const QStringList &, const QStringList &,
-                                                const QUrlQuery &query, const QByteArray &)
+QVariantMap AbstractRestServer::metrics() const
+{
+    Q_D_CONST(AbstractRestServer);
+    const ServerMetrics &metrics = d->metrics;
+    const qint64 handshakesCount = metrics.tlsHandshakesCount;
+    d->threadPoolLock.lockForRead();
+    const int workersCount = d->threadPool.count();
+    d->threadPoolLock.unlock();
+    d->trafficCaptureLock.lockForRead();
+    const qint64 trafficCaptureDroppedCount = d->trafficCapture ? d->trafficCapture->droppedCount() : 0ll;
+    d->trafficCaptureLock.unlock();
+    return QVariantMap{
+        {QStringLiteral("worker_threads_count"), workersCount},
+        {QStringLiteral("retired_worker_threads_count"), static_cast<qint64>(metrics.retiredWorkerThreadsCount)},
+        {QStringLiteral("canceled_requests_count"), static_cast<qint64>(metrics.canceledRequestsCount)},
+        {QStringLiteral("handler_timeouts_count"), static_cast<qint64>(metrics.handlerTimeoutsCount)},
+        {QStringLiteral("access_log_dropped_records_count"), d->accessLog ? d->accessLog->droppedCount() : 0ll},
+        {QStringLiteral("traffic_capture_dropped_records_count"), trafficCaptureDroppedCount},
+        {QStringLiteral("tls_handshakes_count"), handshakesCount},
+        {QStringLiteral("tls_handshake_failures_count"), static_cast<qint64>(metrics.tlsHandshakeFailuresCount)},
+        {QStringLiteral("tls_handshake_avg_time_ms"),
+         handshakesCount ? metrics.tlsHandshakesTotalTime / 1000.0 / handshakesCount : 0.0},
+        {QStringLiteral("tls_handshake_max_time_ms"), metrics.tlsHandshakeMaxTime / 1000.0},
+        {QStringLiteral("tls_reused_connection_requests_count"),
+         static_cast<qint64>(metrics.tlsReusedConnectionRequestsCount)}};
+}
+
+void AbstractRestServer::rest_get_System_Status(const RestConnection &connection, const QStringList &,
+                                                const QStringList &, const QUrlQuery &query, const QByteArray &)
 {
     auto maybeHealthStatus = healthStatus(query.hasQueryItem(QStringLiteral("quick")));
 
@@ -390,7 +894,9 @@ void AbstractRestServer::rest_get_System_Status(QTcpSocket *socket, const QStrin
                                {QStringLiteral("os"), QSysInfo::prettyProductName()},
                                {QStringLiteral("network_addresses"), QJsonArray::fromStringList(ipsList)}};
     maybeHealthStatus
-        ->onSuccess([this, socket, statusTemplate](const HealthStatusMap &healthStatus) {
+        ->onSuccess([this, connection, statusTemplate](const HealthStatusMap &healthStatus) {
+            if (connection.isCanceled())
+                return;
             auto statusObj = statusTemplate;
             auto notificationsMemoryStorage = ErrorNotifier::instance()->handler<MemoryStorageNotificationHandler>();
             QPair<QDateTime, QString> lastError;
@@ -415,91 +921,184 @@ void AbstractRestServer::rest_get_System_Status(QTcpSocket *socket, const QStrin
             };
             statusObj[QStringLiteral("health")] = algorithms::map(healthStatus, healthMapper, QJsonArray());
             statusObj[QStringLiteral("generated_at")] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
-            sendAnswer(socket, QJsonDocument(statusObj).toJson(), QStringLiteral("text/json"));
+            sendJsonAnswer(connection, QJsonDocument(statusObj));
         })
-        ->onFailure([this, socket](const Failure &f) {
+        ->onFailure([this, connection](const Failure &f) {
             qCDebug(proofNetworkMiscLog) << "Health status fetch failed with " << f.message << f.data;
-            sendInternalError(socket);
+            sendInternalError(connection);
         });
 }
 
-void AbstractRestServer::rest_get_System_RecentErrors(QTcpSocket *socket, const QStringList &, const QStringList &,
-                                                      const QUrlQuery &, const QByteArray &)
+void AbstractRestServer::rest_get_System_RecentErrors(const RestConnection &connection, const QStringList &,
+                                                      const QStringList &, const QUrlQuery &query, const QByteArray &)
 {
-    auto notificationsMemoryStorage = ErrorNotifier::instance()->handler<MemoryStorageNotificationHandler>();
-    auto lastErrors = notificationsMemoryStorage
-                          ? notificationsMemoryStorage->messages()
-                          : QMultiMap<QDateTime, QString>{{QDateTime::currentDateTimeUtc(),
-                                                           QStringLiteral("Memory storage error handler not set")}};
+    bool sinceIsValid = true;
+    bool limitIsValid = true;
+    const qint64 since = query.hasQueryItem(QStringLiteral("since"))
+                             ? query.queryItemValue(QStringLiteral("since")).toLongLong(&sinceIsValid)
+                             : 0;
+    const int limit = query.hasQueryItem(QStringLiteral("limit"))
+                          ? query.queryItemValue(QStringLiteral("limit")).toInt(&limitIsValid)
+                          : -1;
+    if (!sinceIsValid || !limitIsValid || since < 0) {
+        sendBadRequest(connection, QStringLiteral("since and limit must be numbers"));
+        return;
+    }
+    // Whole history is returned only if limit is omitted
+    if (query.hasQueryItem(QStringLiteral("limit")) && limit <= 0) {
+        sendBadRequest(connection, QStringLiteral("limit must be positive"));
+        return;
+    }
 
-    auto errorObjectBuilder = [](const QDateTime &time, const QString &error) -> QJsonObject {
-        return QJsonObject{{"timestamp", time.toString(Qt::ISODate)}, {"message", error}};
-    };
+    auto notificationsMemoryStorage = ErrorNotifier::instance()->handler<MemoryStorageNotificationHandler>();
+    const auto lastErrors = notificationsMemoryStorage
+                                ? notificationsMemoryStorage->messagesSince(since, limit)
+                                : QVector<MemoryStorageNotificationHandler::Message>{
+                                      {0, QDateTime::currentDateTimeUtc(),
+                                       QStringLiteral("Memory storage error handler not set")}};
 
     QJsonArray recentErrorsArray;
-    QList<QDateTime> uniqueErrorsKeys = lastErrors.uniqueKeys();
-    std::reverse(uniqueErrorsKeys.begin(), uniqueErrorsKeys.end());
-    for (const auto &time : uniqueErrorsKeys) {
-        const auto allMessages = lastErrors.values(time);
-        for (const auto &message : allMessages)
-            recentErrorsArray.append(errorObjectBuilder(time, message));
+    for (const auto &error : lastErrors) {
+        recentErrorsArray.append(QJsonObject{{"id", error.id},
+                                             {"timestamp", error.time.toString(Qt::ISODate)},
+                                             {"message", error.text}});
     }
-    sendAnswer(socket, QJsonDocument(recentErrorsArray).toJson(), QStringLiteral("text/json"));
+    sendJsonAnswer(connection, QJsonDocument(recentErrorsArray));
 }
 
-FutureSP<HealthStatusMap> AbstractRestServer::healthStatus(bool) const
+void AbstractRestServer::rest_get_System_Metrics(const RestConnection &connection, const QStringList &,
+                                                 const QStringList &, const QUrlQuery &, const QByteArray &)
 {
-    return Future<HealthStatusMap>::successful();
+    sendJsonAnswer(connection, QJsonDocument(QJsonObject::fromVariantMap(metrics())));
 }
 
-void AbstractRestServer::incomingConnection(qintptr socketDescriptor)
+void AbstractRestServer::rest_post_System_Batch(const RestConnection &connection, const QStringList &headers,
+                                                const QStringList &, const QUrlQuery &, const QByteArray &body)
 {
     Q_D(AbstractRestServer);
+    QJsonDocument doc = parseJsonBody(connection, body);
+    if (!doc.isArray()) {
+        sendBadRequest(connection, QStringLiteral("Batch body must be a json array"));
+        return;
+    }
+    const QJsonArray requestsArray = doc.array();
+    if (requestsArray.count() > d->maxBatchRequests) {
+        sendBadRequest(connection, QStringLiteral("Too many requests in batch"));
+        return;
+    }
 
-    qCDebug(proofNetworkMiscLog) << "Incoming connection with socket descriptor" << socketDescriptor;
+    // Sub-requests inherit all headers except ones describing batch body itself or explicitly overridden.
+    // Sub-responses are embedded into batch answer, so CBOR is negotiated only for batch as a whole
+    QStringList inheritedHeaders;
+    for (const QString &header : headers) {
+        if (header.startsWith(QLatin1String("Content-"), Qt::CaseInsensitive))
+            continue;
+        if (connection.acceptsCbor() && header.startsWith(QLatin1String("Accept:"), Qt::CaseInsensitive))
+            continue;
+        inheritedHeaders << header;
+    }
 
-    WorkerThread *worker = nullptr;
+    QVector<BatchRequest::SubRequest> requests;
+    requests.reserve(requestsArray.count());
+    for (const QJsonValue &value : requestsArray) {
+        const QJsonObject requestObject = value.toObject();
+        BatchRequest::SubRequest request;
+        request.method = requestObject.value(QStringLiteral("method")).toString(QStringLiteral("GET")).toUpper();
+        request.path = requestObject.value(QStringLiteral("path")).toString();
+        if (request.path.isEmpty()) {
+            sendBadRequest(connection, QStringLiteral("Path is required for each request in batch"));
+            return;
+        }
 
-    d->threadPoolLock.lockForRead();
-    if (!d->threadPool.isEmpty()) {
-        auto iter = std::min_element(d->threadPool.begin(), d->threadPool.end(),
-                                     [](const WorkerThreadInfo &lhs, const WorkerThreadInfo &rhs) {
-                                         return lhs.socketCount < rhs.socketCount;
-                                     });
-        if (iter->socketCount == 0 || d->threadPool.count() >= d->suggestedMaxThreadsCount) {
-            worker = iter->thread;
-            ++iter->socketCount;
+        const QJsonObject headersObject = requestObject.value(QStringLiteral("headers")).toObject();
+        QSet<QString> overriddenHeaders;
+        for (auto it = headersObject.constBegin(); it != headersObject.constEnd(); ++it)
+            overriddenHeaders << it.key().toLower();
+        for (const QString &header : qAsConst(inheritedHeaders)) {
+            if (!overriddenHeaders.contains(header.section(':', 0, 0).trimmed().toLower()))
+                request.headers << header;
         }
+        for (auto it = headersObject.constBegin(); it != headersObject.constEnd(); ++it)
+            request.headers << QStringLiteral("%1: %2").arg(it.key(), it.value().toString());
+
+        const QJsonValue bodyValue = requestObject.value(QStringLiteral("body"));
+        if (bodyValue.isString())
+            request.body = bodyValue.toString().toUtf8();
+        else if (bodyValue.isObject())
+            request.body = QJsonDocument(bodyValue.toObject()).toJson(QJsonDocument::Compact);
+        else if (bodyValue.isArray())
+            request.body = QJsonDocument(bodyValue.toArray()).toJson(QJsonDocument::Compact);
+        if (!request.body.isEmpty())
+            request.headers << QStringLiteral("Content-Length: %1").arg(request.body.size());
+        requests << request;
     }
-    d->threadPoolLock.unlock();
 
-    if (worker == nullptr) {
-        worker = new WorkerThread(d);
-        worker->start();
-        d->threadPoolLock.lockForWrite();
-        d->threadPool << WorkerThreadInfo(worker, 1);
-        d->threadPoolLock.unlock();
-    }
+    auto batch = QSharedPointer<BatchRequest>(new BatchRequest(d, connection, requests, d->maxConcurrentBatchRequests),
+                                              &QObject::deleteLater);
+    batch->start(batch);
+}
 
-    worker->handleNewConnection(socketDescriptor);
+FutureSP<HealthStatusMap> AbstractRestServer::healthStatus(bool) const
+{
+    return Future<HealthStatusMap>::successful();
+}
+
+void AbstractRestServer::incomingConnection(qintptr socketDescriptor)
+{
+    Q_D(AbstractRestServer);
+    qCDebug(proofNetworkMiscLog) << "Incoming connection with socket descriptor" << socketDescriptor;
+    d->dispatchConnection(socketDescriptor, false);
 }
 
-void AbstractRestServer::sendAnswer(QTcpSocket *socket, const QByteArray &body, const QString &contentType,
-                                    int returnCode, const QString &reason)
+void AbstractRestServer::sendAnswer(const RestConnection &connection, const QByteArray &body,
+                                    const QString &contentType, int returnCode, const QString &reason)
 {
     Q_D(AbstractRestServer);
-    d->sendAnswer(socket, body, contentType, QHash<QString, QString>(), returnCode, reason);
+    d->sendAnswer(connection, body, contentType, QHash<QString, QString>(), returnCode, reason);
 }
 
-void AbstractRestServer::sendAnswer(QTcpSocket *socket, const QByteArray &body, const QString &contentType,
-                                    const QHash<QString, QString> &headers, int returnCode, const QString &reason)
+void AbstractRestServer::sendAnswer(const RestConnection &connection, const QByteArray &body,
+                                    const QString &contentType, const QHash<QString, QString> &headers, int returnCode,
+                                    const QString &reason)
 {
     Q_D(AbstractRestServer);
-    d->sendAnswer(socket, body, contentType, headers, returnCode, reason);
+    d->sendAnswer(connection, body, contentType, headers, returnCode, reason);
+}
+
+void AbstractRestServer::sendJsonAnswer(const RestConnection &connection, const QJsonDocument &body, int returnCode,
+                                        const QString &reason)
+{
+    Q_D(AbstractRestServer);
+    d->sendJsonAnswer(connection, body, returnCode, reason);
+}
+
+QJsonDocument AbstractRestServer::parseJsonBody(const RestConnection &connection, const QByteArray &body,
+                                                bool *ok) const
+{
+    QJsonDocument result;
+#ifdef PROOF_REST_SERVER_CBOR
+    if (connection.hasCborBody()) {
+        QCborParserError parseError;
+        const QCborValue value = QCborValue::fromCbor(body, &parseError);
+        if (parseError.error == QCborError::NoError) {
+            if (value.isMap())
+                result = QJsonDocument(value.toMap().toJsonObject());
+            else if (value.isArray())
+                result = QJsonDocument(value.toArray().toJsonArray());
+        }
+    } else {
+        result = QJsonDocument::fromJson(body);
+    }
+#else
+    result = QJsonDocument::fromJson(body);
+#endif
+    if (ok)
+        *ok = !result.isNull();
+    return result;
 }
 
-void AbstractRestServer::sendErrorCode(QTcpSocket *socket, int returnCode, const QString &reason, int errorCode,
-                                       const QStringList &args)
+void AbstractRestServer::sendErrorCode(const RestConnection &connection, int returnCode, const QString &reason,
+                                       int errorCode, const QStringList &args)
 {
     QJsonObject body;
     body.insert(QStringLiteral("error_code"), errorCode);
@@ -509,8 +1108,7 @@ void AbstractRestServer::sendErrorCode(QTcpSocket *socket, int returnCode, const
             jsonArgs << arg;
         body.insert(QStringLiteral("message_args"), jsonArgs);
     }
-    sendAnswer(socket, QJsonDocument(body).toJson(QJsonDocument::Compact), QStringLiteral("application/json"),
-               returnCode, reason);
+    sendJsonAnswer(connection, QJsonDocument(body), returnCode, reason);
 }
 
 bool AbstractRestServer::checkBasicAuth(const QString &encryptedAuth) const
@@ -522,45 +1120,46 @@ bool AbstractRestServer::checkBasicAuth(const QString &encryptedAuth) const
     return false;
 }
 
-QString AbstractRestServer::parseAuth(QTcpSocket *socket, const QString &header)
+QString AbstractRestServer::parseAuth(const RestConnection &connection, const QString &header)
 {
     QString auth;
     QStringList parts = header.split(QStringLiteral(":"));
     if (parts.count() != 2) {
-        sendInternalError(socket);
+        sendInternalError(connection);
     } else {
         parts = parts.at(1).split(QStringLiteral(" "), QString::SkipEmptyParts);
         if (parts.count() != 2 || parts.at(0) != QLatin1String("Basic"))
-            sendNotAuthorized(socket);
+            sendNotAuthorized(connection);
         else
             auth = parts.at(1);
     }
     return auth;
 }
 
-void AbstractRestServer::sendBadRequest(QTcpSocket *socket, const QString &reason)
+void AbstractRestServer::sendBadRequest(const RestConnection &connection, const QString &reason)
 {
-    sendAnswer(socket, "", QStringLiteral("text/plain; charset=utf-8"), 400, reason);
+    sendAnswer(connection, "", QStringLiteral("text/plain; charset=utf-8"), 400, reason);
 }
 
-void AbstractRestServer::sendNotFound(QTcpSocket *socket, const QString &reason)
+void AbstractRestServer::sendNotFound(const RestConnection &connection, const QString &reason)
 {
-    sendAnswer(socket, "", QStringLiteral("text/plain; charset=utf-8"), 404, reason);
+    sendAnswer(connection, "", QStringLiteral("text/plain; charset=utf-8"), 404, reason);
 }
 
-void AbstractRestServer::sendNotAuthorized(QTcpSocket *socket, const QString &reason)
+void AbstractRestServer::sendNotAuthorized(const RestConnection &connection, const QString &reason)
 {
-    sendAnswer(socket, "", QStringLiteral("text/plain; charset=utf-8"), 401, reason);
+    sendAnswer(connection, "", QStringLiteral("text/plain; charset=utf-8"), 401, reason);
 }
 
-void AbstractRestServer::sendConflict(QTcpSocket *socket, const QString &reason)
+void AbstractRestServer::sendConflict(const RestConnection &connection, const QString &reason)
 {
-    sendAnswer(socket, "", QStringLiteral("text/plain; charset=utf-8"), 409, reason);
+    sendAnswer(connection, "", QStringLiteral("text/plain; charset=utf-8"), 409, reason);
 }
 
-void AbstractRestServer::sendInternalError(QTcpSocket *socket)
+void AbstractRestServer::sendInternalError(const RestConnection &connection)
 {
-    sendAnswer(socket, "", QStringLiteral("text/plain; charset=utf-8"), 500, QStringLiteral("Internal Server Error"));
+    sendAnswer(connection, "", QStringLiteral("text/plain; charset=utf-8"), 500,
+               QStringLiteral("Internal Server Error"));
 }
 
 QStringList AbstractRestServerPrivate::makeMethodName(const QString &type, const QString &name)
@@ -644,10 +1243,87 @@ void AbstractRestServerPrivate::addMethodToTree(const QString &realMethod, const
     currentNode->setTag(tag);
 }
 
-void AbstractRestServerPrivate::tryToCallMethod(QTcpSocket *socket, const QString &type, const QString &method,
+void AbstractRestServerPrivate::dispatchConnection(qintptr socketDescriptor, bool isLocal)
+{
+    QSharedPointer<WorkerThread> worker;
+
+    threadPoolLock.lockForRead();
+    if (!threadPool.isEmpty()) {
+        auto iter = std::min_element(threadPool.cbegin(), threadPool.cend(),
+                                     [](const QSharedPointer<WorkerThread> &lhs,
+                                        const QSharedPointer<WorkerThread> &rhs) {
+                                         return lhs->socketCount() < rhs->socketCount();
+                                     });
+        if ((*iter)->socketCount() == 0 || threadPool.count() >= suggestedMaxThreadsCount)
+            worker = *iter;
+    }
+    threadPoolLock.unlock();
+
+    if (!worker) {
+        worker = createWorker();
+        threadPoolLock.lockForWrite();
+        threadPool << worker;
+        threadPoolLock.unlock();
+    }
+
+    worker->increaseSocketCount();
+    worker->handleNewConnection(socketDescriptor, isLocal);
+}
+
+QSharedPointer<WorkerThread> AbstractRestServerPrivate::createWorker()
+{
+    // Pool is modified only from server thread, so no lock is needed for reading it here
+    quint64 cpuAffinity = 0;
+    int leastUsage = std::numeric_limits<int>::max();
+    for (quint64 mask : qAsConst(workerCpuAffinity)) {
+        int usage = static_cast<int>(std::count_if(threadPool.cbegin(), threadPool.cend(), [mask](const auto &worker) {
+            return worker->cpuAffinity() == mask;
+        }));
+        if (usage < leastUsage) {
+            leastUsage = usage;
+            cpuAffinity = mask;
+        }
+    }
+    // Last reference can be dropped by request handler via connection owner, so deleter is used
+    auto worker = QSharedPointer<WorkerThread>(
+        new WorkerThread(this, cpuAffinity, accessLog ? accessLog->createBuffer() : QSharedPointer<AccessLogBuffer>()),
+        &WorkerThread::destroy);
+    worker->start();
+    return worker;
+}
+
+void AbstractRestServerPrivate::retireIdleWorkers()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QVector<QSharedPointer<WorkerThread>> retiredWorkers;
+    threadPoolLock.lockForWrite();
+    for (auto it = threadPool.begin(); it != threadPool.end() && threadPool.count() > minThreadsCount;) {
+        if ((*it)->socketCount() == 0 && now - (*it)->lastActivityTime() >= idleThreadTimeout) {
+            retiredWorkers << *it;
+            it = threadPool.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    threadPoolLock.unlock();
+
+    if (!retiredWorkers.isEmpty()) {
+        metrics.retiredWorkerThreadsCount += retiredWorkers.count();
+        qCDebug(proofNetworkMiscLog) << "RestServer:" << retiredWorkers.count() << "idle workers retired";
+    }
+}
+
+void AbstractRestServerPrivate::tryToCallMethod(RestConnection connection, const QHostAddress &peer,
+                                                const QString &type, const QString &method,
                                                 const QStringList &headers, const QByteArray &body)
 {
     Q_Q(AbstractRestServer);
+#ifdef PROOF_REST_SERVER_CBOR
+    connection.m_acceptsCbor = headerListsMediaType(headers, QLatin1String("Accept"),
+                                                    QLatin1String("application/cbor"));
+    connection.m_cborBody = headerListsMediaType(headers, QLatin1String("Content-Type"),
+                                                 QLatin1String("application/cbor"));
+#endif
     QStringList splittedByParamsMethod = method.split('?');
     QStringList methodVariableParts;
     QUrlQuery queryParams;
@@ -658,194 +1334,952 @@ void AbstractRestServerPrivate::tryToCallMethod(QTcpSocket *socket, const QStrin
 
     MethodNode *methodNode = findMethod(makeMethodName(type, splittedByParamsMethod.at(0)), methodVariableParts);
     QString methodName = methodNode ? (*methodNode) : QString();
-    qCDebug(proofNetworkMiscLog) << "Request for" << method << "associated with" << methodName << "at socket" << socket;
+    qCDebug(proofNetworkMiscLog) << "Request for" << method << "associated with" << methodName << "at" << connection;
 
     if (methodNode) {
+        qint64 throttleTime = routeThrottleTime(connection, methodName);
+        if (throttleTime) {
+            sendTooManyRequests(connection, throttleTime);
+            return;
+        }
+
         bool isAuthenticationSuccessful = true;
         if (authType == RestAuthType::Basic && methodNode->tag() != noAuthTag) {
             QString encryptedAuth;
             for (int i = 0; i < headers.count(); ++i) {
                 if (headers.at(i).startsWith(QLatin1String("Authorization"), Qt::CaseInsensitive)) {
-                    encryptedAuth = q->parseAuth(socket, headers.at(i));
+                    encryptedAuth = q->parseAuth(connection, headers.at(i));
                     break;
                 }
             }
             isAuthenticationSuccessful = (!encryptedAuth.isEmpty() && q->checkBasicAuth(encryptedAuth));
         }
         if (isAuthenticationSuccessful) {
+            const int timeout = routeHandlerTimeouts.value(methodName, handlerTimeout);
+            auto owner = connection.m_owner.toStrongRef();
+            if (timeout && owner)
+                owner->startDeadline(connection.m_slot, connection.m_generation, connection.m_stream, timeout);
+            RequestCancellation::Scope cancellationScope(connection.m_cancellation);
             // clang-format off
             QMetaObject::invokeMethod(q, methodName.toLatin1().constData(), Qt::DirectConnection,
-                                      Q_ARG(QTcpSocket*, socket), Q_ARG(QStringList, headers),
+                                      Q_ARG(Proof::RestConnection, connection), Q_ARG(QStringList, headers),
                                       Q_ARG(QStringList, methodVariableParts), Q_ARG(QUrlQuery, queryParams),
                                       Q_ARG(QByteArray, body));
             // clang-format on
         } else {
-            q->sendNotAuthorized(socket);
+            q->sendNotAuthorized(connection);
         }
     } else {
-        q->sendNotFound(socket, QStringLiteral("Wrong method"));
+        q->sendNotFound(connection, QStringLiteral("Wrong method"));
     }
 }
 
-void AbstractRestServerPrivate::sendAnswer(QTcpSocket *socket, const QByteArray &body, const QString &contentType,
-                                           const QHash<QString, QString> &headers, int returnCode, const QString &reason)
+void AbstractRestServerPrivate::sendAnswer(const RestConnection &connection, const QByteArray &body,
+                                           const QString &contentType, const QHash<QString, QString> &headers,
+                                           int returnCode, const QString &reason)
 {
-    WorkerThread *worker = nullptr;
-    {
-        QMutexLocker lock(&socketsMutex);
-        if (sockets.contains(socket))
-            worker = qobject_cast<WorkerThread *>(socket->thread());
-    }
-    if (worker != nullptr) {
-        qCDebug(proofNetworkMiscLog) << "Replying" << returnCode << ":" << reason << "at socket" << socket;
-        worker->sendAnswer(socket, body, contentType, headers, returnCode, reason);
+    auto owner = connection.m_owner.toStrongRef();
+    if (owner) {
+        qCDebug(proofNetworkMiscLog) << "Replying" << returnCode << ":" << reason << "at" << connection;
+        owner->sendAnswer(connection.m_slot, connection.m_generation, connection.m_stream, body, contentType, headers,
+                          returnCode, reason);
     } else {
-        qCDebug(proofNetworkMiscLog).noquote()
-            << "Wanted to reply" << returnCode << ":" << reason << "at socket"
-            << QStringLiteral("QTcpSocket(%1)").arg(reinterpret_cast<quint64>(socket), 0, 16)
-            << "but it is dead already";
+        qCDebug(proofNetworkMiscLog) << "Wanted to reply" << returnCode << ":" << reason << "at" << connection
+                                     << "but it is dead already";
     }
 }
 
-void AbstractRestServerPrivate::registerSocket(QTcpSocket *socket)
+void AbstractRestServerPrivate::sendJsonAnswer(const RestConnection &connection, const QJsonDocument &body,
+                                               int returnCode, const QString &reason)
 {
-    QMutexLocker lock(&socketsMutex);
-    sockets.insert(socket);
+#ifdef PROOF_REST_SERVER_CBOR
+    if (connection.acceptsCbor()) {
+        const QCborValue value = body.isArray() ? QCborValue(QCborArray::fromJsonArray(body.array()))
+                                                : QCborValue(QCborMap::fromJsonObject(body.object()));
+        sendAnswer(connection, value.toCbor(), QStringLiteral("application/cbor"), QHash<QString, QString>(),
+                   returnCode, reason);
+        return;
+    }
+#endif
+    sendAnswer(connection, body.toJson(QJsonDocument::Compact), QStringLiteral("application/json"),
+               QHash<QString, QString>(), returnCode, reason);
 }
 
-void AbstractRestServerPrivate::deleteSocket(QTcpSocket *socket, WorkerThread *worker)
+void AbstractRestServerPrivate::captureRequest(const QHostAddress &peer, const QString &method, const QString &uri,
+                                               const QStringList &headers, const QByteArray &body)
 {
-    {
-        QMutexLocker lock(&socketsMutex);
-        auto iter = sockets.constFind(socket);
-        if (iter != sockets.cend())
-            sockets.erase(iter);
-        else
-            return;
+    if (!captureEnabled)
+        return;
+    static const QStringList redactedHeaders = {QStringLiteral("authorization"), QStringLiteral("proxy-authorization"),
+                                                QStringLiteral("cookie")};
+    TrafficCaptureRecord record;
+    record.timestamp = QDateTime::currentMSecsSinceEpoch();
+    record.peer = peer.toString();
+    record.method = method;
+    record.uri = uri;
+    record.body = body;
+    record.headers.reserve(headers.count());
+    for (const QString &header : headers) {
+        const QString name = header.section(':', 0, 0).trimmed();
+        record.headers << (redactedHeaders.contains(name.toLower()) ? QStringLiteral("%1: <redacted>").arg(name)
+                                                                      : header);
     }
-    delete socket;
-    threadPoolLock.lockForRead();
-    auto iter = std::find_if(threadPool.begin(), threadPool.end(),
-                             [worker](const WorkerThreadInfo &info) { return info.thread == worker; });
-    if (iter != threadPool.end())
-        --iter->socketCount;
-    threadPoolLock.unlock();
+
+    trafficCaptureLock.lockForRead();
+    if (trafficCapture)
+        trafficCapture->push(std::move(record));
+    trafficCaptureLock.unlock();
+}
+
+qint64 AbstractRestServerPrivate::peerThrottleTime(const QHostAddress &peer)
+{
+    if (peerRateLimit.requestsPerSecond <= 0.0 || peer.isNull())
+        return 0;
+    return peerRateLimiter.acquire(RateLimiter::key(peer), peerRateLimit.requestsPerSecond, peerRateLimit.burst);
+}
+
+qint64 AbstractRestServerPrivate::routeThrottleTime(const RestConnection &connection, const QString &methodName)
+{
+    auto limitIt = routeRateLimits.constFind(methodName);
+    if (limitIt == routeRateLimits.cend())
+        return 0;
+    quint64 peerKey = 0;
+    if (connection.m_peer.isNull()) {
+        // Local socket peers have no address, so each of their connections is limited separately
+        auto owner = reinterpret_cast<quintptr>(connection.m_owner.toStrongRef().data());
+        peerKey = RateLimiter::key(qMakePair(connection.m_slot, connection.m_generation), qHash(owner));
+    } else {
+        peerKey = RateLimiter::key(connection.m_peer);
+    }
+    return routeRateLimiter.acquire(RateLimiter::key(methodName) ^ peerKey, limitIt->requestsPerSecond,
+                                    limitIt->burst);
+}
+
+void AbstractRestServerPrivate::sendTooManyRequests(const RestConnection &connection, qint64 throttleTime)
+{
+    qCDebug(proofNetworkMiscLog) << "Request at" << connection << "is throttled for" << throttleTime << "msecs";
+    // Retry-After is measured in whole seconds
+    QHash<QString, QString> headers{{QStringLiteral("Retry-After"), QString::number((throttleTime + 999) / 1000)}};
+    sendAnswer(connection, "", QStringLiteral("text/plain; charset=utf-8"), headers, 429,
+               QStringLiteral("Too Many Requests"));
+}
+
+RestConnection AbstractRestServerPrivate::createConnection(const QWeakPointer<RestConnectionOwner> &owner,
+                                                           quint32 slot, quint32 generation, quint32 stream,
+                                                           const QHostAddress &peer,
+                                                           const QSharedPointer<RequestCancellation> &cancellation)
+{
+    return RestConnection(owner, slot, generation, stream, peer, cancellation);
 }
 
-WorkerThread::WorkerThread(Proof::AbstractRestServerPrivate *const _server_d) : serverD(_server_d)
+QSharedPointer<RequestCancellation> AbstractRestServerPrivate::cancellation(const RestConnection &connection)
+{
+    return connection.m_cancellation;
+}
+
+void AbstractRestServerPrivate::setFormDataParts(RestConnection &connection, const QVector<RestFormDataPart> &parts)
+{
+    connection.m_formDataParts = parts;
+}
+
+WorkerThread::WorkerThread(Proof::AbstractRestServerPrivate *const _server_d, quint64 cpuAffinity,
+                           const QSharedPointer<Proof::AccessLogBuffer> &accessLogBuffer)
+    : serverD(_server_d), m_serverThread(_server_d->serverThread), m_cpuAffinity(cpuAffinity),
+      m_accessLogBuffer(accessLogBuffer), m_lastActivityTime(QDateTime::currentMSecsSinceEpoch())
 {
     moveToThread(this);
 }
 
 WorkerThread::~WorkerThread()
-{}
+{
+    if (m_accessLogBuffer)
+        m_accessLogBuffer->close();
+}
 
-void WorkerThread::handleNewConnection(qintptr socketDescriptor)
+void WorkerThread::handleNewConnection(qintptr socketDescriptor, bool isLocal)
 {
-    if (Proof::ProofObject::call(this, &WorkerThread::handleNewConnection, socketDescriptor))
+    if (Proof::ProofObject::call(this, &WorkerThread::handleNewConnection, socketDescriptor, isLocal))
         return;
 
-    QTcpSocket *tcpSocket = new QTcpSocket();
-    serverD->registerSocket(tcpSocket);
-    SocketInfo info;
-    info.readyReadConnection = connect(tcpSocket, &QTcpSocket::readyRead, this,
-                                       [tcpSocket, this] { onReadyRead(tcpSocket); }, Qt::QueuedConnection);
-
-    void (QTcpSocket::*errorSignal)(QAbstractSocket::SocketError) = &QTcpSocket::error;
-    info.errorConnection = connect(tcpSocket, errorSignal, this,
-                                   [tcpSocket] {
-                                       qCWarning(proofNetworkMiscLog)
-                                           << "RestServer: socket error:" << tcpSocket->errorString();
-                                   },
-                                   Qt::QueuedConnection);
-
-    info.disconnectConnection = connect(tcpSocket, &QTcpSocket::disconnected, this,
-                                        [tcpSocket, this] { deleteSocket(tcpSocket); }, Qt::QueuedConnection);
-
-    if (!tcpSocket->setSocketDescriptor(socketDescriptor)) {
-        qCWarning(proofNetworkMiscLog) << "RestServer: can't create socket, error:" << tcpSocket->errorString();
-        serverD->deleteSocket(tcpSocket, this);
+    quint32 slot;
+    if (freeSlots.isEmpty()) {
+        slot = static_cast<quint32>(sockets.count());
+        sockets.append(SocketInfo());
+    } else {
+        slot = freeSlots.takeLast();
+    }
+
+    SocketInfo &info = sockets[slot];
+    const quint32 generation = info.generation;
+    auto onDisconnected = [slot, generation, this] {
+        if (isAlive(slot, generation))
+            deleteSocket(slot);
+    };
+
+    bool descriptorAccepted = false;
+    if (isLocal) {
+        QLocalSocket *localSocket = new QLocalSocket();
+        info.socket = localSocket;
+        info.errorConnection = connect(localSocket, QOverload<QLocalSocket::LocalSocketError>::of(&QLocalSocket::error),
+                                       this,
+                                       [localSocket] {
+                                           qCWarning(proofNetworkMiscLog)
+                                               << "RestServer: local socket error:" << localSocket->errorString();
+                                       },
+                                       Qt::QueuedConnection);
+        info.disconnectConnection = connect(localSocket, &QLocalSocket::disconnected, this, onDisconnected,
+                                            Qt::QueuedConnection);
+        descriptorAccepted = localSocket->setSocketDescriptor(socketDescriptor);
+    } else {
+        QSslSocket *sslSocket = serverD->sslEnabled ? new QSslSocket() : nullptr;
+        QTcpSocket *tcpSocket = sslSocket ? sslSocket : new QTcpSocket();
+        info.socket = tcpSocket;
+        void (QTcpSocket::*errorSignal)(QAbstractSocket::SocketError) = &QTcpSocket::error;
+        info.errorConnection = connect(tcpSocket, errorSignal, this,
+                                       [tcpSocket] {
+                                           qCWarning(proofNetworkMiscLog)
+                                               << "RestServer: socket error:" << tcpSocket->errorString();
+                                       },
+                                       Qt::QueuedConnection);
+        info.disconnectConnection = connect(tcpSocket, &QTcpSocket::disconnected, this, onDisconnected,
+                                            Qt::QueuedConnection);
+        if (sslSocket) {
+            sslSocket->setSslConfiguration(serverD->sslConfiguration);
+            connect(sslSocket, &QSslSocket::encrypted, this, [slot, generation, this] {
+                if (!isAlive(slot, generation))
+                    return;
+                QElapsedTimer &handshakeTimer = sockets[slot].handshakeTimer;
+                serverD->metrics.addTlsHandshake(handshakeTimer.nsecsElapsed() / 1000);
+                handshakeTimer.invalidate();
+            });
+        }
+        descriptorAccepted = tcpSocket->setSocketDescriptor(socketDescriptor);
+        if (descriptorAccepted && sslSocket) {
+            info.handshakeTimer.start();
+            sslSocket->startServerEncryption();
+        }
+    }
+
+    watchReadyRead(slot);
+
+    if (!descriptorAccepted) {
+        qCWarning(proofNetworkMiscLog) << "RestServer: can't create socket, error:" << info.socket->errorString();
+        deleteSocket(slot);
         return;
     }
-    sockets[tcpSocket] = info;
-    qCDebug(proofNetworkMiscLog) << "Handling socket descriptor" << socketDescriptor << "with socket" << tcpSocket;
+    qCDebug(proofNetworkMiscLog) << "Handling socket descriptor" << socketDescriptor << "with socket" << info.socket
+                                 << "at slot" << slot;
 }
 
-void WorkerThread::deleteSocket(QTcpSocket *socket)
+void WorkerThread::deleteSocket(quint32 slot)
 {
-    sockets.remove(socket);
-    serverD->deleteSocket(socket, this);
+    if (slot >= static_cast<quint32>(sockets.count()) || !sockets[slot].socket)
+        return;
+    SocketInfo &info = sockets[slot];
+    cancelRequests(info);
+    // Connection closed before TLS handshake was finished
+    if (info.handshakeTimer.isValid())
+        ++serverD->metrics.tlsHandshakeFailuresCount;
+    delete info.socket;
+    info.socket = nullptr;
+    info.parser = HttpParser();
+    info.http2.reset();
+    info.protocolDetected = false;
+    info.protocolDetectionData.clear();
+    info.keepAlive = false;
+    info.pipelinedData.clear();
+    info.requestNumber = 0;
+    info.answered = false;
+    info.handshakeTimer.invalidate();
+    info.idleTimer.invalidate();
+    info.accessLogEntry = AccessLogEntry();
+    info.streamAccessLogEntries.clear();
+    // Any handle given out for this slot becomes stale from now on
+    ++info.generation;
+    freeSlots.append(slot);
+    m_lastActivityTime = QDateTime::currentMSecsSinceEpoch();
+    --m_socketCount;
 }
 
-void WorkerThread::onReadyRead(QTcpSocket *socket)
+void WorkerThread::onReadyRead(quint32 slot)
 {
-    SocketInfo &info = sockets[socket];
-    HttpParser::Result result = info.parser.parseNextPart(socket->readAll());
+    SocketInfo &info = sockets[slot];
+    QByteArray data = info.pipelinedData + info.socket->readAll();
+    info.pipelinedData.clear();
+    if (data.isEmpty())
+        return;
+    if (!info.protocolDetected && serverD->http2Enabled) {
+        // Preface can come in several reads, so protocol is chosen only when it is complete or some byte mismatches
+        info.protocolDetectionData += data;
+        const QByteArray preface = Http2Session::connectionPreface();
+        if (info.protocolDetectionData.size() < preface.size() && preface.startsWith(info.protocolDetectionData))
+            return;
+        if (info.protocolDetectionData.startsWith(preface)) {
+            info.http2 = QSharedPointer<Http2Session>::create(
+                static_cast<quint32>(serverD->http2MaxConcurrentStreams));
+        }
+        data.clear();
+        data.swap(info.protocolDetectionData);
+    }
+    info.protocolDetected = true;
+    if (info.http2) {
+        onHttp2ReadyRead(slot, data);
+        return;
+    }
+    // Latency is measured from first received byte of request
+    if (m_accessLogBuffer && !info.accessLogEntry.timer.isValid()) {
+        info.accessLogEntry.timer.start();
+        info.accessLogEntry.time = QDateTime::currentMSecsSinceEpoch();
+    }
+
+    info.parser.setFormDataStreaming(serverD->formDataMaxPartSize, serverD->formDataInMemoryPartSize);
+    HttpParser::Result result = info.parser.parseNextPart(data);
     switch (result) {
-    case HttpParser::Result::Success:
+    case HttpParser::Result::Success: {
         disconnect(info.readyReadConnection);
-        serverD->tryToCallMethod(socket, info.parser.method(), info.parser.uri(), info.parser.headers(),
+        info.idleTimer.invalidate();
+        info.pipelinedData = info.parser.takeUnparsedData();
+        // Plain connections are closed after answer unless enabled explicitly, TLS ones are kept alive
+        // unless client asks otherwise. HTTP/1.0 clients must ask for persistent connection explicitly
+        const bool isTls = qobject_cast<QSslSocket *>(info.socket);
+        const bool clientKeepsAlive = info.parser.httpMinorVersion() > 0
+                                          ? !headerListsToken(info.parser.headers(), QLatin1String("Connection"),
+                                                              QLatin1String("close"))
+                                          : headerListsToken(info.parser.headers(), QLatin1String("Connection"),
+                                                             QLatin1String("keep-alive"));
+        info.keepAlive = (isTls || serverD->keepAliveEnabled) && clientKeepsAlive;
+        if (info.requestNumber && isTls)
+            ++serverD->metrics.tlsReusedConnectionRequestsCount;
+        // Local sockets have no peer address and are not limited per peer
+        auto tcpSocket = qobject_cast<QTcpSocket *>(info.socket);
+        const QHostAddress peer = tcpSocket ? tcpSocket->peerAddress() : QHostAddress();
+        serverD->captureRequest(peer, info.parser.method(), info.parser.uri(), info.parser.headers(),
+                                info.parser.body());
+        if (m_accessLogBuffer)
+            startAccessLogEntry(info.accessLogEntry, info.parser.method(), info.parser.uri(), info.parser.headers());
+        info.cancellation = QSharedPointer<RequestCancellation>::create();
+        auto connection = AbstractRestServerPrivate::createConnection(sharedFromThis(), slot, info.generation,
+                                                                      info.requestNumber, peer, info.cancellation);
+        AbstractRestServerPrivate::setFormDataParts(connection, info.parser.formDataParts());
+        qint64 throttleTime = serverD->peerThrottleTime(peer);
+        if (throttleTime) {
+            serverD->sendTooManyRequests(connection, throttleTime);
+            break;
+        }
+        serverD->tryToCallMethod(connection, peer, info.parser.method(), info.parser.uri(), info.parser.headers(),
                                  info.parser.body());
         break;
+    }
     case HttpParser::Result::Error:
         qCWarning(proofNetworkMiscLog) << "RestServer: parse error:" << info.parser.error();
+        if (m_accessLogBuffer)
+            startAccessLogEntry(info.accessLogEntry, info.parser.method(), info.parser.uri(), info.parser.headers());
         disconnect(info.readyReadConnection);
-        sendAnswer(socket, "", QStringLiteral("text/plain; charset=utf-8"), QHash<QString, QString>(), 400,
-                   QStringLiteral("Bad Request"));
+        info.keepAlive = false;
+        sendAnswer(slot, info.generation, info.requestNumber, "", QStringLiteral("text/plain; charset=utf-8"),
+                   QHash<QString, QString>(), 400, QStringLiteral("Bad Request"));
         break;
     case HttpParser::Result::NeedMore:
         break;
     }
 }
 
+void WorkerThread::onHttp2ReadyRead(quint32 slot, const QByteArray &data)
+{
+    QSharedPointer<Http2Session> session = sockets[slot].http2;
+    const quint32 generation = sockets[slot].generation;
+    if (!session->processIncoming(data))
+        qCWarning(proofNetworkMiscLog) << "RestServer: HTTP/2 connection error:" << session->error();
+    const auto requests = session->takeRequests();
+    const auto resetStreams = session->takeResetStreams();
+    flushHttp2(slot);
+
+    auto tcpSocket = qobject_cast<QTcpSocket *>(sockets[slot].socket);
+    const QHostAddress peer = tcpSocket ? tcpSocket->peerAddress() : QHostAddress();
+    for (const Http2Request &request : requests) {
+        // Rest method can answer synchronously and connection can be closed as a result
+        if (!isAlive(slot, generation))
+            return;
+        serverD->captureRequest(peer, request.method, request.path, request.headers, request.body);
+        if (m_accessLogBuffer) {
+            AccessLogEntry &entry = sockets[slot].streamAccessLogEntries[request.streamId];
+            entry.timer.start();
+            entry.time = QDateTime::currentMSecsSinceEpoch();
+            startAccessLogEntry(entry, request.method, request.path, request.headers);
+        }
+        auto cancellation = QSharedPointer<RequestCancellation>::create();
+        sockets[slot].streamCancellations[request.streamId] = cancellation;
+        auto connection = AbstractRestServerPrivate::createConnection(sharedFromThis(), slot, generation,
+                                                                      request.streamId, peer, cancellation);
+        qint64 throttleTime = serverD->peerThrottleTime(peer);
+        if (throttleTime) {
+            serverD->sendTooManyRequests(connection, throttleTime);
+            continue;
+        }
+        serverD->tryToCallMethod(connection, peer, request.method, request.path, request.headers, request.body);
+    }
+
+    // Requests from the same read are dispatched above, so reset of any of them is handled here too
+    for (quint32 streamId : resetStreams) {
+        if (!isAlive(slot, generation))
+            return;
+        if (auto cancellation = sockets[slot].streamCancellations.take(streamId)) {
+            if (cancellation->cancel())
+                ++serverD->metrics.canceledRequestsCount;
+        }
+        sockets[slot].streamAccessLogEntries.remove(streamId);
+    }
+}
+
+void WorkerThread::flushHttp2(quint32 slot)
+{
+    SocketInfo &info = sockets[slot];
+    const QByteArray outgoing = info.http2->takeOutgoing();
+    if (!outgoing.isEmpty())
+        info.socket->write(outgoing);
+    // Connection is closed only once, after GOAWAY or after last stream when client sent GOAWAY
+    if (info.http2->isFinished() && info.readyReadConnection) {
+        disconnect(info.readyReadConnection);
+        QIODevice *socket = info.socket;
+        if (!socket->bytesToWrite()) {
+            closeSocket(socket);
+            return;
+        }
+        connect(socket, &QIODevice::bytesWritten, this, [socket] {
+            if (socket->bytesToWrite() == 0)
+                closeSocket(socket);
+        });
+    }
+}
+
+QVector<QPair<QString, QString>> WorkerThread::responseHeaders(const QHash<QString, QString> &headers) const
+{
+    QVector<QPair<QString, QString>> result;
+    result.reserve(3 + serverD->customHeaders.count() + headers.count());
+    result << qMakePair(QStringLiteral("Proof-Application"), proofApp->prettifiedApplicationName());
+    result << qMakePair(QStringLiteral("Proof-%1-Version").arg(proofApp->prettifiedApplicationName()),
+                        qApp->applicationVersion());
+    result << qMakePair(QStringLiteral("Proof-%1-Framework-Version").arg(proofApp->prettifiedApplicationName()),
+                        Proof::proofVersion());
+    for (auto it = serverD->customHeaders.cbegin(); it != serverD->customHeaders.cend(); ++it)
+        result << qMakePair(it.key(), it.value());
+    for (auto it = headers.cbegin(); it != headers.cend(); ++it)
+        result << qMakePair(it.key(), it.value());
+    return result;
+}
+
 void WorkerThread::stop()
 {
     if (!ProofObject::call(this, &WorkerThread::stop, Proof::Call::Block)) {
-        const auto allKeys = sockets.keys();
-        for (QTcpSocket *socket : allKeys)
-            deleteSocket(socket);
+        for (quint32 slot = 0; slot < static_cast<quint32>(sockets.count()); ++slot)
+            deleteSocket(slot);
     }
 }
 
-void WorkerThread::sendAnswer(QTcpSocket *socket, const QByteArray &body, const QString &contentType,
-                              const QHash<QString, QString> &headers, int returnCode, const QString &reason)
+void WorkerThread::detachFromServer()
 {
-    if (Proof::ProofObject::call(this, &WorkerThread::sendAnswer, socket, body, contentType, headers, returnCode, reason)) {
+    m_serverThread = nullptr;
+}
+
+void WorkerThread::destroy(WorkerThread *worker)
+{
+    QThread *serverThread = worker->m_serverThread;
+    if (serverThread && QThread::currentThread() != serverThread) {
+        QMetaObject::invokeMethod(serverThread, [worker]() { destroy(worker); }, Qt::QueuedConnection);
         return;
     }
+    if (worker->isRunning()) {
+        worker->stop();
+        worker->quit();
+        worker->wait(1000);
+    }
+    delete worker;
+}
 
-    if (sockets.contains(socket) && socket->state() == QTcpSocket::ConnectedState) {
-        QStringList additionalHeadersList;
-        additionalHeadersList << QStringLiteral("Proof-Application: %1").arg(proofApp->prettifiedApplicationName());
-        additionalHeadersList << QStringLiteral("Proof-%1-Version: %2")
-                                     .arg(proofApp->prettifiedApplicationName(), qApp->applicationVersion());
-        additionalHeadersList << QStringLiteral("Proof-%1-Framework-Version: %2")
-                                     .arg(proofApp->prettifiedApplicationName(), Proof::proofVersion());
-        for (auto it = serverD->customHeaders.cbegin(); it != serverD->customHeaders.cend(); ++it)
-            additionalHeadersList << QStringLiteral("%1: %2").arg(it.key(), it.value());
-        for (auto it = headers.cbegin(); it != headers.cend(); ++it)
-            additionalHeadersList << QStringLiteral("%1: %2").arg(it.key(), it.value());
-        QString additionalHeaders = additionalHeadersList.join(QStringLiteral("\r\n")) + "\r\n";
-
-        //TODO: Add support for keep-alive
-        socket->write(QStringLiteral("HTTP/1.1 %1 %2\r\n"
-                                     "Server: proof\r\n"
-                                     "Connection: closed\r\n"
-                                     "Content-Type: %3\r\n"
-                                     "%4"
-                                     "%5"
-                                     "\r\n")
-                          .arg(QString::number(returnCode), reason, contentType,
-                               !body.isEmpty() ? QStringLiteral("Content-Length: %1\r\n").arg(body.size()) : QString(),
-                               additionalHeaders)
-                          .toUtf8());
-
-        socket->write(body);
-        connect(socket, &QTcpSocket::bytesWritten, this, [socket] {
-            if (socket->bytesToWrite() == 0)
-                socket->disconnectFromHost();
+bool WorkerThread::isAlive(quint32 slot, quint32 generation) const
+{
+    return slot < static_cast<quint32>(sockets.count()) && sockets[slot].socket
+           && sockets[slot].generation == generation;
+}
+
+void WorkerThread::cancelRequests(SocketInfo &info)
+{
+    if (info.cancellation && info.cancellation->cancel())
+        ++serverD->metrics.canceledRequestsCount;
+    for (const auto &cancellation : qAsConst(info.streamCancellations)) {
+        if (cancellation->cancel())
+            ++serverD->metrics.canceledRequestsCount;
+    }
+    info.cancellation.reset();
+    info.streamCancellations.clear();
+}
+
+void WorkerThread::watchReadyRead(quint32 slot)
+{
+    const quint32 generation = sockets[slot].generation;
+    sockets[slot].readyReadConnection = connect(sockets[slot].socket, &QIODevice::readyRead, this,
+                                                [slot, generation, this] {
+                                                    if (isAlive(slot, generation))
+                                                        onReadyRead(slot);
+                                                },
+                                                Qt::QueuedConnection);
+}
+
+void WorkerThread::waitForNextRequest(quint32 slot)
+{
+    SocketInfo &info = sockets[slot];
+    ++info.requestNumber;
+    info.answered = false;
+    info.parser = HttpParser();
+    info.keepAlive = false;
+    info.idleTimer.start();
+    watchReadyRead(slot);
+    // Next request could arrive together with previous one or while it was processed
+    if (!info.pipelinedData.isEmpty() || info.socket->bytesAvailable()) {
+        const quint32 generation = info.generation;
+        QTimer::singleShot(0, this, [slot, generation, this] {
+            if (isAlive(slot, generation))
+                onReadyRead(slot);
         });
     }
+
+    if (!keepAliveTimer) {
+        keepAliveTimer = new QTimer(this);
+        keepAliveTimer->setInterval(KEEP_ALIVE_CHECK_INTERVAL);
+        connect(keepAliveTimer, &QTimer::timeout, this, &WorkerThread::closeIdleSockets);
+        keepAliveTimer->start();
+    }
+}
+
+void WorkerThread::closeIdleSockets()
+{
+    for (SocketInfo &info : sockets) {
+        if (info.socket && info.idleTimer.isValid() && info.idleTimer.hasExpired(KEEP_ALIVE_TIMEOUT)) {
+            info.idleTimer.invalidate();
+            disconnect(info.readyReadConnection);
+            closeSocket(info.socket);
+        }
+    }
+}
+
+bool WorkerThread::isConnected(QIODevice *socket)
+{
+    if (auto tcpSocket = qobject_cast<QTcpSocket *>(socket))
+        return tcpSocket->state() == QTcpSocket::ConnectedState;
+    if (auto localSocket = qobject_cast<QLocalSocket *>(socket))
+        return localSocket->state() == QLocalSocket::ConnectedState;
+    return false;
+}
+
+void WorkerThread::closeSocket(QIODevice *socket)
+{
+    if (auto tcpSocket = qobject_cast<QTcpSocket *>(socket))
+        tcpSocket->disconnectFromHost();
+    else if (auto localSocket = qobject_cast<QLocalSocket *>(socket))
+        localSocket->disconnectFromServer();
+}
+
+long long WorkerThread::socketCount() const
+{
+    return m_socketCount;
+}
+
+void WorkerThread::increaseSocketCount()
+{
+    m_lastActivityTime = QDateTime::currentMSecsSinceEpoch();
+    ++m_socketCount;
+}
+
+quint64 WorkerThread::cpuAffinity() const
+{
+    return m_cpuAffinity;
+}
+
+qint64 WorkerThread::lastActivityTime() const
+{
+    return m_lastActivityTime;
+}
+
+void WorkerThread::run()
+{
+    if (m_cpuAffinity && !setCurrentThreadAffinity(m_cpuAffinity))
+        qCWarning(proofNetworkMiscLog) << "RestServer: can't pin worker to cpu mask"
+                                       << QStringLiteral("0x%1").arg(m_cpuAffinity, 0, 16);
+    exec();
+}
+
+void WorkerThread::sendAnswer(quint32 slot, quint32 generation, quint32 stream, const QByteArray &body,
+                              const QString &contentType, const QHash<QString, QString> &headers, int returnCode,
+                              const QString &reason)
+{
+    if (Proof::ProofObject::call(this, &WorkerThread::sendAnswer, slot, generation, stream, body, contentType, headers,
+                                 returnCode, reason)) {
+        return;
+    }
+
+    if (!isAlive(slot, generation)) {
+        qCDebug(proofNetworkMiscLog) << "Wanted to reply" << returnCode << ":" << reason << "at slot" << slot
+                                     << "but connection is dead already";
+        return;
+    }
+
+    QIODevice *socket = sockets[slot].socket;
+    if (!isConnected(socket))
+        return;
+
+    const auto allHeaders = responseHeaders(headers);
+    if (sockets[slot].http2) {
+        HpackHeaders http2Headers;
+        http2Headers.reserve(allHeaders.count() + 2);
+        http2Headers << qMakePair(QByteArrayLiteral("server"), QByteArrayLiteral("proof"));
+        http2Headers << qMakePair(QByteArrayLiteral("content-type"), contentType.toUtf8());
+        for (const auto &header : allHeaders)
+            http2Headers << qMakePair(header.first.toLower().toLatin1(), header.second.toUtf8());
+        if (auto cancellation = sockets[slot].streamCancellations.take(stream))
+            cancellation->finish();
+        if (m_accessLogBuffer)
+            writeAccessLogEntry(sockets[slot].streamAccessLogEntries.take(stream), socket, returnCode, body.size());
+        sockets[slot].http2->sendResponse(stream, returnCode, http2Headers, body);
+        flushHttp2(slot);
+        return;
+    }
+
+    // Each request gets exactly one answer, it could be given already by deadline
+    if (stream != sockets[slot].requestNumber || sockets[slot].answered) {
+        qCDebug(proofNetworkMiscLog) << "Wanted to reply" << returnCode << ":" << reason << "at slot" << slot
+                                     << "but request" << stream << "is answered already";
+        return;
+    }
+
+    QStringList additionalHeadersList;
+    for (const auto &header : allHeaders)
+        additionalHeadersList << QStringLiteral("%1: %2").arg(header.first, header.second);
+    QString additionalHeaders = additionalHeadersList.join(QStringLiteral("\r\n")) + "\r\n";
+
+    sockets[slot].answered = true;
+    if (m_accessLogBuffer) {
+        writeAccessLogEntry(sockets[slot].accessLogEntry, socket, returnCode, body.size());
+        sockets[slot].accessLogEntry = AccessLogEntry();
+    }
+    if (sockets[slot].cancellation) {
+        sockets[slot].cancellation->finish();
+        sockets[slot].cancellation.reset();
+    }
+
+    const bool keepAlive = sockets[slot].keepAlive;
+    socket->write(QStringLiteral("HTTP/1.1 %1 %2\r\n"
+                                 "Server: proof\r\n"
+                                 "Connection: %3\r\n"
+                                 "Content-Type: %4\r\n"
+                                 "%5"
+                                 "%6"
+                                 "\r\n")
+                      .arg(QString::number(returnCode), reason,
+                           keepAlive ? QStringLiteral("keep-alive") : QStringLiteral("closed"), contentType,
+                           !body.isEmpty() || keepAlive ? QStringLiteral("Content-Length: %1\r\n").arg(body.size())
+                                                        : QString(),
+                           additionalHeaders)
+                      .toUtf8());
+
+    socket->write(body);
+    if (keepAlive) {
+        waitForNextRequest(slot);
+        return;
+    }
+    connect(socket, &QIODevice::bytesWritten, this, [socket] {
+        if (socket->bytesToWrite() == 0)
+            closeSocket(socket);
+    });
+}
+
+void WorkerThread::startAccessLogEntry(AccessLogEntry &entry, const QString &method, const QString &uri,
+                                       const QStringList &headers)
+{
+    entry.method = method;
+    // Query is not logged, it can contain sensitive data
+    entry.path = uri.section('?', 0, 0);
+    for (const QString &header : headers) {
+        if (header.startsWith(QLatin1String("X-Request-Id:"), Qt::CaseInsensitive)) {
+            entry.requestId = header.section(':', 1).trimmed();
+            break;
+        }
+    }
+    if (entry.requestId.isEmpty())
+        entry.requestId = QStringLiteral("%1-%2").arg(serverD->requestIdPrefix).arg(++serverD->requestIdCounter);
+}
+
+void WorkerThread::writeAccessLogEntry(const AccessLogEntry &entry, QIODevice *socket, int returnCode, qint64 bytes)
+{
+    AccessLogRecord record;
+    record.time = entry.timer.isValid() ? entry.time : QDateTime::currentMSecsSinceEpoch();
+    auto tcpSocket = qobject_cast<QTcpSocket *>(socket);
+    record.peer = tcpSocket ? tcpSocket->peerAddress().toString() : QStringLiteral("local");
+    record.method = entry.method;
+    record.path = entry.path;
+    record.status = returnCode;
+    record.bytes = bytes;
+    record.latency = entry.timer.isValid() ? entry.timer.nsecsElapsed() / 1000 : 0;
+    record.requestId = entry.requestId;
+    m_accessLogBuffer->push(std::move(record));
+}
+
+void WorkerThread::startDeadline(quint32 slot, quint32 generation, quint32 stream, int msecs)
+{
+    if (Proof::ProofObject::call(this, &WorkerThread::startDeadline, slot, generation, stream, msecs))
+        return;
+
+    QTimer::singleShot(msecs, this, [this, slot, generation, stream] {
+        if (!isAlive(slot, generation))
+            return;
+        SocketInfo &info = sockets[slot];
+        QSharedPointer<RequestCancellation> cancellation = info.http2 ? info.streamCancellations.value(stream)
+                                                                      : info.cancellation;
+        if (!cancellation || (!info.http2 && info.requestNumber != stream))
+            return;
+        ++serverD->metrics.handlerTimeoutsCount;
+        qCWarning(proofNetworkMiscLog) << "RestServer: handler didn't answer in time at slot" << slot << "stream"
+                                       << stream;
+        // Work started for this request is not needed anymore
+        cancellation->cancel();
+        sendAnswer(slot, generation, stream, "", QStringLiteral("text/plain; charset=utf-8"), QHash<QString, QString>(),
+                   504, QStringLiteral("Gateway Timeout"));
+    });
+}
+
+RestConnection::RestConnection()
+{}
+
+RestConnection::RestConnection(const QWeakPointer<RestConnectionOwner> &owner, quint32 slot, quint32 generation,
+                               quint32 stream, const QHostAddress &peer,
+                               const QSharedPointer<RequestCancellation> &cancellation)
+    : m_owner(owner), m_slot(slot), m_generation(generation), m_stream(stream), m_peer(peer),
+      m_cancellation(cancellation)
+{}
+
+bool RestConnection::isValid() const
+{
+    return !m_owner.isNull();
+}
+
+QHostAddress RestConnection::peerAddress() const
+{
+    return m_peer;
+}
+
+bool RestConnection::isCanceled() const
+{
+    return m_cancellation && m_cancellation->isCanceled();
+}
+
+void RestConnection::addCancelCallback(std::function<void()> &&callback) const
+{
+    if (m_cancellation)
+        m_cancellation->addCallback(std::move(callback));
+}
+
+QVector<RestFormDataPart> RestConnection::formDataParts() const
+{
+    return m_formDataParts;
+}
+
+bool RestConnection::acceptsCbor() const
+{
+    return m_acceptsCbor;
+}
+
+bool RestConnection::hasCborBody() const
+{
+    return m_cborBody;
+}
+
+bool RestConnection::operator==(const RestConnection &other) const
+{
+    return m_owner == other.m_owner && m_slot == other.m_slot && m_generation == other.m_generation
+           && m_stream == other.m_stream;
+}
+
+bool RestConnection::operator!=(const RestConnection &other) const
+{
+    return !(*this == other);
+}
+
+QDebug Proof::operator<<(QDebug dbg, const RestConnection &connection)
+{
+    QDebugStateSaver saver(dbg);
+    dbg.nospace() << "RestConnection(" << connection.m_slot << ":" << connection.m_generation;
+    if (connection.m_stream)
+        dbg << ", stream " << connection.m_stream;
+    dbg << ")";
+    return dbg;
+}
+
+BatchRequest::BatchRequest(Proof::AbstractRestServerPrivate *const _serverD, const Proof::RestConnection &connection,
+                           const QVector<SubRequest> &requests, int maxConcurrentRequests)
+    : serverD(_serverD), connection(connection), requests(requests), responses(requests.count()),
+      maxConcurrentRequests(maxConcurrentRequests)
+{}
+
+void BatchRequest::start(const QSharedPointer<BatchRequest> &self)
+{
+    // Keeps itself alive until all sub-requests are answered or batch itself is canceled by deadline or disconnect
+    this->self = self;
+    QWeakPointer<BatchRequest> weakSelf = self;
+    connection.addCancelCallback([weakSelf]() {
+        auto batch = weakSelf.toStrongRef();
+        if (batch)
+            batch->abandon();
+    });
+    dispatch();
+}
+
+void BatchRequest::sendAnswer(quint32 slot, quint32 generation, quint32 stream, const QByteArray &body,
+                              const QString &contentType, const QHash<QString, QString> &headers, int returnCode,
+                              const QString &reason)
+{
+    if (Proof::ProofObject::call(this, &BatchRequest::sendAnswer, slot, generation, stream, body, contentType, headers,
+                                 returnCode, reason)) {
+        return;
+    }
+
+    if (slot >= static_cast<quint32>(responses.count()) || responses[slot].answered) {
+        qCDebug(proofNetworkMiscLog) << "Wanted to reply" << returnCode << ":" << reason << "to batch sub-request"
+                                     << slot << "but it is answered already";
+        return;
+    }
+
+    SubResponse &response = responses[slot];
+    response.answered = true;
+    response.returnCode = returnCode;
+    response.reason = reason;
+    response.contentType = contentType;
+    response.headers = headers;
+    response.body = body;
+    --inFlightCount;
+    ++answeredCount;
+    dispatch();
+}
+
+void BatchRequest::startDeadline(quint32 slot, quint32 generation, quint32 stream, int msecs)
+{
+    if (Proof::ProofObject::call(this, &BatchRequest::startDeadline, slot, generation, stream, msecs))
+        return;
+
+    // Sub-requests share cancellation with batch, so only the answer is substituted here
+    QTimer::singleShot(msecs, this, [this, slot, generation, stream] {
+        if (!self || slot >= static_cast<quint32>(responses.count()) || responses[slot].answered)
+            return;
+        ++serverD->metrics.handlerTimeoutsCount;
+        qCWarning(proofNetworkMiscLog) << "RestServer: handler didn't answer in time to batch sub-request" << slot;
+        sendAnswer(slot, generation, stream, "", QStringLiteral("text/plain; charset=utf-8"), QHash<QString, QString>(),
+                   504, QStringLiteral("Gateway Timeout"));
+    });
+}
+
+void BatchRequest::dispatch()
+{
+    // Synchronous answers come back here through sendAnswer while loop below is still running
+    if (dispatching || !self)
+        return;
+    dispatching = true;
+    while (inFlightCount < maxConcurrentRequests && nextRequest < requests.count()) {
+        const quint32 index = static_cast<quint32>(nextRequest++);
+        const SubRequest &request = requests[index];
+        ++inFlightCount;
+        // Sub-requests are canceled together with batch itself
+        auto subConnection = Proof::AbstractRestServerPrivate::createConnection(
+            self, index, 0, 0, connection.peerAddress(), Proof::AbstractRestServerPrivate::cancellation(connection));
+
+        QStringList methodVariableParts;
+        MethodNode *methodNode = serverD->findMethod(
+            serverD->makeMethodName(request.method, request.path.section('?', 0, 0)), methodVariableParts);
+        if (methodNode && QString(*methodNode) == serverD->batchMethodName) {
+            serverD->sendAnswer(subConnection, "", QStringLiteral("text/plain; charset=utf-8"),
+                                QHash<QString, QString>(), 400, QStringLiteral("Nested batches are not allowed"));
+            continue;
+        }
+        qint64 throttleTime = serverD->peerThrottleTime(connection.peerAddress());
+        if (throttleTime) {
+            serverD->sendTooManyRequests(subConnection, throttleTime);
+            continue;
+        }
+        serverD->tryToCallMethod(subConnection, connection.peerAddress(), request.method, request.path,
+                                 request.headers, request.body);
+    }
+    dispatching = false;
+    if (answeredCount == requests.count())
+        finish();
+}
+
+void BatchRequest::finish()
+{
+    QJsonArray result;
+    for (const SubResponse &response : qAsConst(responses)) {
+        QJsonObject headersObject;
+        for (auto it = response.headers.cbegin(); it != response.headers.cend(); ++it)
+            headersObject.insert(it.key(), it.value());
+        QJsonObject responseObject{{QStringLiteral("status"), response.returnCode},
+                                   {QStringLiteral("reason"), response.reason},
+                                   {QStringLiteral("content_type"), response.contentType},
+                                   {QStringLiteral("headers"), headersObject}};
+        if (!isTextBody(response.contentType, response.body)) {
+            responseObject.insert(QStringLiteral("body"), QString::fromLatin1(response.body.toBase64()));
+            responseObject.insert(QStringLiteral("body_encoding"), QStringLiteral("base64"));
+        } else if (response.contentType.contains(QLatin1String("json"))) {
+            QJsonDocument bodyDoc = QJsonDocument::fromJson(response.body);
+            if (bodyDoc.isObject())
+                responseObject.insert(QStringLiteral("body"), bodyDoc.object());
+            else if (bodyDoc.isArray())
+                responseObject.insert(QStringLiteral("body"), bodyDoc.array());
+            else
+                responseObject.insert(QStringLiteral("body"), QString::fromUtf8(response.body));
+        } else {
+            responseObject.insert(QStringLiteral("body"), QString::fromUtf8(response.body));
+        }
+        result.append(responseObject);
+    }
+    serverD->sendJsonAnswer(connection, QJsonDocument(result));
+    self.clear();
+}
+
+void BatchRequest::abandon()
+{
+    if (Proof::ProofObject::call(this, &BatchRequest::abandon))
+        return;
+    // Batch connection is answered or closed already, late sub-responses are just dropped
+    self.clear();
+}
+
+bool BatchRequest::isTextBody(const QString &contentType, const QByteArray &body)
+{
+    const QString mediaType = contentType.section(';', 0, 0).trimmed().toLower();
+    const bool textType = mediaType.isEmpty() || mediaType.startsWith(QLatin1String("text/"))
+                          || mediaType.contains(QLatin1String("json")) || mediaType.contains(QLatin1String("xml"))
+                          || mediaType.contains(QLatin1String("javascript"))
+                          || mediaType == QLatin1String("application/x-www-form-urlencoded");
+    if (!textType)
+        return false;
+    QTextCodec::ConverterState state;
+    QTextCodec::codecForName("UTF-8")->toUnicode(body.constData(), body.size(), &state);
+    return !state.invalidChars && !state.remainingChars;
+}
+
+void ServerMetrics::addTlsHandshake(qint64 usecs)
+{
+    ++tlsHandshakesCount;
+    tlsHandshakesTotalTime += usecs;
+    qint64 maxTime = tlsHandshakeMaxTime;
+    while (usecs > maxTime && !tlsHandshakeMaxTime.compare_exchange_weak(maxTime, usecs)) {
+    }
+}
+
+LocalServer::LocalServer(Proof::AbstractRestServerPrivate *const _serverD, QObject *parent)
+    : QLocalServer(parent), serverD(_serverD)
+{}
+
+void LocalServer::incomingConnection(quintptr socketDescriptor)
+{
+    qCDebug(proofNetworkMiscLog) << "Incoming local connection with socket descriptor" << socketDescriptor;
+    serverD->dispatchConnection(static_cast<qintptr>(socketDescriptor), true);
 }
 
 MethodNode::MethodNode()
@@ -0,0 +1,168 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "proofnetwork/accesslog_p.h"
+
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+
+static constexpr int BUFFER_CAPACITY = 8192;
+static constexpr int DRAIN_INTERVAL = 200;
+
+using namespace Proof;
+
+AccessLogBuffer::AccessLogBuffer(int capacity)
+{
+    quint64 size = 1;
+    while (size < static_cast<quint64>(qMax(1, capacity)))
+        size <<= 1;
+    m_records.resize(size);
+    m_mask = size - 1;
+}
+
+bool AccessLogBuffer::push(AccessLogRecord &&record)
+{
+    const quint64 tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) >= m_records.size()) {
+        ++m_droppedCount;
+        return false;
+    }
+    m_records[tail & m_mask] = std::move(record);
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool AccessLogBuffer::pop(AccessLogRecord &record)
+{
+    const quint64 head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire))
+        return false;
+    record = std::move(m_records[head & m_mask]);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+void AccessLogBuffer::close()
+{
+    m_closed = true;
+}
+
+bool AccessLogBuffer::isClosed() const
+{
+    return m_closed;
+}
+
+qint64 AccessLogBuffer::droppedCount() const
+{
+    return m_droppedCount;
+}
+
+AccessLogWriter::AccessLogWriter(const QString &filePath) : m_file(filePath)
+{}
+
+AccessLogWriter::~AccessLogWriter()
+{
+    stop();
+}
+
+bool AccessLogWriter::open()
+{
+    return m_file.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+QString AccessLogWriter::errorString() const
+{
+    return m_file.errorString();
+}
+
+QSharedPointer<AccessLogBuffer> AccessLogWriter::createBuffer()
+{
+    auto buffer = QSharedPointer<AccessLogBuffer>::create(BUFFER_CAPACITY);
+    QMutexLocker locker(&m_buffersMutex);
+    m_buffers << buffer;
+    return buffer;
+}
+
+void AccessLogWriter::stop()
+{
+    m_stopRequested = true;
+    if (isRunning())
+        wait();
+}
+
+qint64 AccessLogWriter::droppedCount() const
+{
+    QMutexLocker locker(&m_buffersMutex);
+    qint64 result = m_closedBuffersDroppedCount;
+    for (const auto &buffer : m_buffers)
+        result += buffer->droppedCount();
+    return result;
+}
+
+void AccessLogWriter::run()
+{
+    while (!m_stopRequested) {
+        drain();
+        msleep(DRAIN_INTERVAL);
+    }
+    drain();
+}
+
+void AccessLogWriter::drain()
+{
+    m_buffersMutex.lock();
+    const auto buffers = m_buffers;
+    m_buffersMutex.unlock();
+
+    QByteArray batch;
+    AccessLogRecord record;
+    for (const auto &buffer : buffers) {
+        // Closed flag is checked before draining, so nothing can be pushed after last pop
+        const bool closed = buffer->isClosed();
+        while (buffer->pop(record)) {
+            QJsonObject line{{QStringLiteral("time"),
+                              QDateTime::fromMSecsSinceEpoch(record.time, Qt::UTC).toString(Qt::ISODateWithMs)},
+                             {QStringLiteral("peer"), record.peer},
+                             {QStringLiteral("method"), record.method},
+                             {QStringLiteral("path"), record.path},
+                             {QStringLiteral("status"), record.status},
+                             {QStringLiteral("bytes"), record.bytes},
+                             {QStringLiteral("latency_us"), record.latency},
+                             {QStringLiteral("request_id"), record.requestId}};
+            batch += QJsonDocument(line).toJson(QJsonDocument::Compact);
+            batch += '\n';
+        }
+        if (closed) {
+            QMutexLocker locker(&m_buffersMutex);
+            m_closedBuffersDroppedCount += buffer->droppedCount();
+            m_buffers.removeOne(buffer);
+        }
+    }
+    if (!batch.isEmpty()) {
+        m_file.write(batch);
+        m_file.flush();
+    }
+}
@@ -27,16 +27,112 @@
 #include "proofseed/tasks.h"
 
 #include "proofnetwork/baserestapi_p.h"
+#include "proofnetwork/requestcancellation_p.h"
 
+#include <QCryptographicHash>
 #include <QHostAddress>
 #include <QNetworkInterface>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QPointer>
 #include <QProcess>
+#include <QRandomGenerator>
+#include <QTimer>
+
+#include <cmath>
 
 static const int NETWORK_SSL_ERROR_OFFSET = 1500;
 static const int NETWORK_ERROR_OFFSET = 1000;
 static const QString PING_ADDRESS = QStringLiteral("8.8.8.8");
 
 static const QSet<int> ALLOWED_HTTP_STATUSES = {200, 201, 202, 203, 204, 205, 206};
+static const QSet<int> RETRIABLE_HTTP_STATUSES = {429, 502, 503, 504};
+static constexpr qint64 RETRY_BUDGET_WINDOW = 10000;
+
+namespace Proof {
+class RetryBudget
+{
+public:
+    RetryBudget() { clock.start(); }
+
+    static RetryBudget *instance()
+    {
+        static RetryBudget i;
+        return &i;
+    }
+
+    void countRequest(const QString &host)
+    {
+        lock.lock();
+        ++hostBudget(host).requests;
+        lock.unlock();
+    }
+
+    bool withdrawRetry(const QString &host, double ratio, int minRetries)
+    {
+        lock.lock();
+        HostBudget &budget = hostBudget(host);
+        bool result = budget.retries < minRetries + budget.requests * ratio;
+        if (result)
+            ++budget.retries;
+        lock.unlock();
+        return result;
+    }
+
+private:
+    struct HostBudget
+    {
+        qint64 windowStart = 0;
+        qint64 requests = 0;
+        qint64 retries = 0;
+    };
+
+    HostBudget &hostBudget(const QString &host)
+    {
+        HostBudget &budget = hosts[host];
+        qint64 now = clock.elapsed();
+        if (now - budget.windowStart >= RETRY_BUDGET_WINDOW) {
+            budget.windowStart = now;
+            budget.requests = 0;
+            budget.retries = 0;
+        }
+        return budget;
+    }
+
+    QHash<QString, HostBudget> hosts;
+    SpinLock lock;
+    QElapsedTimer clock;
+};
+} // namespace Proof
+
+static bool isTransientNetworkError(QNetworkReply::NetworkError error)
+{
+    switch (error) {
+    case QNetworkReply::ConnectionRefusedError:
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::ProxyConnectionClosedError:
+    case QNetworkReply::ProxyTimeoutError:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static qint64 retryAfterMsecs(QNetworkReply *reply)
+{
+    const QByteArray value = reply->rawHeader("Retry-After").trimmed();
+    if (value.isEmpty())
+        return 0;
+    bool ok = false;
+    qint64 seconds = value.toLongLong(&ok);
+    if (ok)
+        return qMax(qint64(0), seconds) * 1000;
+    QDateTime date = QDateTime::fromString(QString::fromLatin1(value), Qt::RFC2822Date);
+    return date.isValid() ? qMax(qint64(0), QDateTime::currentDateTimeUtc().msecsTo(date)) : 0;
+}
 
 using namespace Proof;
 
@@ -94,40 +190,82 @@ void BaseRestApi::abortAllRequests()
         reply.cancel();
 }
 
-CancelableFuture<RestApiReply> BaseRestApi::get(const QString &method, const QUrlQuery &query)
+bool BaseRestApi::requestCoalescingEnabled() const
+{
+    Q_D_CONST(BaseRestApi);
+    return d->requestCoalescingEnabled;
+}
+
+void BaseRestApi::setRequestCoalescingEnabled(bool enabled)
+{
+    Q_D(BaseRestApi);
+    d->requestCoalescingEnabled = enabled;
+}
+
+RestRetryPolicy BaseRestApi::retryPolicy() const
+{
+    Q_D_CONST(BaseRestApi);
+    return d->retryPolicy;
+}
+
+void BaseRestApi::setRetryPolicy(const RestRetryPolicy &policy)
 {
     Q_D(BaseRestApi);
-    return d->configureReply(d->restClient->get(method, query, vendor()));
+    d->retryPolicy = policy;
 }
 
-CancelableFuture<RestApiReply> BaseRestApi::post(const QString &method, const QUrlQuery &query, const QByteArray &body)
+CancelableFuture<RestApiReply> BaseRestApi::get(const QString &method, const QUrlQuery &query,
+                                                RestRequestPriority priority)
 {
     Q_D(BaseRestApi);
-    return d->configureReply(d->restClient->post(method, query, body, vendor()));
+    if (d->requestCoalescingEnabled)
+        return d->coalescedGet(method, query, priority);
+    return d->configureRetriableReply([d, method, query, vendor = vendor(), priority]() {
+        return d->restClient->get(method, query, vendor, priority);
+    }, true);
 }
 
-CancelableFuture<RestApiReply> BaseRestApi::post(const QString &method, const QUrlQuery &query, QHttpMultiPart *multiParts)
+CancelableFuture<RestApiReply> BaseRestApi::post(const QString &method, const QUrlQuery &query,
+                                                 const RestRequestBody &body, RestRequestPriority priority)
 {
     Q_D(BaseRestApi);
-    return d->configureReply(d->restClient->post(method, query, multiParts));
+    return d->configureRetriableReply([d, method, query, body, vendor = vendor(), priority]() {
+        return d->restClient->post(method, query, body, vendor, priority);
+    }, false);
 }
 
-CancelableFuture<RestApiReply> BaseRestApi::put(const QString &method, const QUrlQuery &query, const QByteArray &body)
+CancelableFuture<RestApiReply> BaseRestApi::post(const QString &method, const QUrlQuery &query,
+                                                 QHttpMultiPart *multiParts, RestRequestPriority priority)
 {
     Q_D(BaseRestApi);
-    return d->configureReply(d->restClient->put(method, query, body, vendor()));
+    return d->configureReply(d->restClient->post(method, query, multiParts, priority));
 }
 
-CancelableFuture<RestApiReply> BaseRestApi::patch(const QString &method, const QUrlQuery &query, const QByteArray &body)
+CancelableFuture<RestApiReply> BaseRestApi::put(const QString &method, const QUrlQuery &query,
+                                                const RestRequestBody &body, RestRequestPriority priority)
 {
     Q_D(BaseRestApi);
-    return d->configureReply(d->restClient->patch(method, query, body, vendor()));
+    return d->configureRetriableReply([d, method, query, body, vendor = vendor(), priority]() {
+        return d->restClient->put(method, query, body, vendor, priority);
+    }, true);
 }
 
-CancelableFuture<RestApiReply> BaseRestApi::deleteResource(const QString &method, const QUrlQuery &query)
+CancelableFuture<RestApiReply> BaseRestApi::patch(const QString &method, const QUrlQuery &query,
+                                                  const RestRequestBody &body, RestRequestPriority priority)
 {
     Q_D(BaseRestApi);
-    return d->configureReply(d->restClient->deleteResource(method, query, vendor()));
+    return d->configureRetriableReply([d, method, query, body, vendor = vendor(), priority]() {
+        return d->restClient->patch(method, query, body, vendor, priority);
+    }, false);
+}
+
+CancelableFuture<RestApiReply> BaseRestApi::deleteResource(const QString &method, const QUrlQuery &query,
+                                                           RestRequestPriority priority)
+{
+    Q_D(BaseRestApi);
+    return d->configureRetriableReply([d, method, query, vendor = vendor(), priority]() {
+        return d->restClient->deleteResource(method, query, vendor, priority);
+    }, true);
 }
 
 void BaseRestApi::processSuccessfulReply(QNetworkReply *reply, const PromiseSP<RestApiReply> &promise)
@@ -213,24 +351,57 @@ QString BaseRestApi::vendor() const
 
 CancelableFuture<RestApiReply> BaseRestApiPrivate::configureReply(CancelableFuture<QNetworkReply *> replyFuture)
 {
-    Q_Q(BaseRestApi);
     auto promise = PromiseSP<RestApiReply>::create();
+    handleReplyFuture(replyFuture, promise, QSharedPointer<RetryState>());
+    auto result = CancelableFuture<RestApiReply>(promise);
+    rememberReply(result);
+    return result;
+}
+
+CancelableFuture<RestApiReply>
+BaseRestApiPrivate::configureRetriableReply(const std::function<CancelableFuture<QNetworkReply *>()> &send,
+                                            bool idempotent)
+{
+    QSharedPointer<RetryState> retryState;
+    if (retryPolicy.maxRetries > 0) {
+        RetryBudget::instance()->countRequest(restClient->host());
+        if (idempotent || retryPolicy.retryNonIdempotent) {
+            retryState = QSharedPointer<RetryState>::create();
+            retryState->send = send;
+            retryState->policy = retryPolicy;
+            retryState->host = restClient->host();
+        }
+    }
+    auto promise = PromiseSP<RestApiReply>::create();
+    handleReplyFuture(send(), promise, retryState);
+    auto result = CancelableFuture<RestApiReply>(promise);
+    rememberReply(result);
+    return result;
+}
+
+void BaseRestApiPrivate::handleReplyFuture(const CancelableFuture<QNetworkReply *> &replyFuture,
+                                           const PromiseSP<RestApiReply> &promise,
+                                           const QSharedPointer<RetryState> &retryState)
+{
+    Q_Q(BaseRestApi);
     promise->future()->onFailure([replyFuture](const Failure &) { replyFuture.cancel(); });
 
-    replyFuture->onSuccess([this, q, promise](QNetworkReply *reply) {
+    replyFuture->onSuccess([this, q, promise, retryState](QNetworkReply *reply) {
         if (promise->filled()) {
             reply->abort();
             reply->deleteLater();
             return;
         }
 
-        promise->future()->onFailure([reply](const Failure &) {
-            if (reply->isRunning())
-                reply->abort();
+        // Reply is already deleted if promise is canceled while request waits for retry
+        QPointer<QNetworkReply> replyPointer(reply);
+        promise->future()->onFailure([replyPointer](const Failure &) {
+            if (replyPointer && replyPointer->isRunning())
+                replyPointer->abort();
         });
 
         if (reply->isFinished()) {
-            if (!promise->filled()) {
+            if (!promise->filled() && !retryIfNeeded(reply, promise, retryState)) {
                 if (replyShouldBeHandledByError(reply))
                     q->processErroredReply(reply, promise);
                 else
@@ -238,18 +409,20 @@ CancelableFuture<RestApiReply> BaseRestApiPrivate::configureReply(CancelableFutu
             }
             reply->deleteLater();
         } else {
-            QObject::connect(reply, &QNetworkReply::finished, q, [this, q, promise, reply]() {
+            QObject::connect(reply, &QNetworkReply::finished, q, [this, q, promise, retryState, reply]() {
                 if (promise->filled() || replyShouldBeHandledByError(reply))
                     return;
-                q->processSuccessfulReply(reply, promise);
+                if (!retryIfNeeded(reply, promise, retryState))
+                    q->processSuccessfulReply(reply, promise);
                 reply->deleteLater();
             });
 
             QObject::connect(reply, QOverload<QNetworkReply::NetworkError>::of(&QNetworkReply::error), q,
-                             [this, q, promise, reply](QNetworkReply::NetworkError) {
+                             [this, q, promise, retryState, reply](QNetworkReply::NetworkError) {
                                  if (promise->filled() || !replyShouldBeHandledByError(reply))
                                      return;
-                                 q->processErroredReply(reply, promise);
+                                 if (!retryIfNeeded(reply, promise, retryState))
+                                     q->processErroredReply(reply, promise);
                                  reply->deleteLater();
                              });
 
@@ -271,10 +444,56 @@ CancelableFuture<RestApiReply> BaseRestApiPrivate::configureReply(CancelableFutu
             });
         }
     });
+}
 
-    auto result = CancelableFuture<RestApiReply>(promise);
-    rememberReply(result);
-    return result;
+bool BaseRestApiPrivate::retryIfNeeded(QNetworkReply *reply, const PromiseSP<RestApiReply> &promise,
+                                       const QSharedPointer<RetryState> &retryState)
+{
+    Q_Q(BaseRestApi);
+    qint64 delay = retryDelay(reply, retryState);
+    if (delay < 0)
+        return false;
+    qCDebug(proofNetworkMiscLog) << "Retry" << retryState->retries << "of" << retryState->policy.maxRetries << "for"
+                                 << reply->request().url().toDisplayString(QUrl::FormattingOptions(QUrl::FullyDecoded))
+                                 << "in" << delay << "ms";
+    // Reply handlers can be called in network thread, timer is started in api thread
+    QTimer::singleShot(0, q, [this, q, promise, retryState, delay]() {
+        QTimer::singleShot(delay, q, [this, promise, retryState]() {
+            if (!promise->filled())
+                handleReplyFuture(retryState->send(), promise, retryState);
+        });
+    });
+    return true;
+}
+
+qint64 BaseRestApiPrivate::retryDelay(QNetworkReply *reply, const QSharedPointer<RetryState> &retryState) const
+{
+    if (!retryState || retryState->retries >= retryState->policy.maxRetries)
+        return -1;
+    int httpStatus = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    // Aborted replies are retried only if RestClient gave up waiting, not if request was canceled
+    if (!isTransientNetworkError(reply->error()) && !RestClient::replyTimedOut(reply)
+        && !RETRIABLE_HTTP_STATUSES.contains(httpStatus))
+        return -1;
+
+    const RestRetryPolicy &policy = retryState->policy;
+    qint64 retryAfter = retryAfterMsecs(reply);
+    if (retryAfter > policy.maxBackoffMsecs) {
+        qCDebug(proofNetworkMiscLog) << "Not retrying request to" << retryState->host << "because of Retry-After"
+                                     << retryAfter << "ms";
+        return -1;
+    }
+    double backoff = policy.initialBackoffMsecs * std::pow(policy.backoffMultiplier, retryState->retries);
+    qint64 delay = static_cast<qint64>(qMin(backoff, static_cast<double>(policy.maxBackoffMsecs)));
+    delay = delay / 2 + static_cast<qint64>(QRandomGenerator::global()->bounded(delay / 2.0));
+    delay = qMax(delay, retryAfter);
+
+    if (!RetryBudget::instance()->withdrawRetry(retryState->host, policy.budgetRatio, policy.minRetriesPerWindow)) {
+        qCWarning(proofNetworkMiscLog) << "Retry budget for" << retryState->host << "is exhausted";
+        return -1;
+    }
+    ++retryState->retries;
+    return delay;
 }
 
 bool BaseRestApiPrivate::replyShouldBeHandledByError(QNetworkReply *reply) const
@@ -358,6 +577,105 @@ void BaseRestApiPrivate::rememberReply(const CancelableFuture<RestApiReply> &rep
     reply->onSuccess([cleaner](const RestApiReply &) { cleaner(); })->onFailure([cleaner](const Failure &) { cleaner(); });
 }
 
+CancelableFuture<RestApiReply> BaseRestApiPrivate::coalescedGet(const QString &method, const QUrlQuery &query,
+                                                                RestRequestPriority priority)
+{
+    Q_Q(BaseRestApi);
+    const QByteArray key = coalescingKey(method, query);
+    inFlightRequestsLock.lock();
+    QSharedPointer<InFlightRequest> flight = inFlightRequests.value(key);
+    const bool isNewFlight = flight.isNull();
+    if (isNewFlight) {
+        flight = QSharedPointer<InFlightRequest>::create();
+        inFlightRequests.insert(key, flight);
+    }
+    ++flight->waiters;
+    inFlightRequestsLock.unlock();
+
+    if (isNewFlight) {
+        // Network request is shared by all waiters, so it must not be dropped together with rest method
+        // of the first one, each waiter is canceled on its own below
+        RequestCancellation::Scope detachedScope(nullptr);
+        auto upstream = configureRetriableReply([this, method, query, vendor = q->vendor(), priority]() {
+            return restClient->get(method, query, vendor, priority);
+        }, true);
+        upstream->onSuccess([this, key, flight](const RestApiReply &reply) {
+            forgetInFlightRequest(key, flight);
+            flight->promise->success(reply);
+        });
+        upstream->onFailure([this, key, flight](const Failure &f) {
+            forgetInFlightRequest(key, flight);
+            flight->promise->failure(f);
+        });
+        inFlightRequestsLock.lock();
+        flight->cancelUpstream = [upstream]() { upstream.cancel(); };
+        const bool abandoned = !flight->waiters;
+        inFlightRequestsLock.unlock();
+        if (abandoned)
+            upstream.cancel();
+    } else {
+        qCDebug(proofNetworkMiscLog) << "GET request" << method << "is coalesced with the one already in flight";
+    }
+
+    auto promise = PromiseSP<RestApiReply>::create();
+    flight->promise->future()->onSuccess([promise](const RestApiReply &reply) {
+        if (!promise->filled())
+            promise->success(reply);
+    });
+    flight->promise->future()->onFailure([promise](const Failure &f) {
+        if (!promise->filled())
+            promise->failure(f);
+    });
+    promise->future()->onFailure([this, key, flight](const Failure &) { releaseInFlightRequest(key, flight); });
+
+    auto result = CancelableFuture<RestApiReply>(promise);
+    rememberReply(result);
+    auto cancellation = RequestCancellation::current();
+    if (cancellation)
+        cancellation->addCallback([result]() { result.cancel(); });
+    return result;
+}
+
+QByteArray BaseRestApiPrivate::coalescingKey(const QString &method, const QUrlQuery &query) const
+{
+    Q_Q_CONST(BaseRestApi);
+    // Credentials are hashed to not keep them in plain text as long as request is in flight
+    QCryptographicHash credentials(QCryptographicHash::Sha1);
+    credentials.addData(QByteArray::number(static_cast<int>(restClient->authType())));
+    credentials.addData(restClient->userName().toUtf8() + '\n');
+    credentials.addData(restClient->password().toUtf8() + '\n');
+    credentials.addData(restClient->token().toUtf8());
+    return QStringList{restClient->scheme(), restClient->host(), QString::number(restClient->port()),
+                       restClient->localSocketPath(), restClient->postfix(), q->vendor(), method,
+                       query.toString(QUrl::FullyEncoded)}
+               .join('\n')
+               .toUtf8()
+           + '\n' + credentials.result().toHex();
+}
+
+void BaseRestApiPrivate::forgetInFlightRequest(const QByteArray &key, const QSharedPointer<InFlightRequest> &flight)
+{
+    inFlightRequestsLock.lock();
+    if (inFlightRequests.value(key) == flight)
+        inFlightRequests.remove(key);
+    inFlightRequestsLock.unlock();
+}
+
+void BaseRestApiPrivate::releaseInFlightRequest(const QByteArray &key, const QSharedPointer<InFlightRequest> &flight)
+{
+    inFlightRequestsLock.lock();
+    const bool lastWaiter = !--flight->waiters;
+    std::function<void()> cancelUpstream;
+    if (lastWaiter) {
+        if (inFlightRequests.value(key) == flight)
+            inFlightRequests.remove(key);
+        cancelUpstream = flight->cancelUpstream;
+    }
+    inFlightRequestsLock.unlock();
+    if (cancelUpstream)
+        cancelUpstream();
+}
+
 RestApiReply::RestApiReply(const QByteArray &data, const QHash<QByteArray, QByteArray> &headers,
                            const QByteArray &httpReason, int httpStatus)
     : data(data), headers(headers), httpReason(httpReason), httpStatus(httpStatus)
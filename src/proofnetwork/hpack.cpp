@@ -0,0 +1,479 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "proofnetwork/hpack_p.h"
+
+#include <QHash>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace {
+constexpr int STATIC_TABLE_SIZE = 61;
+constexpr int MAX_HUFFMAN_CODE_LENGTH = 30;
+constexpr quint32 EOS_SYMBOL = 256;
+constexpr quint32 ENTRY_OVERHEAD = 32;
+
+struct StaticEntry
+{
+    const char *name;
+    const char *value;
+};
+
+// RFC 7541, Appendix A
+const StaticEntry STATIC_TABLE[STATIC_TABLE_SIZE] = {{":authority", ""},
+                                                     {":method", "GET"},
+                                                     {":method", "POST"},
+                                                     {":path", "/"},
+                                                     {":path", "/index.html"},
+                                                     {":scheme", "http"},
+                                                     {":scheme", "https"},
+                                                     {":status", "200"},
+                                                     {":status", "204"},
+                                                     {":status", "206"},
+                                                     {":status", "304"},
+                                                     {":status", "400"},
+                                                     {":status", "404"},
+                                                     {":status", "500"},
+                                                     {"accept-charset", ""},
+                                                     {"accept-encoding", "gzip, deflate"},
+                                                     {"accept-language", ""},
+                                                     {"accept-ranges", ""},
+                                                     {"accept", ""},
+                                                     {"access-control-allow-origin", ""},
+                                                     {"age", ""},
+                                                     {"allow", ""},
+                                                     {"authorization", ""},
+                                                     {"cache-control", ""},
+                                                     {"content-disposition", ""},
+                                                     {"content-encoding", ""},
+                                                     {"content-language", ""},
+                                                     {"content-length", ""},
+                                                     {"content-location", ""},
+                                                     {"content-range", ""},
+                                                     {"content-type", ""},
+                                                     {"cookie", ""},
+                                                     {"date", ""},
+                                                     {"etag", ""},
+                                                     {"expect", ""},
+                                                     {"expires", ""},
+                                                     {"from", ""},
+                                                     {"host", ""},
+                                                     {"if-match", ""},
+                                                     {"if-modified-since", ""},
+                                                     {"if-none-match", ""},
+                                                     {"if-range", ""},
+                                                     {"if-unmodified-since", ""},
+                                                     {"last-modified", ""},
+                                                     {"link", ""},
+                                                     {"location", ""},
+                                                     {"max-forwards", ""},
+                                                     {"proxy-authenticate", ""},
+                                                     {"proxy-authorization", ""},
+                                                     {"range", ""},
+                                                     {"referer", ""},
+                                                     {"refresh", ""},
+                                                     {"retry-after", ""},
+                                                     {"server", ""},
+                                                     {"set-cookie", ""},
+                                                     {"strict-transport-security", ""},
+                                                     {"transfer-encoding", ""},
+                                                     {"user-agent", ""},
+                                                     {"vary", ""},
+                                                     {"via", ""},
+                                                     {"www-authenticate", ""}};
+
+// RFC 7541, Appendix B. Code is canonical, so lengths are enough to restore codes themselves
+const quint8 HUFFMAN_CODE_LENGTHS[EOS_SYMBOL + 1] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 30, 28,
+    28, 28, 28, 28, 28, 28, 28, 28, 6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10, 13, 6, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5, 6, 7, 6, 5, 5, 6, 7, 7,
+    7, 7, 7, 15, 11, 14, 13, 28, 20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24, 22, 21, 20, 22, 22, 23, 23, 21,
+    23, 22, 22, 24, 21, 22, 23, 23, 21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25, 19, 21, 26, 27, 27, 26, 27, 24,
+    21, 21, 26, 26, 28, 27, 27, 27, 20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26, 30};
+
+class HuffmanCode
+{
+public:
+    HuffmanCode()
+    {
+        std::array<quint16, EOS_SYMBOL + 1> symbols;
+        for (quint16 i = 0; i <= EOS_SYMBOL; ++i)
+            symbols[i] = i;
+        std::stable_sort(symbols.begin(), symbols.end(), [](quint16 left, quint16 right) {
+            return HUFFMAN_CODE_LENGTHS[left] < HUFFMAN_CODE_LENGTHS[right];
+        });
+
+        firstCode.fill(0);
+        firstIndex.fill(0);
+        count.fill(0);
+        quint32 code = 0;
+        int previousLength = HUFFMAN_CODE_LENGTHS[symbols[0]];
+        for (int i = 0; i <= static_cast<int>(EOS_SYMBOL); ++i) {
+            int length = HUFFMAN_CODE_LENGTHS[symbols[i]];
+            if (i > 0)
+                code = (code + 1) << (length - previousLength);
+            if (!count[length]) {
+                firstCode[length] = code;
+                firstIndex[length] = i;
+            }
+            ++count[length];
+            codes[symbols[i]] = code;
+            sortedSymbols[i] = symbols[i];
+            previousLength = length;
+        }
+    }
+
+    std::array<quint32, EOS_SYMBOL + 1> codes;
+    std::array<quint16, EOS_SYMBOL + 1> sortedSymbols;
+    std::array<quint32, MAX_HUFFMAN_CODE_LENGTH + 1> firstCode;
+    std::array<int, MAX_HUFFMAN_CODE_LENGTH + 1> firstIndex;
+    std::array<quint32, MAX_HUFFMAN_CODE_LENGTH + 1> count;
+};
+
+const HuffmanCode &huffmanCode()
+{
+    static const HuffmanCode code;
+    return code;
+}
+
+const QHash<QByteArray, int> &staticNameIndices()
+{
+    static const QHash<QByteArray, int> indices = []() {
+        QHash<QByteArray, int> result;
+        for (int i = STATIC_TABLE_SIZE - 1; i >= 0; --i)
+            result[QByteArray(STATIC_TABLE[i].name)] = i + 1;
+        return result;
+    }();
+    return indices;
+}
+
+bool shouldBeIndexed(const QByteArray &name)
+{
+    // Values that differ almost every time would only push useful entries out of table
+    return name != "content-length";
+}
+} // namespace
+
+using namespace Proof;
+
+HpackTable::HpackTable(quint32 maxSize) : m_maxSize(maxSize)
+{}
+
+bool HpackTable::entry(quint32 index, HpackHeader &result) const
+{
+    if (index == 0)
+        return false;
+    if (index <= STATIC_TABLE_SIZE) {
+        result = qMakePair(QByteArray(STATIC_TABLE[index - 1].name), QByteArray(STATIC_TABLE[index - 1].value));
+        return true;
+    }
+    index -= STATIC_TABLE_SIZE + 1;
+    if (index >= m_entries.size())
+        return false;
+    result = m_entries[index];
+    return true;
+}
+
+int HpackTable::find(const HpackHeader &header) const
+{
+    int nameMatch = 0;
+    int staticIndex = staticNameIndices().value(header.first, 0);
+    if (staticIndex) {
+        nameMatch = -staticIndex;
+        for (int i = staticIndex - 1; i < STATIC_TABLE_SIZE && header.first == STATIC_TABLE[i].name; ++i) {
+            if (header.second == STATIC_TABLE[i].value)
+                return i + 1;
+        }
+    }
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        if (m_entries[i].first != header.first)
+            continue;
+        if (m_entries[i].second == header.second)
+            return static_cast<int>(i) + STATIC_TABLE_SIZE + 1;
+        if (!nameMatch)
+            nameMatch = -(static_cast<int>(i) + STATIC_TABLE_SIZE + 1);
+    }
+    return nameMatch;
+}
+
+void HpackTable::add(const HpackHeader &header)
+{
+    quint32 size = entrySize(header);
+    if (size > m_maxSize) {
+        m_entries.clear();
+        m_size = 0;
+        return;
+    }
+    evict(size);
+    m_entries.push_front(header);
+    m_size += size;
+}
+
+quint32 HpackTable::maxSize() const
+{
+    return m_maxSize;
+}
+
+void HpackTable::setMaxSize(quint32 maxSize)
+{
+    m_maxSize = maxSize;
+    evict(0);
+}
+
+quint32 HpackTable::entrySize(const HpackHeader &header)
+{
+    return static_cast<quint32>(header.first.size() + header.second.size()) + ENTRY_OVERHEAD;
+}
+
+void HpackTable::evict(quint32 neededSpace)
+{
+    while (!m_entries.empty() && m_size + neededSpace > m_maxSize) {
+        m_size -= entrySize(m_entries.back());
+        m_entries.pop_back();
+    }
+}
+
+HpackDecoder::HpackDecoder(quint32 maxTableSize) : m_table(maxTableSize), m_maxAllowedTableSize(maxTableSize)
+{}
+
+bool HpackDecoder::decode(const QByteArray &block, HpackHeaders &headers)
+{
+    headers.clear();
+    const char *data = block.constData();
+    const char *end = data + block.size();
+    while (data < end) {
+        const quint8 firstByte = static_cast<quint8>(*data);
+        quint32 index = 0;
+        HpackHeader header;
+        if (firstByte & 0x80) {
+            if (!hpack::decodeInteger(data, end, 7, index) || !m_table.entry(index, header))
+                return false;
+            headers << header;
+            continue;
+        }
+        if ((firstByte & 0xE0) == 0x20) {
+            // Table size update is allowed only before first header
+            if (!hpack::decodeInteger(data, end, 5, index) || index > m_maxAllowedTableSize || !headers.isEmpty())
+                return false;
+            m_table.setMaxSize(index);
+            continue;
+        }
+
+        const bool incrementalIndexing = firstByte & 0x40;
+        if (!hpack::decodeInteger(data, end, incrementalIndexing ? 6 : 4, index))
+            return false;
+        if (index) {
+            if (!m_table.entry(index, header))
+                return false;
+        } else if (!hpack::decodeString(data, end, header.first)) {
+            return false;
+        }
+        if (!hpack::decodeString(data, end, header.second))
+            return false;
+        if (incrementalIndexing)
+            m_table.add(header);
+        headers << header;
+    }
+    return true;
+}
+
+HpackEncoder::HpackEncoder(quint32 maxTableSize) : m_table(maxTableSize), m_tableSizeLimit(maxTableSize)
+{}
+
+QByteArray HpackEncoder::encode(const HpackHeaders &headers)
+{
+    QByteArray result;
+    result.reserve(headers.count() * 16);
+    if (m_tableSizeChanged) {
+        if (m_smallestPendingTableSize < m_pendingTableSize) {
+            hpack::encodeInteger(result, m_smallestPendingTableSize, 5, 0x20);
+            m_table.setMaxSize(m_smallestPendingTableSize);
+        }
+        hpack::encodeInteger(result, m_pendingTableSize, 5, 0x20);
+        m_table.setMaxSize(m_pendingTableSize);
+        m_tableSizeChanged = false;
+    }
+
+    for (const HpackHeader &header : headers) {
+        int index = m_table.find(header);
+        if (index > 0) {
+            hpack::encodeInteger(result, static_cast<quint32>(index), 7, 0x80);
+            continue;
+        }
+        const bool indexed = shouldBeIndexed(header.first) && HpackTable::entrySize(header) <= m_table.maxSize();
+        hpack::encodeInteger(result, static_cast<quint32>(-index), indexed ? 6 : 4, indexed ? 0x40 : 0x00);
+        if (!index)
+            hpack::encodeString(result, header.first);
+        hpack::encodeString(result, header.second);
+        if (indexed)
+            m_table.add(header);
+    }
+    return result;
+}
+
+void HpackEncoder::setMaxTableSize(quint32 maxTableSize)
+{
+    maxTableSize = qMin(maxTableSize, m_tableSizeLimit);
+    m_smallestPendingTableSize = m_tableSizeChanged ? qMin(m_smallestPendingTableSize, maxTableSize) : maxTableSize;
+    m_pendingTableSize = maxTableSize;
+    m_tableSizeChanged = true;
+}
+
+void hpack::encodeInteger(QByteArray &out, quint32 value, int prefixBits, quint8 firstByteFlags)
+{
+    const quint32 maxPrefix = (1u << prefixBits) - 1;
+    if (value < maxPrefix) {
+        out.append(static_cast<char>(firstByteFlags | value));
+        return;
+    }
+    out.append(static_cast<char>(firstByteFlags | maxPrefix));
+    value -= maxPrefix;
+    while (value >= 0x80) {
+        out.append(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+bool hpack::decodeInteger(const char *&data, const char *end, int prefixBits, quint32 &value)
+{
+    if (data >= end)
+        return false;
+    const quint32 maxPrefix = (1u << prefixBits) - 1;
+    value = static_cast<quint8>(*data++) & maxPrefix;
+    if (value < maxPrefix)
+        return true;
+    quint64 result = value;
+    for (int shift = 0; data < end; shift += 7) {
+        // 32-bit value never needs more than 5 continuation bytes, zero payload ones would grow shift forever
+        if (shift > 28)
+            return false;
+        const quint8 byte = static_cast<quint8>(*data++);
+        result += static_cast<quint64>(byte & 0x7F) << shift;
+        if (result > 0xFFFFFFFFull)
+            return false;
+        if (!(byte & 0x80)) {
+            value = static_cast<quint32>(result);
+            return true;
+        }
+    }
+    return false;
+}
+
+void hpack::encodeString(QByteArray &out, const QByteArray &value)
+{
+    const int huffmanSize = huffmanEncodedSize(value);
+    if (huffmanSize < value.size()) {
+        encodeInteger(out, static_cast<quint32>(huffmanSize), 7, 0x80);
+        out.append(huffmanEncode(value));
+    } else {
+        encodeInteger(out, static_cast<quint32>(value.size()), 7, 0x00);
+        out.append(value);
+    }
+}
+
+bool hpack::decodeString(const char *&data, const char *end, QByteArray &value)
+{
+    if (data >= end)
+        return false;
+    const bool huffman = static_cast<quint8>(*data) & 0x80;
+    quint32 length = 0;
+    if (!decodeInteger(data, end, 7, length) || length > static_cast<quint32>(end - data))
+        return false;
+    const int size = static_cast<int>(length);
+    if (huffman) {
+        if (!huffmanDecode(data, size, value))
+            return false;
+    } else {
+        value = QByteArray(data, size);
+    }
+    data += size;
+    return true;
+}
+
+QByteArray hpack::huffmanEncode(const QByteArray &data)
+{
+    const HuffmanCode &code = huffmanCode();
+    QByteArray result;
+    result.reserve(huffmanEncodedSize(data));
+    quint64 bits = 0;
+    int bitsCount = 0;
+    for (char c : data) {
+        const quint8 symbol = static_cast<quint8>(c);
+        bits = (bits << HUFFMAN_CODE_LENGTHS[symbol]) | code.codes[symbol];
+        bitsCount += HUFFMAN_CODE_LENGTHS[symbol];
+        while (bitsCount >= 8) {
+            bitsCount -= 8;
+            result.append(static_cast<char>(bits >> bitsCount));
+        }
+        bits &= (1ull << bitsCount) - 1;
+    }
+    // Padding is the most significant bits of EOS, i.e. all ones
+    if (bitsCount)
+        result.append(static_cast<char>((bits << (8 - bitsCount)) | (0xFFu >> bitsCount)));
+    return result;
+}
+
+bool hpack::huffmanDecode(const char *data, int size, QByteArray &result)
+{
+    const HuffmanCode &code = huffmanCode();
+    result.clear();
+    result.reserve(size * 8 / 5);
+    quint32 current = 0;
+    int length = 0;
+    for (int i = 0; i < size; ++i) {
+        const quint8 byte = static_cast<quint8>(data[i]);
+        for (int bit = 7; bit >= 0; --bit) {
+            current = (current << 1) | ((byte >> bit) & 1);
+            ++length;
+            if (length > MAX_HUFFMAN_CODE_LENGTH)
+                return false;
+            if (current - code.firstCode[length] < code.count[length] && current >= code.firstCode[length]) {
+                const quint16 symbol = code.sortedSymbols[code.firstIndex[length] + current - code.firstCode[length]];
+                if (symbol == EOS_SYMBOL)
+                    return false;
+                result.append(static_cast<char>(symbol));
+                current = 0;
+                length = 0;
+            }
+        }
+    }
+    // Only padding of up to 7 ones can be left
+    return length < 8 && current == (1u << length) - 1;
+}
+
+int hpack::huffmanEncodedSize(const QByteArray &data)
+{
+    quint64 bits = 0;
+    for (char c : data)
+        bits += HUFFMAN_CODE_LENGTHS[static_cast<quint8>(c)];
+    return static_cast<int>((bits + 7) / 8);
+}
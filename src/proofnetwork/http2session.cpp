@@ -0,0 +1,614 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "proofnetwork/http2session_p.h"
+
+#include <cstring>
+
+namespace {
+constexpr int FRAME_HEADER_SIZE = 9;
+constexpr quint32 DEFAULT_MAX_FRAME_SIZE = 16384;
+constexpr quint32 MAX_ALLOWED_FRAME_SIZE = 16777215;
+constexpr qint64 DEFAULT_WINDOW_SIZE = 65535;
+constexpr qint64 MAX_WINDOW_SIZE = 0x7FFFFFFF;
+constexpr int MAX_HEADER_BLOCK_SIZE = 256 * 1024;
+
+enum FrameType : quint8
+{
+    DataFrame = 0x0,
+    HeadersFrame = 0x1,
+    PriorityFrame = 0x2,
+    RstStreamFrame = 0x3,
+    SettingsFrame = 0x4,
+    PushPromiseFrame = 0x5,
+    PingFrame = 0x6,
+    GoAwayFrame = 0x7,
+    WindowUpdateFrame = 0x8,
+    ContinuationFrame = 0x9
+};
+
+enum FrameFlag : quint8
+{
+    EndStreamFlag = 0x1,
+    AckFlag = 0x1,
+    EndHeadersFlag = 0x4,
+    PaddedFlag = 0x8,
+    PriorityFlag = 0x20
+};
+
+enum Setting : quint16
+{
+    HeaderTableSizeSetting = 0x1,
+    EnablePushSetting = 0x2,
+    MaxConcurrentStreamsSetting = 0x3,
+    InitialWindowSizeSetting = 0x4,
+    MaxFrameSizeSetting = 0x5
+};
+
+enum ErrorCode : quint32
+{
+    ProtocolError = 0x1,
+    FlowControlError = 0x3,
+    StreamClosedError = 0x5,
+    FrameSizeError = 0x6,
+    RefusedStreamError = 0x7,
+    CompressionError = 0x9,
+    EnhanceYourCalmError = 0xb
+};
+
+quint16 readUInt16(const char *data)
+{
+    const auto bytes = reinterpret_cast<const quint8 *>(data);
+    return static_cast<quint16>((bytes[0] << 8) | bytes[1]);
+}
+
+quint32 readUInt32(const char *data)
+{
+    const auto bytes = reinterpret_cast<const quint8 *>(data);
+    return (static_cast<quint32>(bytes[0]) << 24) | (static_cast<quint32>(bytes[1]) << 16)
+           | (static_cast<quint32>(bytes[2]) << 8) | bytes[3];
+}
+
+void writeUInt32(char *data, quint32 value)
+{
+    data[0] = static_cast<char>(value >> 24);
+    data[1] = static_cast<char>(value >> 16);
+    data[2] = static_cast<char>(value >> 8);
+    data[3] = static_cast<char>(value);
+}
+
+bool isConnectionSpecificHeader(const QByteArray &name)
+{
+    // These are not allowed in HTTP/2 (RFC 7540, 8.1.2.2)
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" || name == "transfer-encoding"
+           || name == "upgrade";
+}
+} // namespace
+
+using namespace Proof;
+
+QByteArray Http2Session::connectionPreface()
+{
+    return QByteArrayLiteral("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+}
+
+Http2Session::Http2Session(quint32 maxConcurrentStreams)
+    : m_maxConcurrentStreams(maxConcurrentStreams), m_peerMaxFrameSize(DEFAULT_MAX_FRAME_SIZE),
+      m_peerInitialWindowSize(DEFAULT_WINDOW_SIZE), m_sendWindow(DEFAULT_WINDOW_SIZE)
+{
+    // Server preface is a SETTINGS frame and it doesn't need to wait for client one
+    char settings[6];
+    settings[0] = 0;
+    settings[1] = static_cast<char>(MaxConcurrentStreamsSetting);
+    writeUInt32(settings + 2, maxConcurrentStreams);
+    writeFrame(SettingsFrame, 0, 0, settings, 6);
+}
+
+bool Http2Session::processIncoming(const QByteArray &data)
+{
+    if (m_goAwaySent)
+        return false;
+    m_incoming.append(data);
+
+    int offset = 0;
+    if (!m_prefaceReceived) {
+        const QByteArray preface = connectionPreface();
+        const int checkedSize = qMin(m_incoming.size(), preface.size());
+        if (memcmp(m_incoming.constData(), preface.constData(), static_cast<size_t>(checkedSize)))
+            return connectionError(ProtocolError, QStringLiteral("Invalid connection preface"));
+        if (checkedSize < preface.size())
+            return true;
+        m_prefaceReceived = true;
+        offset = preface.size();
+    }
+
+    bool result = true;
+    while (result && m_incoming.size() - offset >= FRAME_HEADER_SIZE) {
+        const char *header = m_incoming.constData() + offset;
+        const quint32 length = readUInt32(header) >> 8;
+        const quint8 type = static_cast<quint8>(header[3]);
+        const quint8 flags = static_cast<quint8>(header[4]);
+        const quint32 streamId = readUInt32(header + 5) & 0x7FFFFFFF;
+        if (length > DEFAULT_MAX_FRAME_SIZE) {
+            result = connectionError(FrameSizeError, QStringLiteral("Frame is bigger than SETTINGS_MAX_FRAME_SIZE"));
+            break;
+        }
+        if (static_cast<quint32>(m_incoming.size() - offset - FRAME_HEADER_SIZE) < length)
+            break;
+        const QByteArray payload = m_incoming.mid(offset + FRAME_HEADER_SIZE, static_cast<int>(length));
+        offset += FRAME_HEADER_SIZE + static_cast<int>(length);
+        result = handleFrame(type, flags, streamId, payload);
+    }
+    m_incoming.remove(0, offset);
+    return result;
+}
+
+QVector<Http2Request> Http2Session::takeRequests()
+{
+    QVector<Http2Request> result;
+    result.swap(m_requests);
+    return result;
+}
+
+QVector<quint32> Http2Session::takeResetStreams()
+{
+    QVector<quint32> result;
+    result.swap(m_resetStreams);
+    return result;
+}
+
+QByteArray Http2Session::takeOutgoing()
+{
+    QByteArray result;
+    result.swap(m_outgoing);
+    return result;
+}
+
+void Http2Session::sendResponse(quint32 streamId, int status, const HpackHeaders &headers, const QByteArray &body)
+{
+    auto it = m_streams.find(streamId);
+    if (it == m_streams.end() || !it->requestReceived || it->responseSent)
+        return;
+
+    HpackHeaders responseHeaders;
+    responseHeaders.reserve(headers.count() + 2);
+    responseHeaders << qMakePair(QByteArrayLiteral(":status"), QByteArray::number(status));
+    for (const HpackHeader &header : headers) {
+        if (!isConnectionSpecificHeader(header.first))
+            responseHeaders << header;
+    }
+    if (!body.isEmpty())
+        responseHeaders << qMakePair(QByteArrayLiteral("content-length"), QByteArray::number(body.size()));
+
+    // Header block goes in HEADERS frame followed by as many CONTINUATION frames as peer frame size requires
+    const QByteArray block = m_encoder.encode(responseHeaders);
+    int offset = 0;
+    quint8 type = HeadersFrame;
+    do {
+        const int size = qMin(block.size() - offset, static_cast<int>(m_peerMaxFrameSize));
+        quint8 flags = 0;
+        if (type == HeadersFrame && body.isEmpty())
+            flags |= EndStreamFlag;
+        if (offset + size == block.size())
+            flags |= EndHeadersFlag;
+        writeFrame(type, flags, streamId, block.constData() + offset, size);
+        offset += size;
+        type = ContinuationFrame;
+    } while (offset < block.size());
+
+    if (body.isEmpty()) {
+        m_streams.erase(it);
+        return;
+    }
+    it->responseSent = true;
+    it->pendingData = body;
+    it->pendingDataOffset = 0;
+    flushStream(streamId);
+}
+
+bool Http2Session::isFinished() const
+{
+    return m_goAwaySent || (m_goAwayReceived && m_streams.isEmpty());
+}
+
+QString Http2Session::error() const
+{
+    return m_error;
+}
+
+bool Http2Session::handleFrame(quint8 type, quint8 flags, quint32 streamId, const QByteArray &payload)
+{
+    if (!m_settingsReceived && type != SettingsFrame)
+        return connectionError(ProtocolError, QStringLiteral("First frame must be SETTINGS"));
+    if (m_headerBlockStreamId && type != ContinuationFrame)
+        return connectionError(ProtocolError, QStringLiteral("CONTINUATION frame expected"));
+
+    switch (type) {
+    case DataFrame:
+        return handleData(flags, streamId, payload);
+    case HeadersFrame:
+        return handleHeaders(flags, streamId, payload);
+    case PriorityFrame:
+        // Responses are sent as soon as they are ready, priorities are not used
+        if (!streamId)
+            return connectionError(ProtocolError, QStringLiteral("PRIORITY on stream 0"));
+        if (payload.size() != 5)
+            resetStream(streamId, FrameSizeError);
+        return true;
+    case RstStreamFrame:
+        if (!streamId || streamId > m_lastStreamId)
+            return connectionError(ProtocolError, QStringLiteral("RST_STREAM on idle stream"));
+        if (payload.size() != 4)
+            return connectionError(FrameSizeError, QStringLiteral("Invalid RST_STREAM size"));
+        if (m_streams.remove(streamId))
+            m_resetStreams << streamId;
+        return true;
+    case SettingsFrame:
+        return handleSettings(flags, streamId, payload);
+    case PushPromiseFrame:
+        return connectionError(ProtocolError, QStringLiteral("PUSH_PROMISE from client"));
+    case PingFrame:
+        if (streamId)
+            return connectionError(ProtocolError, QStringLiteral("PING on non-zero stream"));
+        if (payload.size() != 8)
+            return connectionError(FrameSizeError, QStringLiteral("Invalid PING size"));
+        if (!(flags & AckFlag))
+            writeFrame(PingFrame, AckFlag, 0, payload);
+        return true;
+    case GoAwayFrame:
+        if (streamId)
+            return connectionError(ProtocolError, QStringLiteral("GOAWAY on non-zero stream"));
+        m_goAwayReceived = true;
+        return true;
+    case WindowUpdateFrame:
+        return handleWindowUpdate(streamId, payload);
+    case ContinuationFrame:
+        return handleContinuation(flags, streamId, payload);
+    default:
+        // Unknown frame types must be ignored
+        return true;
+    }
+}
+
+bool Http2Session::handleData(quint8 flags, quint32 streamId, const QByteArray &payload)
+{
+    if (!streamId)
+        return connectionError(ProtocolError, QStringLiteral("DATA on stream 0"));
+
+    // Flow control counts whole payload including padding. Data is buffered right away, so window is given back
+    // as soon as half of it is used
+    m_receiveWindowConsumed += payload.size();
+    if (m_receiveWindowConsumed > DEFAULT_WINDOW_SIZE)
+        return connectionError(FlowControlError, QStringLiteral("Connection flow control window exceeded"));
+    if (m_receiveWindowConsumed >= DEFAULT_WINDOW_SIZE / 2) {
+        writeWindowUpdate(0, static_cast<quint32>(m_receiveWindowConsumed));
+        m_receiveWindowConsumed = 0;
+    }
+
+    QByteArray data = payload;
+    if (!stripPadding(flags, data))
+        return connectionError(ProtocolError, QStringLiteral("Invalid DATA padding"));
+
+    auto it = m_streams.find(streamId);
+    if (it == m_streams.end()) {
+        if (streamId > m_lastStreamId)
+            return connectionError(ProtocolError, QStringLiteral("DATA on idle stream"));
+        // Stream was reset already, frames that were in flight are ignored
+        return true;
+    }
+    if (it->requestReceived) {
+        resetStream(streamId, StreamClosedError);
+        return true;
+    }
+
+    it->receiveWindowConsumed += payload.size();
+    if (it->receiveWindowConsumed > DEFAULT_WINDOW_SIZE) {
+        resetStream(streamId, FlowControlError);
+        return true;
+    }
+    it->body.append(data);
+    if (flags & EndStreamFlag) {
+        completeRequest(streamId, *it);
+    } else if (it->receiveWindowConsumed >= DEFAULT_WINDOW_SIZE / 2) {
+        writeWindowUpdate(streamId, static_cast<quint32>(it->receiveWindowConsumed));
+        it->receiveWindowConsumed = 0;
+    }
+    return true;
+}
+
+bool Http2Session::handleHeaders(quint8 flags, quint32 streamId, const QByteArray &payload)
+{
+    if (!streamId || !(streamId & 1))
+        return connectionError(ProtocolError, QStringLiteral("HEADERS on invalid stream"));
+
+    QByteArray fragment = payload;
+    if (!stripPadding(flags, fragment))
+        return connectionError(ProtocolError, QStringLiteral("Invalid HEADERS padding"));
+    if (flags & PriorityFlag) {
+        if (fragment.size() < 5)
+            return connectionError(FrameSizeError, QStringLiteral("Invalid HEADERS priority"));
+        fragment.remove(0, 5);
+    }
+
+    auto it = m_streams.constFind(streamId);
+    if (it == m_streams.cend()) {
+        if (streamId <= m_lastStreamId)
+            return connectionError(StreamClosedError, QStringLiteral("HEADERS on closed stream"));
+        m_lastStreamId = streamId;
+    } else if (it->requestReceived) {
+        return connectionError(StreamClosedError, QStringLiteral("HEADERS after end of stream"));
+    }
+
+    m_headerBlockStreamId = streamId;
+    m_headerBlockFlags = flags;
+    m_headerBlock = fragment;
+    return (flags & EndHeadersFlag) ? handleHeaderBlock() : true;
+}
+
+bool Http2Session::handleContinuation(quint8 flags, quint32 streamId, const QByteArray &payload)
+{
+    if (!m_headerBlockStreamId || streamId != m_headerBlockStreamId)
+        return connectionError(ProtocolError, QStringLiteral("Unexpected CONTINUATION"));
+    if (m_headerBlock.size() + payload.size() > MAX_HEADER_BLOCK_SIZE)
+        return connectionError(EnhanceYourCalmError, QStringLiteral("Header block is too big"));
+    m_headerBlock.append(payload);
+    return (flags & EndHeadersFlag) ? handleHeaderBlock() : true;
+}
+
+bool Http2Session::handleSettings(quint8 flags, quint32 streamId, const QByteArray &payload)
+{
+    if (streamId)
+        return connectionError(ProtocolError, QStringLiteral("SETTINGS on non-zero stream"));
+    if (flags & AckFlag) {
+        if (!payload.isEmpty())
+            return connectionError(FrameSizeError, QStringLiteral("SETTINGS ack with payload"));
+        return true;
+    }
+    if (payload.size() % 6)
+        return connectionError(FrameSizeError, QStringLiteral("Invalid SETTINGS size"));
+
+    for (int i = 0; i < payload.size(); i += 6) {
+        const quint16 id = readUInt16(payload.constData() + i);
+        const quint32 value = readUInt32(payload.constData() + i + 2);
+        switch (id) {
+        case HeaderTableSizeSetting:
+            m_encoder.setMaxTableSize(value);
+            break;
+        case EnablePushSetting:
+            if (value > 1)
+                return connectionError(ProtocolError, QStringLiteral("Invalid SETTINGS_ENABLE_PUSH"));
+            break;
+        case InitialWindowSizeSetting: {
+            if (value > MAX_WINDOW_SIZE)
+                return connectionError(FlowControlError, QStringLiteral("Invalid SETTINGS_INITIAL_WINDOW_SIZE"));
+            // Change is applied to all existing streams, windows can become negative
+            const qint64 delta = static_cast<qint64>(value) - m_peerInitialWindowSize;
+            for (auto streamIt = m_streams.begin(); streamIt != m_streams.end(); ++streamIt) {
+                streamIt->sendWindow += delta;
+                if (streamIt->sendWindow > MAX_WINDOW_SIZE)
+                    return connectionError(FlowControlError, QStringLiteral("Stream window overflow"));
+            }
+            m_peerInitialWindowSize = value;
+            break;
+        }
+        case MaxFrameSizeSetting:
+            if (value < DEFAULT_MAX_FRAME_SIZE || value > MAX_ALLOWED_FRAME_SIZE)
+                return connectionError(ProtocolError, QStringLiteral("Invalid SETTINGS_MAX_FRAME_SIZE"));
+            m_peerMaxFrameSize = value;
+            break;
+        default:
+            break;
+        }
+    }
+    m_settingsReceived = true;
+    writeFrame(SettingsFrame, AckFlag, 0);
+    flushAllStreams();
+    return true;
+}
+
+bool Http2Session::handleWindowUpdate(quint32 streamId, const QByteArray &payload)
+{
+    if (payload.size() != 4)
+        return connectionError(FrameSizeError, QStringLiteral("Invalid WINDOW_UPDATE size"));
+    const quint32 increment = readUInt32(payload.constData()) & 0x7FFFFFFF;
+
+    if (!streamId) {
+        if (!increment)
+            return connectionError(ProtocolError, QStringLiteral("Zero WINDOW_UPDATE increment"));
+        m_sendWindow += increment;
+        if (m_sendWindow > MAX_WINDOW_SIZE)
+            return connectionError(FlowControlError, QStringLiteral("Connection window overflow"));
+        flushAllStreams();
+        return true;
+    }
+
+    auto it = m_streams.find(streamId);
+    if (it == m_streams.end())
+        return true;
+    if (!increment) {
+        resetStream(streamId, ProtocolError);
+        return true;
+    }
+    it->sendWindow += increment;
+    if (it->sendWindow > MAX_WINDOW_SIZE) {
+        resetStream(streamId, FlowControlError);
+        return true;
+    }
+    flushStream(streamId);
+    return true;
+}
+
+bool Http2Session::handleHeaderBlock()
+{
+    const quint32 streamId = m_headerBlockStreamId;
+    const bool endStream = m_headerBlockFlags & EndStreamFlag;
+    m_headerBlockStreamId = 0;
+
+    HpackHeaders headers;
+    const bool decoded = m_decoder.decode(m_headerBlock, headers);
+    m_headerBlock.clear();
+    if (!decoded)
+        return connectionError(CompressionError, QStringLiteral("Can't decode header block"));
+
+    auto it = m_streams.find(streamId);
+    if (it != m_streams.end()) {
+        // Trailers, they are not passed to rest methods
+        if (endStream)
+            completeRequest(streamId, *it);
+        else
+            resetStream(streamId, ProtocolError);
+        return true;
+    }
+
+    if (static_cast<quint32>(m_streams.count()) >= m_maxConcurrentStreams) {
+        resetStream(streamId, RefusedStreamError);
+        return true;
+    }
+
+    Stream stream;
+    stream.sendWindow = m_peerInitialWindowSize;
+    stream.headers.reserve(headers.count());
+    for (const HpackHeader &header : qAsConst(headers)) {
+        if (header.first == ":method")
+            stream.method = QString::fromLatin1(header.second);
+        else if (header.first == ":path")
+            stream.path = QString::fromUtf8(header.second);
+        else if (header.first == ":authority")
+            stream.headers << QStringLiteral("host: %1").arg(QString::fromUtf8(header.second));
+        else if (!header.first.startsWith(':'))
+            stream.headers << QStringLiteral("%1: %2").arg(QString::fromLatin1(header.first),
+                                                           QString::fromUtf8(header.second));
+    }
+    if (stream.method.isEmpty() || stream.path.isEmpty()) {
+        resetStream(streamId, ProtocolError);
+        return true;
+    }
+
+    it = m_streams.insert(streamId, stream);
+    if (endStream)
+        completeRequest(streamId, *it);
+    return true;
+}
+
+bool Http2Session::stripPadding(quint8 flags, QByteArray &payload)
+{
+    if (!(flags & PaddedFlag))
+        return true;
+    if (payload.isEmpty())
+        return false;
+    const int padLength = static_cast<quint8>(payload[0]);
+    if (padLength >= payload.size())
+        return false;
+    payload = payload.mid(1, payload.size() - 1 - padLength);
+    return true;
+}
+
+void Http2Session::completeRequest(quint32 streamId, Stream &stream)
+{
+    stream.requestReceived = true;
+    Http2Request request;
+    request.streamId = streamId;
+    request.method = stream.method;
+    request.path = stream.path;
+    request.headers = stream.headers;
+    request.body = stream.body;
+    stream.body.clear();
+    m_requests << request;
+}
+
+void Http2Session::flushStream(quint32 streamId)
+{
+    auto it = m_streams.find(streamId);
+    if (it == m_streams.end() || !it->responseSent)
+        return;
+
+    Stream &stream = *it;
+    while (stream.pendingDataOffset < stream.pendingData.size() && m_sendWindow > 0 && stream.sendWindow > 0) {
+        qint64 size = qMin(static_cast<qint64>(stream.pendingData.size() - stream.pendingDataOffset),
+                           static_cast<qint64>(m_peerMaxFrameSize));
+        size = qMin(size, qMin(m_sendWindow, stream.sendWindow));
+        const bool last = stream.pendingDataOffset + size == stream.pendingData.size();
+        writeFrame(DataFrame, last ? EndStreamFlag : 0, streamId,
+                   stream.pendingData.constData() + stream.pendingDataOffset, static_cast<int>(size));
+        stream.pendingDataOffset += static_cast<int>(size);
+        m_sendWindow -= size;
+        stream.sendWindow -= size;
+    }
+    if (stream.pendingDataOffset == stream.pendingData.size())
+        m_streams.erase(it);
+}
+
+void Http2Session::flushAllStreams()
+{
+    const auto streamIds = m_streams.keys();
+    for (quint32 streamId : streamIds) {
+        if (m_sendWindow <= 0)
+            break;
+        flushStream(streamId);
+    }
+}
+
+void Http2Session::writeFrame(quint8 type, quint8 flags, quint32 streamId, const char *payload, int size)
+{
+    char header[FRAME_HEADER_SIZE];
+    writeUInt32(header, static_cast<quint32>(size) << 8);
+    header[3] = static_cast<char>(type);
+    header[4] = static_cast<char>(flags);
+    writeUInt32(header + 5, streamId & 0x7FFFFFFF);
+    m_outgoing.append(header, FRAME_HEADER_SIZE);
+    m_outgoing.append(payload, size);
+}
+
+void Http2Session::writeFrame(quint8 type, quint8 flags, quint32 streamId, const QByteArray &payload)
+{
+    writeFrame(type, flags, streamId, payload.constData(), payload.size());
+}
+
+void Http2Session::writeWindowUpdate(quint32 streamId, quint32 increment)
+{
+    char payload[4];
+    writeUInt32(payload, increment);
+    writeFrame(WindowUpdateFrame, 0, streamId, payload, 4);
+}
+
+void Http2Session::resetStream(quint32 streamId, quint32 errorCode)
+{
+    char payload[4];
+    writeUInt32(payload, errorCode);
+    writeFrame(RstStreamFrame, 0, streamId, payload, 4);
+    m_streams.remove(streamId);
+}
+
+bool Http2Session::connectionError(quint32 errorCode, const QString &message)
+{
+    if (!m_goAwaySent) {
+        char payload[8];
+        writeUInt32(payload, m_lastStreamId);
+        writeUInt32(payload + 4, errorCode);
+        writeFrame(GoAwayFrame, 0, 0, payload, 8);
+        m_goAwaySent = true;
+        m_error = message;
+    }
+    return false;
+}
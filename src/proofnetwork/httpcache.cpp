@@ -0,0 +1,221 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "proofnetwork/httpcache_p.h"
+
+#include <QBuffer>
+#include <QMutexLocker>
+
+#include <limits>
+
+using namespace Proof;
+
+HttpCacheStorage::HttpCacheStorage(qint64 memoryBudget, const QString &diskDirectory, qint64 diskBudget)
+{
+    m_memory.setMaxCost(
+        static_cast<int>(qBound(0ll, memoryBudget, static_cast<qint64>(std::numeric_limits<int>::max()))));
+    if (!diskDirectory.isEmpty()) {
+        m_disk.reset(new QNetworkDiskCache);
+        m_disk->setCacheDirectory(diskDirectory);
+        m_disk->setMaximumCacheSize(diskBudget);
+    }
+}
+
+QNetworkCacheMetaData HttpCacheStorage::metaData(const QUrl &url)
+{
+    QMutexLocker lock(&m_mutex);
+    MemoryEntry *entry = m_memory.object(url);
+    if (entry)
+        return entry->metaData;
+    return m_disk ? m_disk->metaData(url) : QNetworkCacheMetaData();
+}
+
+void HttpCacheStorage::updateMetaData(const QNetworkCacheMetaData &metaData)
+{
+    // Qt updates metadata of stored entry only after successful conditional request
+    ++m_revalidations;
+    QMutexLocker lock(&m_mutex);
+    MemoryEntry *entry = m_memory.object(metaData.url());
+    if (entry)
+        entry->metaData = metaData;
+    if (m_disk)
+        m_disk->updateMetaData(metaData);
+}
+
+bool HttpCacheStorage::data(const QUrl &url, QByteArray &result)
+{
+    QMutexLocker lock(&m_mutex);
+    MemoryEntry *entry = m_memory.object(url);
+    if (entry) {
+        result = entry->data;
+        return true;
+    }
+    if (!m_disk)
+        return false;
+    QScopedPointer<QIODevice> device(m_disk->data(url));
+    if (!device)
+        return false;
+    result = device->readAll();
+    ++m_diskHits;
+    insertToMemory(m_disk->metaData(url), result);
+    return true;
+}
+
+void HttpCacheStorage::insert(const QNetworkCacheMetaData &metaData, const QByteArray &data)
+{
+    QMutexLocker lock(&m_mutex);
+    insertToMemory(metaData, data);
+    if (!m_disk)
+        return;
+    QIODevice *device = m_disk->prepare(metaData);
+    if (!device)
+        return;
+    device->write(data);
+    m_disk->insert(device);
+}
+
+bool HttpCacheStorage::remove(const QUrl &url)
+{
+    QMutexLocker lock(&m_mutex);
+    bool result = m_memory.remove(url);
+    if (m_disk)
+        result = m_disk->remove(url) || result;
+    return result;
+}
+
+qint64 HttpCacheStorage::cacheSize() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_memory.totalCost() + (m_disk ? m_disk->cacheSize() : 0);
+}
+
+void HttpCacheStorage::clear()
+{
+    QMutexLocker lock(&m_mutex);
+    m_memory.clear();
+    if (m_disk)
+        m_disk->clear();
+}
+
+void HttpCacheStorage::countReply(bool fromCache)
+{
+    if (fromCache)
+        ++m_hits;
+    else
+        ++m_misses;
+}
+
+QVariantMap HttpCacheStorage::statistics() const
+{
+    QVariantMap result{{QStringLiteral("hits"), static_cast<qint64>(m_hits)},
+                       {QStringLiteral("misses"), static_cast<qint64>(m_misses)},
+                       {QStringLiteral("revalidations"), static_cast<qint64>(m_revalidations)},
+                       {QStringLiteral("disk_hits"), static_cast<qint64>(m_diskHits)}};
+    QMutexLocker lock(&m_mutex);
+    result[QStringLiteral("memory_entries")] = m_memory.count();
+    result[QStringLiteral("memory_size")] = m_memory.totalCost();
+    result[QStringLiteral("memory_budget")] = m_memory.maxCost();
+    result[QStringLiteral("disk_size")] = m_disk ? m_disk->cacheSize() : 0;
+    return result;
+}
+
+void HttpCacheStorage::insertToMemory(const QNetworkCacheMetaData &metaData, const QByteArray &data)
+{
+    // Entries bigger than whole budget are not kept in memory by QCache itself
+    m_memory.insert(metaData.url(), new MemoryEntry{metaData, data}, data.size());
+}
+
+HttpCache::HttpCache(const QSharedPointer<HttpCacheStorage> &storage, QObject *parent)
+    : QAbstractNetworkCache(parent), m_storage(storage)
+{}
+
+HttpCache::~HttpCache()
+{
+    qDeleteAll(m_preparedDevices.keys());
+}
+
+QNetworkCacheMetaData HttpCache::metaData(const QUrl &url)
+{
+    return m_storage->metaData(url);
+}
+
+void HttpCache::updateMetaData(const QNetworkCacheMetaData &metaData)
+{
+    m_storage->updateMetaData(metaData);
+}
+
+QIODevice *HttpCache::data(const QUrl &url)
+{
+    QByteArray data;
+    if (!m_storage->data(url, data))
+        return nullptr;
+    QBuffer *result = new QBuffer;
+    result->setData(data);
+    result->open(QIODevice::ReadOnly);
+    return result;
+}
+
+bool HttpCache::remove(const QUrl &url)
+{
+    // Download of prepared entry can be aborted, device is removed then
+    for (auto it = m_preparedDevices.begin(); it != m_preparedDevices.end();) {
+        if (it.value().url() == url) {
+            delete it.key();
+            it = m_preparedDevices.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return m_storage->remove(url);
+}
+
+qint64 HttpCache::cacheSize() const
+{
+    return m_storage->cacheSize();
+}
+
+QIODevice *HttpCache::prepare(const QNetworkCacheMetaData &metaData)
+{
+    if (!metaData.isValid() || !metaData.url().isValid() || !metaData.saveToDisk())
+        return nullptr;
+    QBuffer *result = new QBuffer;
+    result->open(QIODevice::WriteOnly);
+    m_preparedDevices.insert(result, metaData);
+    return result;
+}
+
+void HttpCache::insert(QIODevice *device)
+{
+    auto it = m_preparedDevices.find(device);
+    if (it == m_preparedDevices.end())
+        return;
+    m_storage->insert(it.value(), static_cast<QBuffer *>(device)->data());
+    m_preparedDevices.erase(it);
+    delete device;
+}
+
+void HttpCache::clear()
+{
+    m_storage->clear();
+}
@@ -24,11 +24,14 @@
  */
 #include "proofnetwork/httpparser_p.h"
 
+#include "proofnetwork/multipartparser_p.h"
+
 #include <QObject>
 #include <QRegExp>
 
-static const QRegExp FIRST_LINE_REG_EXP("(.*) (.*) HTTP/1[.][01]\r\n");
-static const QRegExp HEADER_REG_EXP("((.*): (.*))\r\n");
+static const QRegExp FIRST_LINE_REG_EXP("(.*) (.*) HTTP/1[.]([01])\r\n");
+// Whitespace after colon is optional (RFC 7230, 3.2)
+static const QRegExp HEADER_REG_EXP("(([^:]*):[ \t]*(.*))\r\n");
 
 using namespace Proof;
 
@@ -41,9 +44,24 @@ HttpParser::Result HttpParser::parseNextPart(QByteArray data) // clazy:exclude=f
     do
         result = (this->*m_state)(data);
     while (result == Result::NeedMore && !data.isEmpty());
+    if (result == Result::Success)
+        m_unparsedData = data;
+    return result;
+}
+
+QByteArray HttpParser::takeUnparsedData()
+{
+    QByteArray result;
+    result.swap(m_unparsedData);
     return result;
 }
 
+void HttpParser::setFormDataStreaming(qint64 maxPartSize, qint64 inMemoryPartSize)
+{
+    m_formDataMaxPartSize = maxPartSize;
+    m_formDataInMemoryPartSize = inMemoryPartSize;
+}
+
 QString HttpParser::method() const
 {
     return m_method;
@@ -54,6 +72,11 @@ QString HttpParser::uri() const
     return m_uri;
 }
 
+int HttpParser::httpMinorVersion() const
+{
+    return m_httpMinorVersion;
+}
+
 QStringList HttpParser::headers() const
 {
     return m_headers;
@@ -64,6 +87,11 @@ QByteArray HttpParser::body() const
     return m_data;
 }
 
+QVector<RestFormDataPart> HttpParser::formDataParts() const
+{
+    return m_multipartParser ? m_multipartParser->parts() : QVector<RestFormDataPart>();
+}
+
 QString HttpParser::error() const
 {
     return m_error;
@@ -82,6 +110,7 @@ HttpParser::Result HttpParser::initialState(QByteArray &data)
         if (firstLineRegExp.indexIn(startLine) != -1) {
             m_method = firstLineRegExp.cap(1);
             m_uri = firstLineRegExp.cap(2);
+            m_httpMinorVersion = firstLineRegExp.cap(3).toInt();
             m_state = &HttpParser::headersState;
             result = Result::NeedMore;
         } else {
@@ -117,10 +146,19 @@ HttpParser::Result HttpParser::headersState(QByteArray &data)
                     m_error = QStringLiteral("Can't convert %1 to unsinged long long for \"Content-Length\"")
                                   .arg(headerRegExp.cap(3));
                 }
+            } else if (headerRegExp.cap(2).compare(QLatin1String("Content-Type"), Qt::CaseInsensitive) == 0) {
+                m_contentType = headerRegExp.cap(3);
             }
         } else if (header == QLatin1String("\r\n")) {
             if (m_contentLength != 0) {
                 m_state = &HttpParser::bodyState;
+                const QByteArray boundary = m_formDataMaxPartSize > 0
+                                                ? MultipartParser::boundaryFromContentType(m_contentType)
+                                                : QByteArray();
+                if (!boundary.isEmpty()) {
+                    m_multipartParser = QSharedPointer<MultipartParser>::create(boundary, m_formDataMaxPartSize,
+                                                                                m_formDataInMemoryPartSize);
+                }
                 result = Result::NeedMore;
             } else {
                 result = Result::Success;
@@ -139,16 +177,27 @@ HttpParser::Result HttpParser::headersState(QByteArray &data)
 
 HttpParser::Result HttpParser::bodyState(QByteArray &data)
 {
-    Result result;
-    m_data.append(data);
-    data.clear();
-    if ((qulonglong)m_data.size() > m_contentLength) {
-        m_error = QString();
-        result = Result::Error;
-    } else if ((qulonglong)m_data.size() == m_contentLength) {
-        result = Result::Success;
-    } else {
-        result = Result::NeedMore;
+    // Anything after Content-Length bytes is next request
+    const int bodyPartSize = static_cast<int>(
+        qMin(static_cast<qulonglong>(data.size()), m_contentLength - m_bodyReceived));
+    if (m_multipartParser) {
+        m_bodyReceived += bodyPartSize;
+        MultipartParser::Result multipartResult = m_multipartParser->feed(data.left(bodyPartSize));
+        data.remove(0, bodyPartSize);
+        if (multipartResult == MultipartParser::Result::Error) {
+            m_error = m_multipartParser->error();
+            return Result::Error;
+        }
+        if (m_bodyReceived < m_contentLength)
+            return Result::NeedMore;
+        if (multipartResult == MultipartParser::Result::Finished)
+            return Result::Success;
+        m_error = QStringLiteral("Multipart body has no closing delimiter");
+        return Result::Error;
     }
-    return result;
+
+    m_bodyReceived += bodyPartSize;
+    m_data.append(data.constData(), bodyPartSize);
+    data.remove(0, bodyPartSize);
+    return m_bodyReceived < m_contentLength ? Result::NeedMore : Result::Success;
 }
@@ -0,0 +1,258 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "proofnetwork/localsocketreply_p.h"
+
+#include "proofnetwork/proofnetwork_global.h"
+
+#include <QTimer>
+
+#include <cstring>
+
+static const QByteArray HEAD_END = QByteArrayLiteral("\r\n\r\n");
+
+using namespace Proof;
+
+LocalSocketReply::LocalSocketReply(const QString &socketPath, const QNetworkRequest &request, const QByteArray &verb,
+                                   const QByteArray &body, QObject *parent)
+    : QNetworkReply(parent)
+{
+    setRequest(request);
+    setUrl(request.url());
+    if (verb == "GET")
+        setOperation(QNetworkAccessManager::GetOperation);
+    else if (verb == "POST")
+        setOperation(QNetworkAccessManager::PostOperation);
+    else if (verb == "PUT")
+        setOperation(QNetworkAccessManager::PutOperation);
+    else if (verb == "DELETE")
+        setOperation(QNetworkAccessManager::DeleteOperation);
+    else
+        setOperation(QNetworkAccessManager::CustomOperation);
+    setAttribute(QNetworkRequest::CustomVerbAttribute, verb);
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+
+    const QUrl url = request.url();
+    QByteArray path = url.path(QUrl::FullyEncoded).toLatin1();
+    if (path.isEmpty())
+        path = "/";
+    if (url.hasQuery())
+        path += '?' + url.query(QUrl::FullyEncoded).toLatin1();
+
+    m_requestData.reserve(512 + body.size());
+    m_requestData.append(verb).append(' ').append(path).append(" HTTP/1.1\r\n");
+    m_requestData.append("Host: ").append(url.host().isEmpty() ? QByteArray("localhost") : url.host().toLatin1());
+    m_requestData.append("\r\nConnection: close\r\n");
+    const auto headers = request.rawHeaderList();
+    for (const QByteArray &header : headers)
+        m_requestData.append(header).append(": ").append(request.rawHeader(header)).append("\r\n");
+    if (!body.isEmpty())
+        m_requestData.append("Content-Length: ").append(QByteArray::number(body.size())).append("\r\n");
+    m_requestData.append("\r\n");
+    m_requestData.append(body);
+
+    m_socket = new QLocalSocket(this);
+    connect(m_socket, &QLocalSocket::connected, this, &LocalSocketReply::onConnected);
+    connect(m_socket, &QLocalSocket::readyRead, this, &LocalSocketReply::onReadyRead);
+    connect(m_socket, &QLocalSocket::disconnected, this, &LocalSocketReply::onDisconnected);
+    connect(m_socket, QOverload<QLocalSocket::LocalSocketError>::of(&QLocalSocket::error), this,
+            &LocalSocketReply::onSocketError);
+    m_socket->connectToServer(socketPath);
+}
+
+LocalSocketReply::~LocalSocketReply()
+{}
+
+void LocalSocketReply::abort()
+{
+    if (isFinished())
+        return;
+    failReply(QNetworkReply::OperationCanceledError, QStringLiteral("Operation canceled"));
+}
+
+qint64 LocalSocketReply::bytesAvailable() const
+{
+    return m_content.size() - m_readPosition + QIODevice::bytesAvailable();
+}
+
+bool LocalSocketReply::isSequential() const
+{
+    return true;
+}
+
+qint64 LocalSocketReply::readData(char *data, qint64 maxSize)
+{
+    qint64 size = qMin(maxSize, static_cast<qint64>(m_content.size()) - m_readPosition);
+    if (size <= 0)
+        return isFinished() ? -1 : 0;
+    memcpy(data, m_content.constData() + m_readPosition, static_cast<size_t>(size));
+    m_readPosition += size;
+    return size;
+}
+
+void LocalSocketReply::onConnected()
+{
+    m_socket->write(m_requestData);
+    m_requestData.clear();
+}
+
+void LocalSocketReply::onReadyRead()
+{
+    if (isFinished())
+        return;
+    const QByteArray data = m_socket->readAll();
+    if (!m_headParsed) {
+        m_incoming.append(data);
+        if (m_incoming.indexOf(HEAD_END) < 0)
+            return;
+        if (!parseHead()) {
+            failReply(QNetworkReply::ProtocolFailure, QStringLiteral("Invalid HTTP response"));
+            return;
+        }
+    } else {
+        m_content.append(data);
+    }
+    emit readyRead();
+    if (m_contentLength >= 0 && m_content.size() >= m_contentLength)
+        finishReply();
+}
+
+void LocalSocketReply::onDisconnected()
+{
+    if (isFinished())
+        return;
+    if (m_headParsed && m_contentLength < 0)
+        finishReply();
+    else
+        failReply(QNetworkReply::RemoteHostClosedError, QStringLiteral("Connection closed"));
+}
+
+void LocalSocketReply::onSocketError()
+{
+    if (isFinished() || m_socket->error() == QLocalSocket::PeerClosedError)
+        return;
+    failReply(m_socket->error() == QLocalSocket::ServerNotFoundError ? QNetworkReply::HostNotFoundError
+                                                                      : QNetworkReply::ConnectionRefusedError,
+              m_socket->errorString());
+}
+
+bool LocalSocketReply::parseHead()
+{
+    const int headEnd = m_incoming.indexOf(HEAD_END);
+    const QList<QByteArray> lines = m_incoming.left(headEnd).split('\n');
+    const QByteArray statusLine = lines.first().trimmed();
+    if (!statusLine.startsWith("HTTP/1."))
+        return false;
+    const int codeStart = statusLine.indexOf(' ');
+    if (codeStart < 0)
+        return false;
+    int reasonStart = statusLine.indexOf(' ', codeStart + 1);
+    if (reasonStart < 0)
+        reasonStart = statusLine.size();
+    bool ok = false;
+    const int statusCode = statusLine.mid(codeStart + 1, reasonStart - codeStart - 1).toInt(&ok);
+    if (!ok)
+        return false;
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, statusCode);
+    setAttribute(QNetworkRequest::HttpReasonPhraseAttribute, statusLine.mid(reasonStart + 1));
+
+    for (int i = 1; i < lines.count(); ++i) {
+        const QByteArray &line = lines[i];
+        const int separator = line.indexOf(':');
+        if (separator <= 0)
+            continue;
+        const QByteArray name = line.left(separator).trimmed();
+        const QByteArray value = line.mid(separator + 1).trimmed();
+        setRawHeader(name, value);
+        if (qstricmp(name.constData(), "Content-Length") == 0)
+            m_contentLength = value.toLongLong();
+    }
+
+    m_content = m_incoming.mid(headEnd + HEAD_END.size());
+    m_incoming.clear();
+    m_headParsed = true;
+    return true;
+}
+
+void LocalSocketReply::finishReply()
+{
+    // Same mapping of http statuses to errors as QNetworkAccessManager does
+    const int statusCode = attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QNetworkReply::NetworkError code = QNetworkReply::NoError;
+    if (statusCode >= 400) {
+        switch (statusCode) {
+        case 401:
+            code = QNetworkReply::AuthenticationRequiredError;
+            break;
+        case 403:
+            code = QNetworkReply::ContentAccessDenied;
+            break;
+        case 404:
+            code = QNetworkReply::ContentNotFoundError;
+            break;
+        case 405:
+            code = QNetworkReply::ContentOperationNotPermittedError;
+            break;
+        case 409:
+            code = QNetworkReply::ContentConflictError;
+            break;
+        case 410:
+            code = QNetworkReply::ContentGoneError;
+            break;
+        case 500:
+            code = QNetworkReply::InternalServerError;
+            break;
+        case 501:
+            code = QNetworkReply::OperationNotImplementedError;
+            break;
+        case 503:
+            code = QNetworkReply::ServiceUnavailableError;
+            break;
+        default:
+            code = statusCode < 500 ? QNetworkReply::UnknownContentError : QNetworkReply::UnknownServerError;
+            break;
+        }
+    }
+    if (m_contentLength >= 0 && m_content.size() > m_contentLength)
+        m_content.truncate(static_cast<int>(m_contentLength));
+
+    setFinished(true);
+    m_socket->disconnect(this);
+    m_socket->abort();
+    if (code != QNetworkReply::NoError) {
+        setError(code, attribute(QNetworkRequest::HttpReasonPhraseAttribute).toString());
+        emit error(code);
+    }
+    emit finished();
+}
+
+void LocalSocketReply::failReply(QNetworkReply::NetworkError code, const QString &message)
+{
+    setFinished(true);
+    m_socket->disconnect(this);
+    m_socket->abort();
+    setError(code, message);
+    emit error(code);
+    emit finished();
+}
@@ -0,0 +1,269 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "proofnetwork/multipartparser_p.h"
+
+#include <QBuffer>
+#include <QTemporaryFile>
+
+static constexpr int MAX_PART_HEADERS_SIZE = 16 * 1024;
+
+using namespace Proof;
+
+namespace {
+// Splits header value like 'form-data; name="a"; filename="b;c.txt"' into parameters, semicolons in quotes are kept
+QHash<QString, QString> headerParams(const QString &value)
+{
+    QHash<QString, QString> result;
+    QStringList items;
+    QString current;
+    bool quoted = false;
+    for (int i = 0; i < value.size(); ++i) {
+        const QChar c = value[i];
+        if (c == '"') {
+            quoted = !quoted;
+        } else if (c == '\\' && quoted && i + 1 < value.size()) {
+            current += value[++i];
+            continue;
+        } else if (c == ';' && !quoted) {
+            items << current;
+            current.clear();
+            continue;
+        }
+        current += c;
+    }
+    items << current;
+
+    for (const QString &item : qAsConst(items)) {
+        const int equalsIndex = item.indexOf('=');
+        if (equalsIndex < 0)
+            continue;
+        QString paramValue = item.mid(equalsIndex + 1).trimmed();
+        if (paramValue.size() >= 2 && paramValue.startsWith('"') && paramValue.endsWith('"'))
+            paramValue = paramValue.mid(1, paramValue.size() - 2);
+        result[item.left(equalsIndex).trimmed().toLower()] = paramValue;
+    }
+    return result;
+}
+} // namespace
+
+MultipartParser::MultipartParser(const QByteArray &boundary, qint64 maxPartSize, qint64 inMemoryPartSize)
+    : m_delimiter("\r\n--" + boundary), m_maxPartSize(maxPartSize), m_inMemoryPartSize(inMemoryPartSize)
+{
+    // First delimiter can be at the very beginning of body without preceding line break
+    m_buffer = QByteArrayLiteral("\r\n");
+}
+
+MultipartParser::Result MultipartParser::feed(const QByteArray &data)
+{
+    m_buffer.append(data);
+    Result result;
+    State previousState;
+    do {
+        previousState = m_state;
+        result = (this->*m_state)();
+    } while (result == Result::NeedMore && m_state != previousState);
+    return result;
+}
+
+QVector<RestFormDataPart> MultipartParser::parts() const
+{
+    return m_parts;
+}
+
+QString MultipartParser::error() const
+{
+    return m_error;
+}
+
+QByteArray MultipartParser::boundaryFromContentType(const QString &contentType)
+{
+    if (!contentType.trimmed().startsWith(QLatin1String("multipart/form-data"), Qt::CaseInsensitive))
+        return QByteArray();
+    return headerParams(contentType).value(QStringLiteral("boundary")).toLatin1();
+}
+
+MultipartParser::Result MultipartParser::preambleState()
+{
+    const int delimiterIndex = m_buffer.indexOf(m_delimiter);
+    if (delimiterIndex < 0) {
+        m_buffer.remove(0, qMax(0, m_buffer.size() - m_delimiter.size() + 1));
+        return Result::NeedMore;
+    }
+    m_buffer.remove(0, delimiterIndex + m_delimiter.size());
+    m_state = &MultipartParser::delimiterEndState;
+    return Result::NeedMore;
+}
+
+MultipartParser::Result MultipartParser::delimiterEndState()
+{
+    // Transport padding is allowed between delimiter and line break
+    int paddingSize = 0;
+    while (paddingSize < m_buffer.size() && (m_buffer[paddingSize] == ' ' || m_buffer[paddingSize] == '\t'))
+        ++paddingSize;
+    m_buffer.remove(0, paddingSize);
+    if (m_buffer.size() < 2)
+        return Result::NeedMore;
+
+    if (m_buffer.startsWith("--")) {
+        m_buffer.clear();
+        m_state = &MultipartParser::finishedState;
+        return Result::Finished;
+    }
+    if (!m_buffer.startsWith("\r\n"))
+        return fail(QStringLiteral("Invalid multipart delimiter"));
+    m_buffer.remove(0, 2);
+    m_state = &MultipartParser::headersState;
+    return Result::NeedMore;
+}
+
+MultipartParser::Result MultipartParser::headersState()
+{
+    int headersSize = 0;
+    if (!m_buffer.startsWith("\r\n")) {
+        headersSize = m_buffer.indexOf("\r\n\r\n");
+        if (headersSize < 0) {
+            if (m_buffer.size() > MAX_PART_HEADERS_SIZE)
+                return fail(QStringLiteral("Multipart part headers are too big"));
+            return Result::NeedMore;
+        }
+    }
+
+    if (m_parts.count() >= MAX_PARTS_COUNT)
+        return fail(QStringLiteral("Multipart body has more than %1 parts").arg(MAX_PARTS_COUNT));
+
+    m_currentPart = RestFormDataPart();
+    const QStringList headers = headersSize ? QString::fromUtf8(m_buffer.constData(), headersSize)
+                                                  .split(QStringLiteral("\r\n"), QString::SkipEmptyParts)
+                                            : QStringList();
+    m_buffer.remove(0, headersSize + 2 + (headersSize ? 2 : 0));
+    for (const QString &header : headers) {
+        const int colonIndex = header.indexOf(':');
+        if (colonIndex < 0)
+            return fail(QStringLiteral("Invalid multipart part header: %1").arg(header));
+        const QString name = header.left(colonIndex).trimmed();
+        const QString value = header.mid(colonIndex + 1).trimmed();
+        m_currentPart.headers << QStringLiteral("%1: %2").arg(name, value);
+        if (name.compare(QLatin1String("Content-Disposition"), Qt::CaseInsensitive) == 0) {
+            const auto params = headerParams(value);
+            m_currentPart.name = params.value(QStringLiteral("name"));
+            m_currentPart.fileName = params.value(QStringLiteral("filename"));
+        } else if (name.compare(QLatin1String("Content-Type"), Qt::CaseInsensitive) == 0) {
+            m_currentPart.contentType = value;
+        }
+    }
+
+    auto buffer = new QBuffer;
+    buffer->open(QIODevice::ReadWrite);
+    m_currentPart.data = QSharedPointer<QIODevice>(buffer);
+    m_state = &MultipartParser::dataState;
+    return Result::NeedMore;
+}
+
+MultipartParser::Result MultipartParser::dataState()
+{
+    const int delimiterIndex = m_buffer.indexOf(m_delimiter);
+    if (delimiterIndex < 0) {
+        // Tail can be a beginning of delimiter, it is kept until next chunk arrives
+        const int safeSize = m_buffer.size() - m_delimiter.size() + 1;
+        if (safeSize > 0) {
+            if (!writePartData(m_buffer.constData(), safeSize))
+                return Result::Error;
+            m_buffer.remove(0, safeSize);
+        }
+        return Result::NeedMore;
+    }
+
+    if (!writePartData(m_buffer.constData(), delimiterIndex) || !finishPart())
+        return Result::Error;
+    m_buffer.remove(0, delimiterIndex + m_delimiter.size());
+    m_state = &MultipartParser::delimiterEndState;
+    return Result::NeedMore;
+}
+
+MultipartParser::Result MultipartParser::finishedState()
+{
+    // Epilogue is ignored
+    m_buffer.clear();
+    return Result::Finished;
+}
+
+MultipartParser::Result MultipartParser::errorState()
+{
+    m_buffer.clear();
+    return Result::Error;
+}
+
+MultipartParser::Result MultipartParser::fail(const QString &error)
+{
+    m_error = error;
+    m_currentPart = RestFormDataPart();
+    m_parts.clear();
+    m_inMemoryPartsSize = 0;
+    m_state = &MultipartParser::errorState;
+    return Result::Error;
+}
+
+bool MultipartParser::writePartData(const char *data, int size)
+{
+    if (!size)
+        return true;
+    m_currentPart.size += size;
+    if (m_currentPart.size > m_maxPartSize) {
+        fail(QStringLiteral("Multipart part is bigger than %1 bytes").arg(m_maxPartSize));
+        return false;
+    }
+
+    const bool overBudget = m_inMemoryPartsSize + m_currentPart.size
+                            > IN_MEMORY_PARTS_BUDGET_FACTOR * m_inMemoryPartSize;
+    if ((m_currentPart.size > m_inMemoryPartSize || overBudget)
+        && qobject_cast<QBuffer *>(m_currentPart.data.data())) {
+        auto file = new QTemporaryFile;
+        if (!file->open()) {
+            delete file;
+            fail(QStringLiteral("Can't create temporary file for multipart part"));
+            return false;
+        }
+        file->write(static_cast<QBuffer *>(m_currentPart.data.data())->data());
+        m_currentPart.data = QSharedPointer<QIODevice>(file);
+    }
+    if (m_currentPart.data->write(data, size) != size) {
+        fail(QStringLiteral("Can't store multipart part: %1").arg(m_currentPart.data->errorString()));
+        return false;
+    }
+    return true;
+}
+
+bool MultipartParser::finishPart()
+{
+    if (!m_currentPart.data->seek(0)) {
+        fail(QStringLiteral("Can't rewind multipart part: %1").arg(m_currentPart.data->errorString()));
+        return false;
+    }
+    if (qobject_cast<QBuffer *>(m_currentPart.data.data()))
+        m_inMemoryPartsSize += m_currentPart.size;
+    m_parts << m_currentPart;
+    m_currentPart = RestFormDataPart();
+    return true;
+}
@@ -28,11 +28,13 @@
 #include "proofcore/settings.h"
 #include "proofcore/settingsgroup.h"
 
+#include "proofnetwork/abstractrestserver.h"
 #include "proofnetwork/apicall.h"
 #include "proofnetwork/emailnotificationhandler.h"
 #include "proofnetwork/proofnetwork_global.h"
 #include "proofnetwork/proofnetwork_types.h"
 #include "proofnetwork/proofservicerestapi.h"
+#include "proofnetwork/restclient.h"
 #include "proofnetwork/smtpclient.h"
 
 #include "3rdparty/qamqp/src/qamqpglobal.h"
@@ -46,12 +48,52 @@ PROOF_LIBRARY_INITIALIZER(libraryInit)
     // clang-format off
     qRegisterMetaType<Proof::RestApiError>("Proof::RestApiError");
     qRegisterMetaType<Proof::RestAuthType>("Proof::RestAuthType");
+    qRegisterMetaType<Proof::RestRequestPriority>("Proof::RestRequestPriority");
+    qRegisterMetaType<Proof::RestConnection>("Proof::RestConnection");
     qRegisterMetaType<QAbstractSocket::SocketError>("QAbstractSocket::SocketError");
     qRegisterMetaType<QAMQP::Error>("QAMQP::Error");
     qRegisterMetaType<Proof::NetworkServices::VersionedEntityType>("Proof::NetworkServices::ApplicationType");
     // clang-format on
 
     Proof::CoreApplication::addInitializer([]() {
+        Proof::SettingsGroup *networkGroup = proofApp->settings()->group(QStringLiteral("network"),
+                                                                         Proof::Settings::NotFoundPolicy::Add);
+        Proof::RestClient::setDefaultHostConcurrencyLimit(
+            networkGroup
+                ->value(QStringLiteral("default_host_concurrency"), Proof::RestClient::defaultHostConcurrencyLimit(),
+                        Proof::Settings::NotFoundPolicy::AddGlobal)
+                .toInt());
+        Proof::RestClient::setNetworkThreadsCount(
+            networkGroup
+                ->value(QStringLiteral("threads"), Proof::RestClient::networkThreadsCount(),
+                        Proof::Settings::NotFoundPolicy::AddGlobal)
+                .toInt());
+        qint64 httpCacheMemoryBudget = networkGroup
+                                           ->value(QStringLiteral("http_cache_memory_budget"), 0,
+                                                   Proof::Settings::NotFoundPolicy::AddGlobal)
+                                           .toLongLong();
+        QString httpCacheDirectory = networkGroup->value(QStringLiteral("http_cache_directory"), QString()).toString();
+        if (httpCacheMemoryBudget > 0 || !httpCacheDirectory.isEmpty()) {
+            Proof::RestClient::setupHttpCache(
+                httpCacheMemoryBudget, httpCacheDirectory,
+                networkGroup->value(QStringLiteral("http_cache_disk_budget"), 50 * 1024 * 1024).toLongLong());
+        }
+        Proof::SettingsGroup *hostsConcurrencyGroup = networkGroup->group(QStringLiteral("host_concurrency"));
+        if (hostsConcurrencyGroup) {
+            const auto hosts = hostsConcurrencyGroup->values();
+            for (const QString &host : hosts)
+                Proof::RestClient::setHostConcurrencyLimit(host, hostsConcurrencyGroup->value(host).toInt());
+        }
+        bool adaptiveConcurrency = networkGroup
+                                       ->value(QStringLiteral("adaptive_concurrency"), false,
+                                               Proof::Settings::NotFoundPolicy::AddGlobal)
+                                       .toBool();
+        if (adaptiveConcurrency) {
+            Proof::RestClient::setAdaptiveConcurrencyEnabled(
+                true, networkGroup->value(QStringLiteral("adaptive_concurrency_min"), 1).toInt(),
+                networkGroup->value(QStringLiteral("adaptive_concurrency_max"), 64).toInt());
+        }
+
         Proof::SettingsGroup *notifierGroup = proofApp->settings()->group(QStringLiteral("error_notifier"),
                                                                           Proof::Settings::NotFoundPolicy::Add);
 
@@ -0,0 +1,105 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "proofnetwork/ratelimiter_p.h"
+
+#include <algorithm>
+#include <cmath>
+
+static constexpr quint64 TOKEN_COST = 1000;
+static constexpr quint64 TOKENS_MASK = 0xFFFFFFFF;
+
+using namespace Proof;
+
+RateLimiter::RateLimiter()
+{
+    for (auto &bucket : m_buckets) {
+        bucket.key.store(0, std::memory_order_relaxed);
+        bucket.state.store(0, std::memory_order_relaxed);
+    }
+    m_timer.start();
+}
+
+qint64 RateLimiter::acquire(quint64 key, double requestsPerSecond, int burst)
+{
+    if (requestsPerSecond <= 0.0 || burst <= 0)
+        return 0;
+
+    // Zero is reserved for buckets that were never touched yet
+    const quint32 now = static_cast<quint32>(m_timer.elapsed()) + 1;
+    const quint64 capacity = static_cast<quint64>(burst) * TOKEN_COST;
+    std::atomic<quint64> &bucket = findState(key ? key : 1, now);
+
+    quint64 oldState = bucket.load(std::memory_order_relaxed);
+    forever {
+        quint64 tokens = capacity;
+        if (oldState) {
+            // Unsigned arithmetic handles timer wraparound
+            const quint32 passed = now - static_cast<quint32>(oldState >> 32);
+            const quint64 refill = static_cast<quint64>(passed * requestsPerSecond);
+            tokens = std::min(capacity, (oldState & TOKENS_MASK) + refill);
+        }
+
+        qint64 waitTime = 0;
+        if (tokens >= TOKEN_COST)
+            tokens -= TOKEN_COST;
+        else
+            waitTime = std::max<qint64>(1, static_cast<qint64>(std::ceil((TOKEN_COST - tokens) / requestsPerSecond)));
+
+        const quint64 newState = (static_cast<quint64>(now) << 32) | tokens;
+        if (bucket.compare_exchange_weak(oldState, newState, std::memory_order_relaxed))
+            return waitTime;
+    }
+}
+
+std::atomic<quint64> &RateLimiter::findState(quint64 key, quint32 now)
+{
+    const int start = static_cast<int>(key % BUCKETS_COUNT);
+    forever {
+        int leastRecentlyUsed = start;
+        quint32 longestIdle = 0;
+        quint64 leastRecentlyUsedKey = 0;
+        for (int i = 0; i < PROBES_COUNT; ++i) {
+            Bucket &bucket = m_buckets[(start + i) % BUCKETS_COUNT];
+            quint64 bucketKey = bucket.key.load(std::memory_order_relaxed);
+            if (!bucketKey && bucket.key.compare_exchange_strong(bucketKey, key, std::memory_order_relaxed))
+                return bucket.state;
+            if (bucketKey == key)
+                return bucket.state;
+            const quint32 idle = now - static_cast<quint32>(bucket.state.load(std::memory_order_relaxed) >> 32);
+            if (idle >= longestIdle) {
+                longestIdle = idle;
+                leastRecentlyUsed = (start + i) % BUCKETS_COUNT;
+                leastRecentlyUsedKey = bucketKey;
+            }
+        }
+
+        // Request for replaced key that is already in flight can take one token from new owner, it is acceptable
+        Bucket &bucket = m_buckets[leastRecentlyUsed];
+        if (bucket.key.compare_exchange_strong(leastRecentlyUsedKey, key, std::memory_order_relaxed)) {
+            bucket.state.store(0, std::memory_order_relaxed);
+            return bucket.state;
+        }
+    }
+}
@@ -0,0 +1,90 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "proofnetwork/requestcancellation_p.h"
+
+using namespace Proof;
+
+static thread_local QSharedPointer<RequestCancellation> currentCancellation;
+
+RequestCancellation::Scope::Scope(const QSharedPointer<RequestCancellation> &cancellation)
+    : m_previous(currentCancellation)
+{
+    currentCancellation = cancellation;
+}
+
+RequestCancellation::Scope::~Scope()
+{
+    currentCancellation = m_previous;
+}
+
+bool RequestCancellation::isCanceled() const
+{
+    return m_canceled;
+}
+
+void RequestCancellation::addCallback(std::function<void()> &&callback)
+{
+    m_lock.lock();
+    if (!m_canceled && !m_finished) {
+        m_callbacks.push_back(std::move(callback));
+        m_lock.unlock();
+        return;
+    }
+    const bool canceled = m_canceled;
+    m_lock.unlock();
+    if (canceled)
+        callback();
+}
+
+bool RequestCancellation::cancel()
+{
+    m_lock.lock();
+    if (m_canceled || m_finished) {
+        m_lock.unlock();
+        return false;
+    }
+    m_canceled = true;
+    std::vector<std::function<void()>> callbacks;
+    callbacks.swap(m_callbacks);
+    m_lock.unlock();
+
+    for (const auto &callback : callbacks)
+        callback();
+    return true;
+}
+
+void RequestCancellation::finish()
+{
+    std::vector<std::function<void()>> callbacks;
+    m_lock.lock();
+    m_finished = true;
+    callbacks.swap(m_callbacks);
+    m_lock.unlock();
+}
+
+QSharedPointer<RequestCancellation> RequestCancellation::current()
+{
+    return currentCancellation;
+}
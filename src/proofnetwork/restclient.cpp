@@ -24,6 +24,10 @@
  */
 #include "proofnetwork/restclient.h"
 
+#include "proofnetwork/httpcache_p.h"
+#include "proofnetwork/localsocketreply_p.h"
+#include "proofnetwork/requestcancellation_p.h"
+
 #include "proofcore/coreapplication.h"
 #include "proofcore/proofglobal.h"
 #include "proofcore/proofobject_p.h"
@@ -32,17 +36,46 @@
 #include <QBuffer>
 #include <QCryptographicHash>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QHttpMultiPart>
 #include <QJsonObject>
-#include <QJsonParseError>
 #include <QNetworkInterface>
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QPointer>
 #include <QThread>
 #include <QTimer>
 #include <QUuid>
+#include <QVariantMap>
+#include <QtMath>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
 
 static const int DEFAULT_REPLY_TIMEOUT = 5 * 60 * 1000; //5 minutes
+static const char *const TIMED_OUT_PROPERTY = "proof_timed_out";
+static constexpr int DEFAULT_HOST_CONCURRENCY_LIMIT = 6;
+// Network interfaces are re-enumerated at most once per this period
+static constexpr qint64 IP_ADDRESSES_REFRESH_PERIOD = 30000;
+static constexpr int PRIORITIES_COUNT = static_cast<int>(Proof::RestRequestPriority::Interactive) + 1;
+// Lower priority request is sent anyway after being passed over this many times
+static constexpr int PRIORITY_STARVATION_LIMIT = 8;
+static constexpr int DEFAULT_ADAPTIVE_MIN_LIMIT = 1;
+static constexpr int DEFAULT_ADAPTIVE_MAX_LIMIT = 64;
+// Window is cut in half on overload errors and a bit softer on latency growth
+static constexpr double ADAPTIVE_OVERLOAD_BACKOFF = 0.5;
+static constexpr double ADAPTIVE_LATENCY_BACKOFF = 0.9;
+// Latency is considered grown if it is bigger than baseline * tolerance + slack
+static constexpr double ADAPTIVE_LATENCY_TOLERANCE = 2.0;
+static constexpr qint64 ADAPTIVE_LATENCY_SLACK = 5;
+// Baseline latency is EWMA of medians of this many last samples, so single fast route doesn't pin it down
+// and it can follow backend getting slower
+static constexpr int ADAPTIVE_BASELINE_PERIOD = 32;
+// Adaptive state of host without replies for this long is dropped, idle hosts are looked for at most once per period
+static constexpr qint64 ADAPTIVE_IDLE_TIMEOUT = 10 * 60 * 1000;
+static constexpr double ADAPTIVE_BASELINE_SMOOTHING = 0.25;
 
 namespace Proof {
 class NetworkScheduler
@@ -50,17 +83,19 @@ class NetworkScheduler
 public:
     NetworkScheduler()
     {
-        qnam = new QNetworkAccessManager;
-        qnamThread = new QThread();
-        qnamThread->start();
-        qnam->moveToThread(qnamThread);
+        shards.append(createShard(nullptr));
+        qnam = shards.first().qnam;
+        qnamThread = shards.first().thread;
+        clock.start();
     }
     ~NetworkScheduler()
     {
-        qnam->deleteLater();
-        qnamThread->quit();
-        qnamThread->wait(250);
-        delete qnamThread;
+        for (const auto &shard : qAsConst(shards)) {
+            shard.qnam->deleteLater();
+            shard.thread->quit();
+            shard.thread->wait(250);
+            delete shard.thread;
+        }
     }
 
     static NetworkScheduler *instance()
@@ -69,22 +104,110 @@ public:
         return &i;
     }
 
-    CancelableFuture<QNetworkReply *> addRequest(const QString &host,
+    CancelableFuture<QNetworkReply *> addRequest(QNetworkAccessManager *manager, const QString &host,
+                                                 RestRequestPriority priority,
                                                  std::function<QNetworkReply *(QNetworkAccessManager *)> &&request);
 
+    // Round-robin over network threads
+    QNetworkAccessManager *acquireManager();
+    int threadsCount() const;
+    void setThreadsCount(int count);
+    QSharedPointer<HttpCacheStorage> httpCache() const;
+    void setHttpCache(const QSharedPointer<HttpCacheStorage> &storage);
+
+    int defaultLimit() const;
+    void setDefaultLimit(int limit);
+    int hostLimit(const QString &host) const;
+    void setHostLimit(const QString &host, int limit);
+    QVariantMap statistics() const;
+    bool adaptiveEnabled() const;
+    void setAdaptiveEnabled(bool enabled, int minLimit, int maxLimit);
+
+    // Scheduling itself always happens in first network thread
     QNetworkAccessManager *qnam = nullptr;
     QThread *qnamThread = nullptr;
 
 private:
-    using RequestDescriptor = std::pair<QString, std::function<void()>>;
+    struct Shard
+    {
+        QThread *thread;
+        QNetworkAccessManager *qnam;
+    };
 
-    void schedule();
-    void decreaseUsage(const QString &host);
+    static Shard createShard(const QSharedPointer<HttpCacheStorage> &httpCache);
+    void installHttpCache(QNetworkAccessManager *manager, const QSharedPointer<HttpCacheStorage> &storage);
+
+    struct HostQueue
+    {
+        std::function<void()> takeNext();
+
+        // FIFO per priority class
+        std::array<std::deque<std::function<void()>>, PRIORITIES_COUNT> requests;
+        std::array<int, PRIORITIES_COUNT> bypassed = {};
+        int queued = 0;
+        int usage = 0;
+        int limit = 0;
+        bool isReady = false;
+    };
+
+    struct AdaptiveLimit
+    {
+        double window = 0.0;
+        double baselineLatency = -1.0;
+        std::array<qint64, ADAPTIVE_BASELINE_PERIOD> periodLatencies = {};
+        int periodSamples = 0;
+        qint64 lastDecreaseAt = -1;
+        qint64 lastActivityAt = 0;
+    };
+
+    struct ReplySample
+    {
+        qint64 startedAt = 0;
+        qint64 latency = 0;
+        bool overloaded = false;
+        bool valid = false;
+    };
 
-    std::list<RequestDescriptor> requests;
-    QHash<QString, int> usages;
-    const int limit = 6;
-    SpinLock requestsLock;
+    static ReplySample sampleReply(QNetworkReply *reply, qint64 startedAt, qint64 finishedAt);
+
+    void schedule();
+    void decreaseUsage(const QString &host, const ReplySample &sample = ReplySample());
+    // Must be called under lock
+    bool canSend(const QString &host, const HostQueue &queue) const;
+    void markReadyIfPossible(const QString &host, HostQueue &queue);
+    void eraseIfIdle(QHash<QString, HostQueue>::iterator queueIt);
+    void updateLimits();
+    int effectiveLimit(const QString &host);
+    void evictIdleAdaptiveLimits();
+    void adaptLimit(const QString &host, HostQueue &queue, const ReplySample &sample);
+
+    // Each host has its own FIFO queue per priority class, hosts that have queued requests and are under limit are
+    // kept in ready ring (each at most once), so both dispatch and completion take constant time and hosts are served
+    // round-robin. Requests without host are not limited
+    QHash<QString, HostQueue> hosts;
+    std::deque<QString> readyHosts;
+    qint64 queuedCount = 0;
+    int m_defaultLimit = DEFAULT_HOST_CONCURRENCY_LIMIT;
+    QHash<QString, int> hostLimits;
+    // AIMD window per host, used instead of default limit when adaptive mode is on.
+    // Kept after host queue is gone, so window and baseline survive pauses between requests,
+    // and dropped only after host is idle for ADAPTIVE_IDLE_TIMEOUT
+    bool m_adaptiveEnabled = false;
+    int m_adaptiveMinLimit = DEFAULT_ADAPTIVE_MIN_LIMIT;
+    int m_adaptiveMaxLimit = DEFAULT_ADAPTIVE_MAX_LIMIT;
+    QHash<QString, AdaptiveLimit> adaptiveLimits;
+    qint64 lastAdaptiveEvictionAt = 0;
+    QElapsedTimer clock;
+    mutable SpinLock requestsLock;
+
+    // Each shard is a thread with its own QNetworkAccessManager, clients are assigned to them on creation.
+    // Shards are never removed, so managers given to clients stay valid
+    QVector<Shard> shards;
+    int m_threadsCount = 1;
+    int nextShard = 0;
+    // Each shard manager has its own cache facade over this storage
+    QSharedPointer<HttpCacheStorage> m_httpCache;
+    mutable SpinLock shardsLock;
 };
 
 class RestClientPrivate : public ProofObjectPrivate
@@ -92,16 +215,24 @@ class RestClientPrivate : public ProofObjectPrivate
     Q_DECLARE_PUBLIC(RestClient)
 public:
     QUrl createUrl(QString method, const QUrlQuery &query) const;
-    QNetworkRequest createNetworkRequest(const QUrl &url, const QByteArray &body, const QString &vendor);
+    QNetworkRequest createNetworkRequest(const QUrl &url, const RestRequestBody &body, const QString &vendor);
+    QNetworkReply *sendLocalRequest(QNetworkAccessManager *qnam, const QString &socketPath, const QByteArray &verb,
+                                    const QNetworkRequest &request, const QByteArray &body = QByteArray()) const;
+    QString schedulerKey() const;
     QByteArray generateWsseToken() const;
+    void updateHeadersTemplate();
+    static RestRequestBody::Type guessBodyType(const QByteArray &data);
+    static QByteArray ipAddressesHeader();
 
     void handleReply(QNetworkReply *reply);
     void cleanupReplyHandler(QNetworkReply *reply);
     void cleanupAll();
     QPair<QString, QString> parseHost(const QString &host);
 
+    QNetworkAccessManager *manager = nullptr;
     bool ignoreSslErrors = false;
     bool followRedirects = true;
+    bool httpCacheEnabled = false;
     bool explicitPort = false;
     int port = 443;
     RestAuthType authType = RestAuthType::NoAuth;
@@ -112,10 +243,16 @@ public:
     QString host;
     QString postfix;
     QString token;
+    QString localSocketPath;
     QString scheme = QStringLiteral("https");
     QHash<QNetworkReply *, QTimer *> replyTimeouts;
     QHash<QByteArray, QByteArray> customHeaders;
     QHash<QString, QNetworkCookie> cookies;
+
+    // Headers that don't depend on request itself, rebuilt in client thread on next request after any of related
+    // properties is changed
+    QNetworkRequest headersTemplate;
+    std::atomic_bool headersTemplateDirty{true};
 };
 
 } // namespace Proof
@@ -125,7 +262,8 @@ using namespace Proof;
 RestClient::RestClient(bool ignoreSslErrors) : ProofObject(*new RestClientPrivate)
 {
     Q_D(RestClient);
-    moveToThread(NetworkScheduler::instance()->qnamThread);
+    d->manager = NetworkScheduler::instance()->acquireManager();
+    moveToThread(d->manager->thread());
     d->ignoreSslErrors = ignoreSslErrors;
 }
 
@@ -146,6 +284,7 @@ void RestClient::setUserName(const QString &arg)
     Q_D(RestClient);
     if (d->userName != arg) {
         d->userName = arg;
+        d->headersTemplateDirty = true;
         emit userNameChanged(arg);
     }
 }
@@ -161,6 +300,7 @@ void RestClient::setPassword(const QString &arg)
     Q_D(RestClient);
     if (d->password != arg) {
         d->password = arg;
+        d->headersTemplateDirty = true;
         emit passwordChanged(arg);
     }
 }
@@ -176,6 +316,7 @@ void RestClient::setClientName(const QString &arg)
     Q_D(RestClient);
     if (d->clientName != arg) {
         d->clientName = arg;
+        d->headersTemplateDirty = true;
         emit clientNameChanged(arg);
     }
 }
@@ -254,6 +395,7 @@ void RestClient::setToken(const QString &arg)
     Q_D(RestClient);
     if (d->token != arg) {
         d->token = arg;
+        d->headersTemplateDirty = true;
         emit tokenChanged(arg);
     }
 }
@@ -269,6 +411,7 @@ void RestClient::setAuthType(RestAuthType arg)
     Q_D(RestClient);
     if (d->authType != arg) {
         d->authType = arg;
+        d->headersTemplateDirty = true;
         emit authTypeChanged(arg);
     }
 }
@@ -288,6 +431,21 @@ void RestClient::setMsecsForTimeout(int arg)
     }
 }
 
+QString RestClient::localSocketPath() const
+{
+    Q_D_CONST(RestClient);
+    return d->localSocketPath;
+}
+
+void RestClient::setLocalSocketPath(const QString &arg)
+{
+    Q_D(RestClient);
+    if (d->localSocketPath != arg) {
+        d->localSocketPath = arg;
+        emit localSocketPathChanged(arg);
+    }
+}
+
 bool RestClient::followRedirects() const
 {
     Q_D_CONST(RestClient);
@@ -299,14 +457,32 @@ void RestClient::setFollowRedirects(bool arg)
     Q_D(RestClient);
     if (d->followRedirects != arg) {
         d->followRedirects = arg;
+        d->headersTemplateDirty = true;
         emit followRedirectsChanged(arg);
     }
 }
 
+bool RestClient::httpCacheEnabled() const
+{
+    Q_D_CONST(RestClient);
+    return d->httpCacheEnabled;
+}
+
+void RestClient::setHttpCacheEnabled(bool arg)
+{
+    Q_D(RestClient);
+    if (d->httpCacheEnabled != arg) {
+        d->httpCacheEnabled = arg;
+        d->headersTemplateDirty = true;
+        emit httpCacheEnabledChanged(arg);
+    }
+}
+
 void RestClient::setCustomHeader(const QByteArray &header, const QByteArray &value)
 {
     Q_D(RestClient);
     d->customHeaders[header] = value;
+    d->headersTemplateDirty = true;
 }
 
 QByteArray RestClient::customHeader(const QByteArray &header) const
@@ -325,12 +501,14 @@ void RestClient::unsetCustomHeader(const QByteArray &header)
 {
     Q_D(RestClient);
     d->customHeaders.remove(header);
+    d->headersTemplateDirty = true;
 }
 
 void RestClient::setCookie(const QNetworkCookie &cookie)
 {
     Q_D(RestClient);
     d->cookies[cookie.name()] = cookie;
+    d->headersTemplateDirty = true;
 }
 
 QNetworkCookie RestClient::cookie(const QString &name) const
@@ -349,111 +527,150 @@ void RestClient::unsetCookie(const QString &name)
 {
     Q_D(RestClient);
     d->cookies.remove(name);
+    d->headersTemplateDirty = true;
 }
 
-CancelableFuture<QNetworkReply *> RestClient::get(const QString &method, const QUrlQuery &query, const QString &vendor)
+CancelableFuture<QNetworkReply *> RestClient::get(const QString &method, const QUrlQuery &query, const QString &vendor,
+                                                  RestRequestPriority priority)
 {
     Q_D(RestClient);
     qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces);
 
-    return NetworkScheduler::instance()->addRequest(d->host, [d, method, query, vendor](QNetworkAccessManager *qnam) {
-        qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces) << "started";
-        QNetworkReply *reply = qnam->get(d->createNetworkRequest(d->createUrl(method, query), QByteArray(), vendor));
-        d->handleReply(reply);
-        return reply;
-    });
+    QString socketPath = d->localSocketPath;
+    return NetworkScheduler::instance()->addRequest(
+        d->manager, d->schedulerKey(), priority, [d, method, query, vendor, socketPath](QNetworkAccessManager *qnam) {
+            qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces) << "started";
+            QNetworkRequest request = d->createNetworkRequest(d->createUrl(method, query), QByteArray(), vendor);
+            QNetworkReply *reply = socketPath.isEmpty() ? qnam->get(request)
+                                                        : d->sendLocalRequest(qnam, socketPath, "GET", request);
+            d->handleReply(reply);
+            return reply;
+        });
 }
 
 CancelableFuture<QNetworkReply *> RestClient::post(const QString &method, const QUrlQuery &query,
-                                                   const QByteArray &body, const QString &vendor)
+                                                   const RestRequestBody &body, const QString &vendor,
+                                                   RestRequestPriority priority)
 {
     Q_D(RestClient);
     qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces);
 
-    return NetworkScheduler::instance()->addRequest(d->host, [d, method, query, body, vendor](QNetworkAccessManager *qnam) {
-        qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces) << "started";
-        QNetworkReply *reply = qnam->post(d->createNetworkRequest(d->createUrl(method, query), body, vendor), body);
-        d->handleReply(reply);
-        return reply;
-    });
+    QString socketPath = d->localSocketPath;
+    return NetworkScheduler::instance()->addRequest(
+        d->manager, d->schedulerKey(), priority,
+        [d, method, query, body, vendor, socketPath](QNetworkAccessManager *qnam) {
+            qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces) << "started";
+            QNetworkRequest request = d->createNetworkRequest(d->createUrl(method, query), body, vendor);
+            QNetworkReply *reply = socketPath.isEmpty()
+                                       ? qnam->post(request, body.data)
+                                       : d->sendLocalRequest(qnam, socketPath, "POST", request, body.data);
+            d->handleReply(reply);
+            return reply;
+        });
 }
 
 CancelableFuture<QNetworkReply *> RestClient::post(const QString &method, const QUrlQuery &query,
-                                                   QHttpMultiPart *multiParts)
+                                                   QHttpMultiPart *multiParts, RestRequestPriority priority)
 {
     Q_D(RestClient);
     qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces);
 
-    return NetworkScheduler::instance()->addRequest(d->host, [d, method, query, multiParts](QNetworkAccessManager *qnam) {
-        qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces) << "started";
-        QNetworkRequest request = d->createNetworkRequest(d->createUrl(method, query), QByteArray(), QString());
-        request.setHeader(QNetworkRequest::KnownHeaders::ContentTypeHeader,
-                          QStringLiteral("multipart/form-data; boundary=%1").arg(QString(multiParts->boundary())));
-        QNetworkReply *reply = qnam->post(request, multiParts);
-        qCDebug(proofNetworkMiscLog) << request.header(QNetworkRequest::KnownHeaders::ContentTypeHeader).toString();
-        multiParts->setParent(reply);
-        d->handleReply(reply);
-        return reply;
-    });
+    if (!d->localSocketPath.isEmpty())
+        qCWarning(proofNetworkMiscLog) << "Multipart requests are not supported over local socket, sending via"
+                                       << d->host;
+    return NetworkScheduler::instance()->addRequest(
+        d->manager, d->host, priority, [d, method, query, multiParts](QNetworkAccessManager *qnam) {
+            qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces) << "started";
+            QNetworkRequest request = d->createNetworkRequest(d->createUrl(method, query), QByteArray(), QString());
+            request.setHeader(QNetworkRequest::KnownHeaders::ContentTypeHeader,
+                              QStringLiteral("multipart/form-data; boundary=%1").arg(QString(multiParts->boundary())));
+            QNetworkReply *reply = qnam->post(request, multiParts);
+            qCDebug(proofNetworkMiscLog) << request.header(QNetworkRequest::KnownHeaders::ContentTypeHeader).toString();
+            multiParts->setParent(reply);
+            d->handleReply(reply);
+            return reply;
+        });
 }
 
-CancelableFuture<QNetworkReply *> RestClient::put(const QString &method, const QUrlQuery &query, const QByteArray &body,
-                                                  const QString &vendor)
+CancelableFuture<QNetworkReply *> RestClient::put(const QString &method, const QUrlQuery &query,
+                                                  const RestRequestBody &body, const QString &vendor,
+                                                  RestRequestPriority priority)
 {
     Q_D(RestClient);
     qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces);
 
-    return NetworkScheduler::instance()->addRequest(d->host, [d, method, query, body, vendor](QNetworkAccessManager *qnam) {
-        qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces) << "started";
-        QNetworkReply *reply = qnam->put(d->createNetworkRequest(d->createUrl(method, query), body, vendor), body);
-        d->handleReply(reply);
-        return reply;
-    });
+    QString socketPath = d->localSocketPath;
+    return NetworkScheduler::instance()->addRequest(
+        d->manager, d->schedulerKey(), priority,
+        [d, method, query, body, vendor, socketPath](QNetworkAccessManager *qnam) {
+            qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces) << "started";
+            QNetworkRequest request = d->createNetworkRequest(d->createUrl(method, query), body, vendor);
+            QNetworkReply *reply = socketPath.isEmpty()
+                                       ? qnam->put(request, body.data)
+                                       : d->sendLocalRequest(qnam, socketPath, "PUT", request, body.data);
+            d->handleReply(reply);
+            return reply;
+        });
 }
 
 CancelableFuture<QNetworkReply *> RestClient::patch(const QString &method, const QUrlQuery &query,
-                                                    const QByteArray &body, const QString &vendor)
+                                                    const RestRequestBody &body, const QString &vendor,
+                                                    RestRequestPriority priority)
 {
     Q_D(RestClient);
     qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces);
 
-    return NetworkScheduler::instance()->addRequest(d->host, [d, method, query, body, vendor](QNetworkAccessManager *qnam) {
-        qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces) << "started";
-        QBuffer *bodyBuffer = new QBuffer;
-        bodyBuffer->setData(body);
-        QNetworkReply *reply = qnam->sendCustomRequest(d->createNetworkRequest(d->createUrl(method, query), body, vendor),
-                                                       "PATCH", bodyBuffer);
-        d->handleReply(reply);
-        bodyBuffer->setParent(reply);
-        return reply;
-    });
+    QString socketPath = d->localSocketPath;
+    return NetworkScheduler::instance()->addRequest(
+        d->manager, d->schedulerKey(), priority,
+        [d, method, query, body, vendor, socketPath](QNetworkAccessManager *qnam) {
+            qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces) << "started";
+            if (!socketPath.isEmpty()) {
+                QNetworkReply *reply = d->sendLocalRequest(
+                    qnam, socketPath, "PATCH", d->createNetworkRequest(d->createUrl(method, query), body, vendor),
+                    body.data);
+                d->handleReply(reply);
+                return reply;
+            }
+            QBuffer *bodyBuffer = new QBuffer;
+            bodyBuffer->setData(body.data);
+            QNetworkReply *reply = qnam->sendCustomRequest(
+                d->createNetworkRequest(d->createUrl(method, query), body, vendor), "PATCH", bodyBuffer);
+            d->handleReply(reply);
+            bodyBuffer->setParent(reply);
+            return reply;
+        });
 }
 
 CancelableFuture<QNetworkReply *> RestClient::deleteResource(const QString &method, const QUrlQuery &query,
-                                                             const QString &vendor)
+                                                             const QString &vendor, RestRequestPriority priority)
 {
     Q_D(RestClient);
     qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces);
 
-    return NetworkScheduler::instance()->addRequest(d->host, [d, method, query, vendor](QNetworkAccessManager *qnam) {
-        qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces) << "started";
-        QNetworkReply *reply = qnam->deleteResource(
-            d->createNetworkRequest(d->createUrl(method, query), QByteArray(), vendor));
-        d->handleReply(reply);
-        return reply;
-    });
+    QString socketPath = d->localSocketPath;
+    return NetworkScheduler::instance()->addRequest(
+        d->manager, d->schedulerKey(), priority, [d, method, query, vendor, socketPath](QNetworkAccessManager *qnam) {
+            qCDebug(proofNetworkMiscLog) << method << query.toString(QUrl::EncodeSpaces) << "started";
+            QNetworkRequest request = d->createNetworkRequest(d->createUrl(method, query), QByteArray(), vendor);
+            QNetworkReply *reply = socketPath.isEmpty() ? qnam->deleteResource(request)
+                                                        : d->sendLocalRequest(qnam, socketPath, "DELETE", request);
+            d->handleReply(reply);
+            return reply;
+        });
 }
 
-CancelableFuture<QNetworkReply *> RestClient::get(const QUrl &url)
+CancelableFuture<QNetworkReply *> RestClient::get(const QUrl &url, RestRequestPriority priority)
 {
     Q_D(RestClient);
     qCDebug(proofNetworkMiscLog) << url;
-    return NetworkScheduler::instance()->addRequest(url.host(), [d, url](QNetworkAccessManager *qnam) {
-        qCDebug(proofNetworkMiscLog) << url << "started";
-        QNetworkReply *reply = qnam->get(d->createNetworkRequest(url, QByteArray(), QString()));
-        d->handleReply(reply);
-        return reply;
-    });
+    return NetworkScheduler::instance()->addRequest(
+        d->manager, url.host(), priority, [d, url](QNetworkAccessManager *qnam) {
+            qCDebug(proofNetworkMiscLog) << url << "started";
+            QNetworkReply *reply = qnam->get(d->createNetworkRequest(url, QByteArray(), QString()));
+            d->handleReply(reply);
+            return reply;
+        });
 }
 
 QUrl RestClientPrivate::createUrl(QString method, const QUrlQuery &query) const
@@ -470,22 +687,24 @@ QUrl RestClientPrivate::createUrl(QString method, const QUrlQuery &query) const
     return url;
 }
 
-QNetworkRequest RestClientPrivate::createNetworkRequest(const QUrl &url, const QByteArray &body, const QString &vendor)
+QNetworkRequest RestClientPrivate::createNetworkRequest(const QUrl &url, const RestRequestBody &body,
+                                                       const QString &vendor)
 {
-    QNetworkRequest result(url);
-    result.setAttribute(QNetworkRequest::FollowRedirectsAttribute, followRedirects);
-
-    if (!body.isEmpty()) {
-        QJsonParseError error;
-        QJsonDocument::fromJson(body, &error);
-
+    if (headersTemplateDirty.exchange(false))
+        updateHeadersTemplate();
+    QNetworkRequest result(headersTemplate);
+    result.setUrl(url);
+
+    if (body.type == RestRequestBody::Type::Custom) {
+        result.setHeader(QNetworkRequest::ContentTypeHeader, body.contentType);
+    } else if (!body.data.isEmpty()) {
         QString contentTypePattern = vendor.isEmpty() ? QStringLiteral("application/%1")
                                                       : QStringLiteral("application/vnd.%1+%2").arg(vendor);
 
-        //We assume that if it is not json and not xml it's url encoded data
-        if (error.error == QJsonParseError::NoError)
+        RestRequestBody::Type type = body.type == RestRequestBody::Type::Auto ? guessBodyType(body.data) : body.type;
+        if (type == RestRequestBody::Type::Json)
             result.setHeader(QNetworkRequest::ContentTypeHeader, contentTypePattern.arg(QStringLiteral("json")));
-        else if (body.startsWith("<?xml"))
+        else if (type == RestRequestBody::Type::Xml)
             result.setHeader(QNetworkRequest::ContentTypeHeader, vendor.isEmpty()
                                                                      ? QStringLiteral("text/xml")
                                                                      : contentTypePattern.arg(QStringLiteral("xml")));
@@ -499,6 +718,48 @@ QNetworkRequest RestClientPrivate::createNetworkRequest(const QUrl &url, const Q
         else
             result.setHeader(QNetworkRequest::ContentTypeHeader, QStringLiteral("application/vnd.%1").arg(vendor));
     }
+    // Custom headers have priority over generated content type
+    if (headersTemplate.hasRawHeader("Content-Type"))
+        result.setRawHeader("Content-Type", headersTemplate.rawHeader("Content-Type"));
+
+    result.setRawHeader("Proof-IP-Addresses", ipAddressesHeader());
+    // WSSE token has nonce and timestamp, so it can't be cached
+    if (authType == RestAuthType::Wsse)
+        result.setRawHeader("X-WSSE", generateWsseToken());
+
+    return result;
+}
+
+RestRequestBody::Type RestClientPrivate::guessBodyType(const QByteArray &data)
+{
+    // Only leading bytes are checked, body itself is not validated.
+    // We assume that if it is not json and not xml it's url encoded data
+    if (data.startsWith("<?xml"))
+        return RestRequestBody::Type::Xml;
+    for (char c : data) {
+        switch (c) {
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+            continue;
+        case '{':
+        case '[':
+            return RestRequestBody::Type::Json;
+        default:
+            return RestRequestBody::Type::UrlEncoded;
+        }
+    }
+    return RestRequestBody::Type::UrlEncoded;
+}
+
+void RestClientPrivate::updateHeadersTemplate()
+{
+    QNetworkRequest result;
+    result.setAttribute(QNetworkRequest::FollowRedirectsAttribute, followRedirects);
+    // Manager cache is shared by all clients in the thread, so clients without cache should neither use nor fill it
+    result.setAttribute(QNetworkRequest::CacheLoadControlAttribute,
+                        httpCacheEnabled ? QNetworkRequest::PreferNetwork : QNetworkRequest::AlwaysNetwork);
 
     for (const QNetworkCookie &cookie : qAsConst(cookies))
         result.setHeader(QNetworkRequest::CookieHeader, QVariant::fromValue(cookie));
@@ -512,18 +773,8 @@ QNetworkRequest RestClientPrivate::createNetworkRequest(const QUrl &url, const Q
     result.setRawHeader(QStringLiteral("Proof-%1-Framework-Version").arg(proofApp->prettifiedApplicationName()).toLatin1(),
                         Proof::proofVersion().toLatin1());
 
-    QStringList ipAdresses;
-    const auto allAddresses = QNetworkInterface::allAddresses();
-    for (const auto &address : allAddresses) {
-        if (address.protocol() == QAbstractSocket::IPv4Protocol && address != QHostAddress::LocalHost)
-            ipAdresses << address.toString();
-    }
-    result.setRawHeader(QStringLiteral("Proof-IP-Addresses").toLatin1(),
-                        ipAdresses.join(QStringLiteral("; ")).toLatin1());
-
     switch (authType) {
     case RestAuthType::Wsse:
-        result.setRawHeader("X-WSSE", generateWsseToken());
         result.setRawHeader("X-Client-Name", clientName.toLocal8Bit());
         result.setRawHeader("Authorization", "WSSE profile=\"UsernameToken\"");
         break;
@@ -546,9 +797,119 @@ QNetworkRequest RestClientPrivate::createNetworkRequest(const QUrl &url, const Q
         break;
     }
 
+    // Cache is keyed by url only, so answer for one credentials must not be given to request with another ones
+    const bool withCredentials = authType != RestAuthType::NoAuth || result.hasRawHeader("Authorization");
+    result.setAttribute(QNetworkRequest::CacheSaveControlAttribute, httpCacheEnabled && !withCredentials);
+
+    headersTemplate = result;
+}
+
+QByteArray RestClientPrivate::ipAddressesHeader()
+{
+    // Shared by all clients, interfaces list rarely changes but enumerating it is expensive
+    static SpinLock lock;
+    static QByteArray cached;
+    static QElapsedTimer cacheTimer;
+
+    lock.lock();
+    if (cacheTimer.isValid() && !cacheTimer.hasExpired(IP_ADDRESSES_REFRESH_PERIOD)) {
+        QByteArray result = cached;
+        lock.unlock();
+        return result;
+    }
+    lock.unlock();
+
+    QStringList ipAdresses;
+    const auto allAddresses = QNetworkInterface::allAddresses();
+    for (const auto &address : allAddresses) {
+        if (address.protocol() == QAbstractSocket::IPv4Protocol && address != QHostAddress::LocalHost)
+            ipAdresses << address.toString();
+    }
+    QByteArray result = ipAdresses.join(QStringLiteral("; ")).toLatin1();
+
+    lock.lock();
+    cached = result;
+    cacheTimer.start();
+    lock.unlock();
     return result;
 }
 
+QNetworkReply *RestClientPrivate::sendLocalRequest(QNetworkAccessManager *qnam, const QString &socketPath,
+                                                  const QByteArray &verb, const QNetworkRequest &request,
+                                                  const QByteArray &body) const
+{
+    return new LocalSocketReply(socketPath, request, verb, body, qnam);
+}
+
+int RestClient::defaultHostConcurrencyLimit()
+{
+    return NetworkScheduler::instance()->defaultLimit();
+}
+
+void RestClient::setDefaultHostConcurrencyLimit(int limit)
+{
+    NetworkScheduler::instance()->setDefaultLimit(limit);
+}
+
+int RestClient::hostConcurrencyLimit(const QString &host)
+{
+    return NetworkScheduler::instance()->hostLimit(host);
+}
+
+void RestClient::setHostConcurrencyLimit(const QString &host, int limit)
+{
+    NetworkScheduler::instance()->setHostLimit(host, limit);
+}
+
+QVariantMap RestClient::schedulerStatistics()
+{
+    return NetworkScheduler::instance()->statistics();
+}
+
+void RestClient::setupHttpCache(qint64 memoryBudget, const QString &diskDirectory, qint64 diskBudget)
+{
+    QSharedPointer<HttpCacheStorage> storage;
+    if (memoryBudget > 0 || !diskDirectory.isEmpty())
+        storage = QSharedPointer<HttpCacheStorage>::create(memoryBudget, diskDirectory, diskBudget);
+    NetworkScheduler::instance()->setHttpCache(storage);
+}
+
+bool RestClient::replyTimedOut(const QNetworkReply *reply)
+{
+    return reply->error() == QNetworkReply::OperationCanceledError && reply->property(TIMED_OUT_PROPERTY).toBool();
+}
+
+QVariantMap RestClient::httpCacheStatistics()
+{
+    auto httpCache = NetworkScheduler::instance()->httpCache();
+    return httpCache ? httpCache->statistics() : QVariantMap();
+}
+
+int RestClient::networkThreadsCount()
+{
+    return NetworkScheduler::instance()->threadsCount();
+}
+
+void RestClient::setNetworkThreadsCount(int count)
+{
+    NetworkScheduler::instance()->setThreadsCount(count);
+}
+
+bool RestClient::adaptiveConcurrencyEnabled()
+{
+    return NetworkScheduler::instance()->adaptiveEnabled();
+}
+
+void RestClient::setAdaptiveConcurrencyEnabled(bool enabled, int minLimit, int maxLimit)
+{
+    NetworkScheduler::instance()->setAdaptiveEnabled(enabled, minLimit, maxLimit);
+}
+
+QString RestClientPrivate::schedulerKey() const
+{
+    return localSocketPath.isEmpty() ? host : localSocketPath;
+}
+
 QByteArray RestClientPrivate::generateWsseToken() const
 {
     QByteArray hashedPassword;
@@ -582,8 +943,10 @@ void RestClientPrivate::handleReply(QNetworkReply *reply)
         qCWarning(proofNetworkMiscLog)
             << "Timed out:" << reply->request().url().toDisplayString(QUrl::FormattingOptions(QUrl::FullyDecoded))
             << reply->isRunning();
-        if (reply->isRunning())
+        if (reply->isRunning()) {
+            reply->setProperty(TIMED_OUT_PROPERTY, true);
             reply->abort();
+        }
         timer->deleteLater();
     });
 
@@ -607,6 +970,11 @@ void RestClientPrivate::handleReply(QNetworkReply *reply)
         qCDebug(proofNetworkMiscLog)
             << "Finished:" << reply->request().url().toDisplayString(QUrl::FormattingOptions(QUrl::FullyDecoded))
             << reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (httpCacheEnabled && reply->operation() == QNetworkAccessManager::GetOperation) {
+            auto httpCache = NetworkScheduler::instance()->httpCache();
+            if (httpCache)
+                httpCache->countReply(reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool());
+        }
         cleanupReplyHandler(reply);
     });
 }
@@ -615,8 +983,7 @@ void RestClientPrivate::cleanupReplyHandler(QNetworkReply *reply)
 {
     //This call is only for compatibility with old stations where restclient was explicitly moved to some other thread
     //In proper workflow this call with not do anything since restclient is in the same thread
-    if (ProofObject::call(NetworkScheduler::instance()->qnam, this, &RestClientPrivate::cleanupReplyHandler,
-                          Call::Block, reply))
+    if (ProofObject::call(manager, this, &RestClientPrivate::cleanupReplyHandler, Call::Block, reply))
         return;
     if (replyTimeouts.contains(reply)) {
         QTimer *connectionTimer = replyTimeouts.take(reply);
@@ -627,7 +994,7 @@ void RestClientPrivate::cleanupReplyHandler(QNetworkReply *reply)
 
 void RestClientPrivate::cleanupAll()
 {
-    if (ProofObject::call(NetworkScheduler::instance()->qnam, this, &RestClientPrivate::cleanupAll, Call::BlockEvents))
+    if (ProofObject::call(manager, this, &RestClientPrivate::cleanupAll, Call::BlockEvents))
         return;
     algorithms::forEach(replyTimeouts, [](QNetworkReply *, QTimer *timer) {
         timer->stop();
@@ -656,74 +1023,432 @@ QPair<QString, QString> RestClientPrivate::parseHost(const QString &host)
 }
 
 CancelableFuture<QNetworkReply *>
-NetworkScheduler::addRequest(const QString &host, std::function<QNetworkReply *(QNetworkAccessManager *)> &&request)
+NetworkScheduler::addRequest(QNetworkAccessManager *manager, const QString &host, RestRequestPriority priority,
+                             std::function<QNetworkReply *(QNetworkAccessManager *)> &&request)
 {
     auto promise = PromiseSP<QNetworkReply *>::create();
     promise->future()
-        ->flatMap([host](QNetworkReply *reply) {
-            auto checker = PromiseSP<bool>::create();
-            QObject::connect(reply, &QNetworkReply::finished, reply, [checker]() { checker->success(true); });
+        ->flatMap([this](QNetworkReply *reply) {
+            auto checker = PromiseSP<ReplySample>::create();
+            const qint64 startedAt = clock.elapsed();
+            auto complete = [this, checker, reply, startedAt]() {
+                if (!checker->filled())
+                    checker->success(sampleReply(reply, startedAt, clock.elapsed()));
+            };
+            QObject::connect(reply, &QNetworkReply::finished, reply, complete);
             QObject::connect(reply, QOverload<QNetworkReply::NetworkError>::of(&QNetworkReply::error), reply,
-                             [checker]() { checker->success(true); });
-            QObject::connect(reply, &QNetworkReply::sslErrors, reply, [checker]() { checker->success(true); });
+                             complete);
+            QObject::connect(reply, &QNetworkReply::sslErrors, reply, complete);
             return checker->future();
         })
-        ->onSuccess([this, host](bool) {
-            decreaseUsage(host);
+        ->onSuccess([this, host](const ReplySample &sample) {
+            decreaseUsage(host, sample);
             schedule();
         });
 
-    requestsLock.lock();
-    qCDebug(proofNetworkExtraLog) << "Adding request for" << host << "with current usage =" << usages.value(host, 0);
-    requests.emplace_back(host, [this, host, request, promise]() {
+    // Requests started from rest method of AbstractRestServer are dropped if its client disconnects
+    auto cancellation = RequestCancellation::current();
+
+    std::function<void()> send = [this, manager, host, request, promise, cancellation]() {
         if (promise->filled()) {
             qCDebug(proofNetworkExtraLog)
                 << "Request for" << host << "was ready to be sent, but is already canceled, skipping it";
             decreaseUsage(host);
+            // Freed slot must be given to next request even if this one was skipped outside of scheduler thread
+            schedule();
             return;
         }
         qCDebug(proofNetworkExtraLog) << "Sending request for" << host;
-        promise->success(request(qnam));
-    });
+        QNetworkReply *reply = request(manager);
+        if (cancellation) {
+            QPointer<QNetworkReply> replyPointer(reply);
+            cancellation->addCallback([replyPointer, manager]() {
+                // Reply can be touched only from its own thread
+                QTimer::singleShot(0, manager, [replyPointer]() {
+                    if (replyPointer && replyPointer->isRunning())
+                        replyPointer->abort();
+                });
+            });
+        }
+        promise->success(reply);
+    };
+    // Reply and its handlers must live in thread of client's network manager
+    std::function<void()> descriptor = [manager, send = std::move(send)]() {
+        if (manager->thread() == QThread::currentThread())
+            send();
+        else
+            QTimer::singleShot(0, manager, send);
+    };
+
+    requestsLock.lock();
+    auto queueIt = hosts.find(host);
+    if (queueIt == hosts.end()) {
+        queueIt = hosts.insert(host, HostQueue());
+        queueIt->limit = effectiveLimit(host);
+    }
+    HostQueue &queue = *queueIt;
+    qCDebug(proofNetworkExtraLog) << "Adding request for" << host << "with current usage =" << queue.usage
+                                  << "and priority =" << static_cast<int>(priority);
+    queue.requests[static_cast<int>(priority)].push_back(std::move(descriptor));
+    ++queue.queued;
+    ++queuedCount;
+    markReadyIfPossible(host, queue);
     requestsLock.unlock();
 
+    CancelableFuture<QNetworkReply *> result(promise);
+    if (cancellation)
+        cancellation->addCallback([result]() { result.cancel(); });
     schedule();
-    return CancelableFuture<QNetworkReply *>(promise);
+    return result;
 }
 
 void NetworkScheduler::schedule()
 {
     if (ProofObject::call(qnam, this, &NetworkScheduler::schedule))
         return;
-    qCDebug(proofNetworkExtraLog) << "Scheduling network requests with queue size =" << requests.size();
-    while (requests.size()) {
-        bool found = false;
+    qCDebug(proofNetworkExtraLog) << "Scheduling network requests with queue size =" << queuedCount;
+    forever {
         requestsLock.lock();
-        RequestDescriptor candidate;
-        for (auto it = requests.begin(); it != requests.end(); ++it) {
-            if (usages[it->first] < limit) {
-                candidate = *it;
-                found = true;
-                if (!candidate.first.isEmpty())
-                    ++usages[candidate.first];
-                requests.erase(it);
-                break;
-            }
+        if (readyHosts.empty()) {
+            requestsLock.unlock();
+            break;
         }
+        const QString host = std::move(readyHosts.front());
+        readyHosts.pop_front();
+        auto queueIt = hosts.find(host);
+        HostQueue &queue = *queueIt;
+        queue.isReady = false;
+        std::function<void()> candidate = queue.takeNext();
+        --queuedCount;
+        if (!host.isEmpty())
+            ++queue.usage;
+        // Host goes to the end of ring, so other hosts are served before its next request
+        markReadyIfPossible(host, queue);
+        eraseIfIdle(queueIt);
         requestsLock.unlock();
-        if (!found)
-            break;
-        candidate.second();
+        candidate();
     }
 }
 
-void NetworkScheduler::decreaseUsage(const QString &host)
+void NetworkScheduler::decreaseUsage(const QString &host, const ReplySample &sample)
 {
     if (!host.isEmpty()) {
         requestsLock.lock();
-        --usages[host];
-        if (usages[host] <= 0)
-            usages.remove(host);
+        auto queueIt = hosts.find(host);
+        if (queueIt != hosts.end()) {
+            if (sample.valid)
+                adaptLimit(host, *queueIt, sample);
+            --queueIt->usage;
+            markReadyIfPossible(host, *queueIt);
+            eraseIfIdle(queueIt);
+        }
         requestsLock.unlock();
     }
 }
+
+QNetworkAccessManager *NetworkScheduler::acquireManager()
+{
+    shardsLock.lock();
+    while (shards.count() < m_threadsCount)
+        shards.append(createShard(m_httpCache));
+    nextShard = (nextShard + 1) % m_threadsCount;
+    QNetworkAccessManager *result = shards[nextShard].qnam;
+    shardsLock.unlock();
+    return result;
+}
+
+int NetworkScheduler::threadsCount() const
+{
+    shardsLock.lock();
+    int result = m_threadsCount;
+    shardsLock.unlock();
+    return result;
+}
+
+void NetworkScheduler::setThreadsCount(int count)
+{
+    shardsLock.lock();
+    m_threadsCount = qMax(1, count);
+    shardsLock.unlock();
+}
+
+QSharedPointer<HttpCacheStorage> NetworkScheduler::httpCache() const
+{
+    shardsLock.lock();
+    auto result = m_httpCache;
+    shardsLock.unlock();
+    return result;
+}
+
+void NetworkScheduler::setHttpCache(const QSharedPointer<HttpCacheStorage> &storage)
+{
+    shardsLock.lock();
+    m_httpCache = storage;
+    QVector<Shard> existingShards = shards;
+    shardsLock.unlock();
+    for (const auto &shard : qAsConst(existingShards))
+        installHttpCache(shard.qnam, storage);
+}
+
+void NetworkScheduler::installHttpCache(QNetworkAccessManager *manager, const QSharedPointer<HttpCacheStorage> &storage)
+{
+    if (ProofObject::call(manager, this, &NetworkScheduler::installHttpCache, Call::Block, manager, storage))
+        return;
+    // Previous cache is deleted by manager
+    manager->setCache(storage ? new HttpCache(storage) : nullptr);
+}
+
+NetworkScheduler::Shard NetworkScheduler::createShard(const QSharedPointer<HttpCacheStorage> &httpCache)
+{
+    Shard result;
+    result.qnam = new QNetworkAccessManager;
+    if (httpCache)
+        result.qnam->setCache(new HttpCache(httpCache));
+    result.thread = new QThread();
+    result.thread->start();
+    result.qnam->moveToThread(result.thread);
+    return result;
+}
+
+int NetworkScheduler::defaultLimit() const
+{
+    requestsLock.lock();
+    int result = m_defaultLimit;
+    requestsLock.unlock();
+    return result;
+}
+
+void NetworkScheduler::setDefaultLimit(int limit)
+{
+    requestsLock.lock();
+    m_defaultLimit = qMax(1, limit);
+    updateLimits();
+    requestsLock.unlock();
+    schedule();
+}
+
+int NetworkScheduler::hostLimit(const QString &host) const
+{
+    requestsLock.lock();
+    int result = hostLimits.value(host, m_defaultLimit);
+    auto adaptiveIt = adaptiveLimits.constFind(host);
+    if (m_adaptiveEnabled && !hostLimits.contains(host) && adaptiveIt != adaptiveLimits.cend())
+        result = qFloor(adaptiveIt->window);
+    requestsLock.unlock();
+    return result;
+}
+
+void NetworkScheduler::setHostLimit(const QString &host, int limit)
+{
+    requestsLock.lock();
+    if (limit > 0)
+        hostLimits[host] = limit;
+    else
+        hostLimits.remove(host);
+    updateLimits();
+    requestsLock.unlock();
+    schedule();
+}
+
+QVariantMap NetworkScheduler::statistics() const
+{
+    struct HostStatistics
+    {
+        QString host;
+        int usage;
+        int queued;
+        int limit;
+    };
+    QVector<HostStatistics> hostsStatistics;
+    requestsLock.lock();
+    hostsStatistics.reserve(hosts.count());
+    for (auto it = hosts.cbegin(); it != hosts.cend(); ++it)
+        hostsStatistics.append({it.key(), it->usage, it->queued, it->limit});
+    requestsLock.unlock();
+
+    QVariantMap result;
+    for (const auto &statistics : qAsConst(hostsStatistics)) {
+        result[statistics.host] = QVariantMap{{QStringLiteral("usage"), statistics.usage},
+                                              {QStringLiteral("queued"), statistics.queued},
+                                              {QStringLiteral("limit"), statistics.limit}};
+    }
+    return result;
+}
+
+std::function<void()> NetworkScheduler::HostQueue::takeNext()
+{
+    int selected = PRIORITIES_COUNT - 1;
+    while (requests[selected].empty())
+        --selected;
+    // Starvation protection, lowest starving class goes first
+    for (int priority = 0; priority < selected; ++priority) {
+        if (!requests[priority].empty() && bypassed[priority] >= PRIORITY_STARVATION_LIMIT) {
+            selected = priority;
+            break;
+        }
+    }
+    for (int priority = 0; priority < selected; ++priority) {
+        if (!requests[priority].empty())
+            ++bypassed[priority];
+    }
+    bypassed[selected] = 0;
+
+    std::function<void()> result = std::move(requests[selected].front());
+    requests[selected].pop_front();
+    --queued;
+    return result;
+}
+
+bool NetworkScheduler::canSend(const QString &host, const HostQueue &queue) const
+{
+    return host.isEmpty() || queue.usage < queue.limit;
+}
+
+bool NetworkScheduler::adaptiveEnabled() const
+{
+    requestsLock.lock();
+    bool result = m_adaptiveEnabled;
+    requestsLock.unlock();
+    return result;
+}
+
+void NetworkScheduler::setAdaptiveEnabled(bool enabled, int minLimit, int maxLimit)
+{
+    requestsLock.lock();
+    m_adaptiveEnabled = enabled;
+    m_adaptiveMinLimit = qMax(1, minLimit);
+    m_adaptiveMaxLimit = qMax(m_adaptiveMinLimit, maxLimit);
+    adaptiveLimits.clear();
+    updateLimits();
+    requestsLock.unlock();
+    schedule();
+}
+
+void NetworkScheduler::updateLimits()
+{
+    // Limits are changed rarely, so it is fine to touch all hosts here
+    for (auto it = hosts.begin(); it != hosts.end(); ++it) {
+        it->limit = effectiveLimit(it.key());
+        markReadyIfPossible(it.key(), *it);
+    }
+}
+
+int NetworkScheduler::effectiveLimit(const QString &host)
+{
+    auto overrideIt = hostLimits.constFind(host);
+    if (overrideIt != hostLimits.cend())
+        return *overrideIt;
+    if (!m_adaptiveEnabled)
+        return m_defaultLimit;
+    auto adaptiveIt = adaptiveLimits.find(host);
+    if (adaptiveIt == adaptiveLimits.end()) {
+        evictIdleAdaptiveLimits();
+        adaptiveIt = adaptiveLimits.insert(host, AdaptiveLimit());
+        adaptiveIt->window = qBound(m_adaptiveMinLimit, m_defaultLimit, m_adaptiveMaxLimit);
+    }
+    adaptiveIt->lastActivityAt = clock.elapsed();
+    return qFloor(adaptiveIt->window);
+}
+
+void NetworkScheduler::evictIdleAdaptiveLimits()
+{
+    const qint64 now = clock.elapsed();
+    if (now - lastAdaptiveEvictionAt < ADAPTIVE_IDLE_TIMEOUT)
+        return;
+    lastAdaptiveEvictionAt = now;
+    for (auto it = adaptiveLimits.begin(); it != adaptiveLimits.end();) {
+        if (now - it->lastActivityAt >= ADAPTIVE_IDLE_TIMEOUT && !hosts.contains(it.key()))
+            it = adaptiveLimits.erase(it);
+        else
+            ++it;
+    }
+}
+
+NetworkScheduler::ReplySample NetworkScheduler::sampleReply(QNetworkReply *reply, qint64 startedAt, qint64 finishedAt)
+{
+    ReplySample result;
+    // Aborted replies (timeouts, cancellations) say nothing about backend itself
+    if (reply->error() == QNetworkReply::OperationCanceledError)
+        return result;
+    result.valid = true;
+    result.startedAt = startedAt;
+    result.latency = finishedAt - startedAt;
+    switch (reply->error()) {
+    case QNetworkReply::ConnectionRefusedError:
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::ServiceUnavailableError:
+        result.overloaded = true;
+        break;
+    default: {
+        int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        result.overloaded = httpCode == 429 || httpCode == 502 || httpCode == 503 || httpCode == 504;
+        break;
+    }
+    }
+    return result;
+}
+
+void NetworkScheduler::adaptLimit(const QString &host, HostQueue &queue, const ReplySample &sample)
+{
+    if (!m_adaptiveEnabled || hostLimits.contains(host))
+        return;
+    auto adaptiveIt = adaptiveLimits.find(host);
+    if (adaptiveIt == adaptiveLimits.end())
+        return;
+    AdaptiveLimit &adaptive = *adaptiveIt;
+    adaptive.lastActivityAt = clock.elapsed();
+
+    bool latencyGrown = adaptive.baselineLatency >= 0
+                        && sample.latency > adaptive.baselineLatency * ADAPTIVE_LATENCY_TOLERANCE
+                                                + ADAPTIVE_LATENCY_SLACK;
+    if (sample.overloaded || latencyGrown) {
+        // Replies that were sent before previous decrease reflect the old window, so only one decrease per round trip
+        if (sample.startedAt > adaptive.lastDecreaseAt) {
+            adaptive.window *= sample.overloaded ? ADAPTIVE_OVERLOAD_BACKOFF : ADAPTIVE_LATENCY_BACKOFF;
+            adaptive.lastDecreaseAt = clock.elapsed();
+        }
+    } else if (queue.usage >= qFloor(adaptive.window)) {
+        // Additive increase by one per window of successful replies, only while window is actually saturated
+        adaptive.window += 1.0 / adaptive.window;
+    }
+    adaptive.window = qBound(static_cast<double>(m_adaptiveMinLimit), adaptive.window,
+                             static_cast<double>(m_adaptiveMaxLimit));
+
+    if (!sample.overloaded) {
+        adaptive.periodLatencies[adaptive.periodSamples] = sample.latency;
+        if (++adaptive.periodSamples >= ADAPTIVE_BASELINE_PERIOD) {
+            auto median = adaptive.periodLatencies.begin() + ADAPTIVE_BASELINE_PERIOD / 2;
+            std::nth_element(adaptive.periodLatencies.begin(), median, adaptive.periodLatencies.end());
+            // Latency growth is not checked until first period is collected
+            adaptive.baselineLatency = adaptive.baselineLatency < 0
+                                           ? *median
+                                           : adaptive.baselineLatency * (1.0 - ADAPTIVE_BASELINE_SMOOTHING)
+                                                 + *median * ADAPTIVE_BASELINE_SMOOTHING;
+            adaptive.periodSamples = 0;
+        }
+    }
+
+    int newLimit = qFloor(adaptive.window);
+    if (newLimit != queue.limit) {
+        qCDebug(proofNetworkExtraLog) << "Adaptive limit for" << host << "changed from" << queue.limit << "to"
+                                      << newLimit << "with latency =" << sample.latency
+                                      << "and baseline =" << adaptive.baselineLatency;
+        queue.limit = newLimit;
+    }
+}
+
+void NetworkScheduler::markReadyIfPossible(const QString &host, HostQueue &queue)
+{
+    if (!queue.isReady && queue.queued && canSend(host, queue)) {
+        queue.isReady = true;
+        readyHosts.push_back(host);
+    }
+}
+
+void NetworkScheduler::eraseIfIdle(QHash<QString, HostQueue>::iterator queueIt)
+{
+    if (!queueIt->queued && queueIt->usage <= 0)
+        hosts.erase(queueIt);
+}
@@ -0,0 +1,181 @@
+/* Copyright 2018, OpenSoft Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *     * Neither the name of OpenSoft Inc. nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "proofnetwork/trafficcapture.h"
+
+#include "proofnetwork/trafficcapture_p.h"
+
+#include <QDataStream>
+#include <QIODevice>
+#include <QMutexLocker>
+#include <QtEndian>
+
+static const QByteArray FILE_MAGIC = QByteArrayLiteral("PROOFCAP");
+static constexpr char FILE_VERSION = 1;
+static constexpr quint32 MAX_RECORD_SIZE = 256 * 1024 * 1024;
+static constexpr int MAX_PENDING_RECORDS = 8192;
+// Big bodies would hit memory long before records count limit
+static constexpr qint64 MAX_PENDING_BYTES = 64 * 1024 * 1024;
+static constexpr int DRAIN_INTERVAL = 200;
+
+using namespace Proof;
+
+QByteArray TrafficCapture::fileHeader()
+{
+    return FILE_MAGIC + FILE_VERSION;
+}
+
+QByteArray TrafficCapture::serialize(const TrafficCaptureRecord &record)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_10);
+    // Strings are stored as utf-8 to keep file compact
+    stream << record.timestamp << record.peer.toUtf8() << record.method.toUtf8() << record.uri.toUtf8()
+           << static_cast<quint32>(record.headers.count());
+    for (const QString &header : record.headers)
+        stream << header.toUtf8();
+    stream << record.body;
+
+    QByteArray result(sizeof(quint32), Qt::Uninitialized);
+    qToBigEndian(static_cast<quint32>(payload.size()), result.data());
+    return result + payload;
+}
+
+bool TrafficCapture::readFileHeader(QIODevice *device)
+{
+    return device->read(fileHeader().size()) == fileHeader();
+}
+
+bool TrafficCapture::readRecord(QIODevice *device, TrafficCaptureRecord &record)
+{
+    const QByteArray sizeBytes = device->read(sizeof(quint32));
+    if (sizeBytes.size() != sizeof(quint32))
+        return false;
+    const quint32 size = qFromBigEndian<quint32>(sizeBytes.constData());
+    if (size > MAX_RECORD_SIZE)
+        return false;
+    const QByteArray payload = device->read(size);
+    if (static_cast<quint32>(payload.size()) != size)
+        return false;
+
+    QDataStream stream(payload);
+    stream.setVersion(QDataStream::Qt_5_10);
+    QByteArray peer;
+    QByteArray method;
+    QByteArray uri;
+    quint32 headersCount = 0;
+    stream >> record.timestamp >> peer >> method >> uri >> headersCount;
+    record.peer = QString::fromUtf8(peer);
+    record.method = QString::fromUtf8(method);
+    record.uri = QString::fromUtf8(uri);
+    record.headers.clear();
+    for (quint32 i = 0; i < headersCount && stream.status() == QDataStream::Ok; ++i) {
+        QByteArray header;
+        stream >> header;
+        record.headers << QString::fromUtf8(header);
+    }
+    stream >> record.body;
+    return stream.status() == QDataStream::Ok;
+}
+
+TrafficCaptureWriter::TrafficCaptureWriter(const QString &filePath,
+                                           const std::function<void(TrafficCaptureRecord &)> &redactor)
+    : m_file(filePath), m_redactor(redactor)
+{}
+
+TrafficCaptureWriter::~TrafficCaptureWriter()
+{
+    stop();
+}
+
+bool TrafficCaptureWriter::open()
+{
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+    if (!m_file.size())
+        m_file.write(TrafficCapture::fileHeader());
+    return true;
+}
+
+QString TrafficCaptureWriter::errorString() const
+{
+    return m_file.errorString();
+}
+
+void TrafficCaptureWriter::push(TrafficCaptureRecord &&record)
+{
+    qint64 recordSize = record.body.size() + record.uri.size() + record.method.size() + record.peer.size();
+    for (const QString &header : qAsConst(record.headers))
+        recordSize += header.size();
+    QMutexLocker locker(&m_pendingMutex);
+    if (m_pending.count() >= MAX_PENDING_RECORDS || m_pendingBytes + recordSize > MAX_PENDING_BYTES) {
+        ++m_droppedCount;
+        return;
+    }
+    m_pendingBytes += recordSize;
+    m_pending << std::move(record);
+}
+
+void TrafficCaptureWriter::stop()
+{
+    m_stopRequested = true;
+    if (isRunning())
+        wait();
+}
+
+qint64 TrafficCaptureWriter::droppedCount() const
+{
+    return m_droppedCount;
+}
+
+void TrafficCaptureWriter::run()
+{
+    while (!m_stopRequested) {
+        drain();
+        msleep(DRAIN_INTERVAL);
+    }
+    drain();
+}
+
+void TrafficCaptureWriter::drain()
+{
+    QVector<TrafficCaptureRecord> records;
+    m_pendingMutex.lock();
+    records.swap(m_pending);
+    m_pendingBytes = 0;
+    m_pendingMutex.unlock();
+    if (records.isEmpty())
+        return;
+
+    QByteArray batch;
+    for (auto &record : records) {
+        if (m_redactor)
+            m_redactor(record);
+        batch += TrafficCapture::serialize(record);
+    }
+    m_file.write(batch);
+    // Capture is for post-mortem analysis too, so nothing is left in buffers
+    m_file.flush();
+}
@@ -0,0 +1,37 @@
+// clazy:skip
+
+#include "proofcore/memorystoragenotificationhandler.h"
+
+#include "gtest/proof/test_global.h"
+
+TEST(MemoryStorageNotificationHandlerTest, messagesSince)
+{
+    Proof::MemoryStorageNotificationHandler handler("test");
+    for (int i = 1; i <= 5; ++i)
+        handler.notify(QStringLiteral("message %1").arg(i), Proof::ErrorNotifier::Severity::Error, QString());
+
+    auto all = handler.messagesSince(0);
+    ASSERT_EQ(5, all.count());
+    EXPECT_EQ(5, all.first().id);
+    EXPECT_EQ("message 5", all.first().text);
+    EXPECT_EQ(1, all.last().id);
+    EXPECT_EQ(5, handler.messages().count());
+
+    auto newest = handler.messagesSince(0, 2);
+    ASSERT_EQ(2, newest.count());
+    EXPECT_EQ(5, newest[0].id);
+    EXPECT_EQ(4, newest[1].id);
+
+    auto afterCursor = handler.messagesSince(2, 2);
+    ASSERT_EQ(2, afterCursor.count());
+    EXPECT_EQ(4, afterCursor[0].id);
+    EXPECT_EQ(3, afterCursor[1].id);
+
+    auto rest = handler.messagesSince(4);
+    ASSERT_EQ(1, rest.count());
+    EXPECT_EQ(5, rest[0].id);
+    EXPECT_EQ("message 5", rest[0].text);
+
+    EXPECT_TRUE(handler.messagesSince(5).isEmpty());
+    EXPECT_TRUE(handler.messagesSince(100).isEmpty());
+}
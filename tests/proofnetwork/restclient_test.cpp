@@ -2,14 +2,25 @@
 
 #include "proofseed/future.h"
 
+#include "proofnetwork/abstractrestserver.h"
+#include "proofnetwork/baserestapi.h"
 #include "proofnetwork/restclient.h"
 
 #include "gtest/proof/test_global.h"
 
+#include "resttest_helpers.h"
+
+#include <QMutex>
 #include <QNetworkReply>
 #include <QRegExp>
 #include <QScopedPointer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QtMath>
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <tuple>
 
@@ -58,79 +69,110 @@ INSTANTIATE_TEST_CASE_P(
     testing::Values(
         // Without vendor, without body
         HttpMethodsTestParam(std::bind(static_cast<Proof::CancelableFuture<QNetworkReply *> (Proof::RestClient::*)(
-                                           const QString &, const QUrlQuery &, const QString &)>(&Proof::RestClient::get),
-                                       _1, QStringLiteral("/"), QUrlQuery(), QString()),
+                                           const QString &, const QUrlQuery &, const QString &,
+                                           Proof::RestRequestPriority)>(&Proof::RestClient::get),
+                                       _1, QStringLiteral("/"), QUrlQuery(), QString(),
+                                       Proof::RestRequestPriority::Normal),
                              "", "text/plain"),
         HttpMethodsTestParam(
-            std::bind(static_cast<Proof::CancelableFuture<QNetworkReply *> (Proof::RestClient::*)(const QUrl &)>(
-                          &Proof::RestClient::get),
-                      _1, QUrl("http://127.0.0.1:9091/")),
+            std::bind(static_cast<Proof::CancelableFuture<QNetworkReply *> (Proof::RestClient::*)(
+                          const QUrl &, Proof::RestRequestPriority)>(&Proof::RestClient::get),
+                      _1, QUrl("http://127.0.0.1:9091/"), Proof::RestRequestPriority::Normal),
             "", "text/plain"),
         HttpMethodsTestParam(std::bind(static_cast<Proof::CancelableFuture<QNetworkReply *> (Proof::RestClient::*)(
-                                           const QString &, const QUrlQuery &, const QByteArray &, const QString &)>(
-                                           &Proof::RestClient::post),
-                                       _1, "/", QUrlQuery(), _2, QString()),
+                                           const QString &, const QUrlQuery &, const Proof::RestRequestBody &,
+                                           const QString &, Proof::RestRequestPriority)>(&Proof::RestClient::post),
+                                       _1, "/", QUrlQuery(), _2, QString(), Proof::RestRequestPriority::Normal),
                              "", "text/plain"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::put, _1, "/", QUrlQuery(), _2, QString()), "", "text/plain"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::patch, _1, "/", QUrlQuery(), _2, QString()), "", "text/plain"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::deleteResource, _1, "/", QUrlQuery(), QString()), "",
-                             "text/plain"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::put, _1, "/", QUrlQuery(), _2, QString(), Proof::RestRequestPriority::Normal),
+            "", "text/plain"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::patch, _1, "/", QUrlQuery(), _2, QString(),
+                      Proof::RestRequestPriority::Normal),
+            "", "text/plain"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::deleteResource, _1, "/", QUrlQuery(), QString(),
+                      Proof::RestRequestPriority::Normal),
+            "", "text/plain"),
         // With vendor, without body
         HttpMethodsTestParam(std::bind(static_cast<Proof::CancelableFuture<QNetworkReply *> (Proof::RestClient::*)(
-                                           const QString &, const QUrlQuery &, const QString &)>(&Proof::RestClient::get),
-                                       _1, QStringLiteral("/"), QUrlQuery(), "opensoft"),
+                                           const QString &, const QUrlQuery &, const QString &,
+                                           Proof::RestRequestPriority)>(&Proof::RestClient::get),
+                                       _1, QStringLiteral("/"), QUrlQuery(), "opensoft",
+                                       Proof::RestRequestPriority::Normal),
                              "", "application/vnd.opensoft"),
         HttpMethodsTestParam(std::bind(static_cast<Proof::CancelableFuture<QNetworkReply *> (Proof::RestClient::*)(
-                                           const QString &, const QUrlQuery &, const QByteArray &, const QString &)>(
-                                           &Proof::RestClient::post),
-                                       _1, "/", QUrlQuery(), _2, "opensoft"),
+                                           const QString &, const QUrlQuery &, const Proof::RestRequestBody &,
+                                           const QString &, Proof::RestRequestPriority)>(&Proof::RestClient::post),
+                                       _1, "/", QUrlQuery(), _2, "opensoft", Proof::RestRequestPriority::Normal),
                              "", "application/vnd.opensoft"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::put, _1, "/", QUrlQuery(), _2, "opensoft"), "",
-                             "application/vnd.opensoft"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::patch, _1, "/", QUrlQuery(), _2, "opensoft"), "",
-                             "application/vnd.opensoft"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::deleteResource, _1, "/", QUrlQuery(), "opensoft"), "",
-                             "application/vnd.opensoft"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::put, _1, "/", QUrlQuery(), _2, "opensoft",
+                      Proof::RestRequestPriority::Normal),
+            "", "application/vnd.opensoft"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::patch, _1, "/", QUrlQuery(), _2, "opensoft",
+                      Proof::RestRequestPriority::Normal),
+            "", "application/vnd.opensoft"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::deleteResource, _1, "/", QUrlQuery(), "opensoft",
+                      Proof::RestRequestPriority::Normal),
+            "", "application/vnd.opensoft"),
         // Without vendor, with json body
         HttpMethodsTestParam(std::bind(static_cast<Proof::CancelableFuture<QNetworkReply *> (Proof::RestClient::*)(
-                                           const QString &, const QUrlQuery &, const QByteArray &, const QString &)>(
-                                           &Proof::RestClient::post),
-                                       _1, "/", QUrlQuery(), _2, QString()),
-                             ":/data/vendor_test_body.json", "application/json"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::put, _1, "/", QUrlQuery(), _2, QString()),
-                             ":/data/vendor_test_body.json", "application/json"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::patch, _1, "/", QUrlQuery(), _2, QString()),
+                                           const QString &, const QUrlQuery &, const Proof::RestRequestBody &,
+                                           const QString &, Proof::RestRequestPriority)>(&Proof::RestClient::post),
+                                       _1, "/", QUrlQuery(), _2, QString(), Proof::RestRequestPriority::Normal),
                              ":/data/vendor_test_body.json", "application/json"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::put, _1, "/", QUrlQuery(), _2, QString(), Proof::RestRequestPriority::Normal),
+            ":/data/vendor_test_body.json", "application/json"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::patch, _1, "/", QUrlQuery(), _2, QString(),
+                      Proof::RestRequestPriority::Normal),
+            ":/data/vendor_test_body.json", "application/json"),
         // Without vendor, with xml body
         HttpMethodsTestParam(std::bind(static_cast<Proof::CancelableFuture<QNetworkReply *> (Proof::RestClient::*)(
-                                           const QString &, const QUrlQuery &, const QByteArray &, const QString &)>(
-                                           &Proof::RestClient::post),
-                                       _1, "/", QUrlQuery(), _2, QString()),
-                             ":/data/vendor_test_body.xml", "text/xml"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::put, _1, "/", QUrlQuery(), _2, QString()),
-                             ":/data/vendor_test_body.xml", "text/xml"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::patch, _1, "/", QUrlQuery(), _2, QString()),
+                                           const QString &, const QUrlQuery &, const Proof::RestRequestBody &,
+                                           const QString &, Proof::RestRequestPriority)>(&Proof::RestClient::post),
+                                       _1, "/", QUrlQuery(), _2, QString(), Proof::RestRequestPriority::Normal),
                              ":/data/vendor_test_body.xml", "text/xml"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::put, _1, "/", QUrlQuery(), _2, QString(), Proof::RestRequestPriority::Normal),
+            ":/data/vendor_test_body.xml", "text/xml"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::patch, _1, "/", QUrlQuery(), _2, QString(),
+                      Proof::RestRequestPriority::Normal),
+            ":/data/vendor_test_body.xml", "text/xml"),
         // With vendor, with json body
         HttpMethodsTestParam(std::bind(static_cast<Proof::CancelableFuture<QNetworkReply *> (Proof::RestClient::*)(
-                                           const QString &, const QUrlQuery &, const QByteArray &, const QString &)>(
-                                           &Proof::RestClient::post),
-                                       _1, "/", QUrlQuery(), _2, "opensoft"),
-                             ":/data/vendor_test_body.json", "application/vnd.opensoft+json"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::put, _1, "/", QUrlQuery(), _2, "opensoft"),
-                             ":/data/vendor_test_body.json", "application/vnd.opensoft+json"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::patch, _1, "/", QUrlQuery(), _2, "opensoft"),
+                                           const QString &, const QUrlQuery &, const Proof::RestRequestBody &,
+                                           const QString &, Proof::RestRequestPriority)>(&Proof::RestClient::post),
+                                       _1, "/", QUrlQuery(), _2, "opensoft", Proof::RestRequestPriority::Normal),
                              ":/data/vendor_test_body.json", "application/vnd.opensoft+json"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::put, _1, "/", QUrlQuery(), _2, "opensoft",
+                      Proof::RestRequestPriority::Normal),
+            ":/data/vendor_test_body.json", "application/vnd.opensoft+json"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::patch, _1, "/", QUrlQuery(), _2, "opensoft",
+                      Proof::RestRequestPriority::Normal),
+            ":/data/vendor_test_body.json", "application/vnd.opensoft+json"),
         // With vendor, with xml body
         HttpMethodsTestParam(std::bind(static_cast<Proof::CancelableFuture<QNetworkReply *> (Proof::RestClient::*)(
-                                           const QString &, const QUrlQuery &, const QByteArray &, const QString &)>(
-                                           &Proof::RestClient::post),
-                                       _1, "/", QUrlQuery(), _2, "opensoft"),
-                             ":/data/vendor_test_body.xml", "application/vnd.opensoft+xml"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::put, _1, "/", QUrlQuery(), _2, "opensoft"),
+                                           const QString &, const QUrlQuery &, const Proof::RestRequestBody &,
+                                           const QString &, Proof::RestRequestPriority)>(&Proof::RestClient::post),
+                                       _1, "/", QUrlQuery(), _2, "opensoft", Proof::RestRequestPriority::Normal),
                              ":/data/vendor_test_body.xml", "application/vnd.opensoft+xml"),
-        HttpMethodsTestParam(std::bind(&Proof::RestClient::patch, _1, "/", QUrlQuery(), _2, "opensoft"),
-                             ":/data/vendor_test_body.xml", "application/vnd.opensoft+xml")));
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::put, _1, "/", QUrlQuery(), _2, "opensoft",
+                      Proof::RestRequestPriority::Normal),
+            ":/data/vendor_test_body.xml", "application/vnd.opensoft+xml"),
+        HttpMethodsTestParam(
+            std::bind(&Proof::RestClient::patch, _1, "/", QUrlQuery(), _2, "opensoft",
+                      Proof::RestRequestPriority::Normal),
+            ":/data/vendor_test_body.xml", "application/vnd.opensoft+xml")));
 
 TEST_P(RestClientTest, vendorTest)
 {
@@ -161,3 +203,739 @@ TEST_P(RestClientTest, vendorTest)
     ASSERT_NE(-1, position);
     EXPECT_EQ(expected, expectedRegExp.cap(2));
 }
+
+class SlowRestServer : public Proof::AbstractRestServer
+{
+    Q_OBJECT
+public:
+    SlowRestServer() : Proof::AbstractRestServer(0) {}
+
+    QStringList handledTags() const
+    {
+        QMutexLocker locker(&tagsMutex);
+        return tags;
+    }
+
+    std::atomic_int handlerCalls{0};
+    std::atomic_int canceledHandlers{0};
+
+public slots:
+    // Never answers, client is expected to give up. Handled requests are remembered by tag query param
+    void rest_get_SlowMethod(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                             const QUrlQuery &queryParams, const QByteArray &)
+    {
+        connection.addCancelCallback([this]() { ++canceledHandlers; });
+        {
+            QMutexLocker locker(&tagsMutex);
+            tags << queryParams.queryItemValue(QStringLiteral("tag"));
+        }
+        ++handlerCalls;
+    }
+
+    void rest_get_TestMethod(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                             const QUrlQuery &, const QByteArray &)
+    {
+        sendAnswer(connection, "rest_get_TestMethod", "text/plain");
+    }
+
+    void rest_get_DelayedMethod(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                                const QUrlQuery &, const QByteArray &)
+    {
+        QThread::msleep(300);
+        sendAnswer(connection, "rest_get_DelayedMethod", "text/plain");
+    }
+
+private:
+    mutable QMutex tagsMutex;
+    QStringList tags;
+};
+
+// Reply lives in network thread, so it is aborted there
+static void abortReply(QNetworkReply *reply)
+{
+    QMetaObject::invokeMethod(reply, "abort", Qt::QueuedConnection);
+}
+
+// Scheduler is shared by all clients, so everything changed by test is restored
+class RestClientSchedulerTest : public RestServerFixture<SlowRestServer>
+{
+protected:
+    void TearDown() override
+    {
+        RestServerFixture<SlowRestServer>::TearDown();
+        waitFor([]() { return !Proof::RestClient::schedulerStatistics().contains(QStringLiteral("localhost")); });
+        Proof::RestClient::setHostConcurrencyLimit(QStringLiteral("localhost"), 0);
+        Proof::RestClient::setAdaptiveConcurrencyEnabled(false);
+        Proof::RestClient::setNetworkThreadsCount(1);
+    }
+};
+
+TEST_F(RestClientSchedulerTest, hostConcurrencyLimit)
+{
+    // Separate host name to not interfere with other tests
+    Proof::RestClient::setHostConcurrencyLimit("localhost", 1);
+    EXPECT_EQ(1, Proof::RestClient::hostConcurrencyLimit("localhost"));
+    EXPECT_EQ(Proof::RestClient::defaultHostConcurrencyLimit(), Proof::RestClient::hostConcurrencyLimit("127.0.0.1"));
+
+    ASSERT_NO_FATAL_FAILURE(startServer(QStringLiteral("localhost")));
+    restClient->setMsecsForTimeout(500);
+    for (int i = 0; i < 3; ++i)
+        restClient->get("/slow-method");
+
+    ASSERT_TRUE(waitFor([this]() { return server->handlerCalls > 0; }));
+    QVariantMap hostStatistics = Proof::RestClient::schedulerStatistics()["localhost"].toMap();
+    EXPECT_EQ(1, hostStatistics["usage"].toInt());
+    EXPECT_EQ(2, hostStatistics["queued"].toInt());
+    EXPECT_EQ(1, hostStatistics["limit"].toInt());
+
+    // Requests are served one by one until queue is drained
+    EXPECT_TRUE(waitFor([]() { return !Proof::RestClient::schedulerStatistics().contains("localhost"); }));
+    EXPECT_EQ(3, server->handlerCalls);
+    Proof::RestClient::setHostConcurrencyLimit("localhost", 0);
+    EXPECT_EQ(Proof::RestClient::defaultHostConcurrencyLimit(), Proof::RestClient::hostConcurrencyLimit("localhost"));
+}
+
+TEST_F(RestClientSchedulerTest, adaptiveConcurrencyLimit)
+{
+    Proof::RestClient::setAdaptiveConcurrencyEnabled(true, 1, 64);
+    EXPECT_TRUE(Proof::RestClient::adaptiveConcurrencyEnabled());
+    ASSERT_NO_FATAL_FAILURE(startServer(QStringLiteral("localhost")));
+
+    // Requests go one at a time, so host queue is gone between them, but learned state stays.
+    // Baseline is known only after first 32 replies, slow one after that shrinks the window
+    double window = Proof::RestClient::defaultHostConcurrencyLimit();
+    for (int i = 0; i < 32; ++i) {
+        QScopedPointer<QNetworkReply> reply(restClient->get("/test-method")->result());
+        ASSERT_TRUE(waitForReply(reply.data()));
+        ASSERT_TRUE(waitFor([]() { return !Proof::RestClient::schedulerStatistics().contains("localhost"); }));
+    }
+    EXPECT_EQ(qFloor(window), Proof::RestClient::hostConcurrencyLimit("localhost"));
+    QScopedPointer<QNetworkReply> delayedReply(restClient->get("/delayed-method")->result());
+    ASSERT_TRUE(waitForReply(delayedReply.data()));
+    window *= 0.9;
+    EXPECT_TRUE(waitFor([window]() { return Proof::RestClient::hostConcurrencyLimit("localhost") == qFloor(window); }));
+
+    // Nothing listens there, so each request ends with refused connection which is an overload signal
+    QTcpServer closedServer;
+    ASSERT_TRUE(closedServer.listen(QHostAddress::LocalHost));
+    auto closedClient = createRestClient(closedServer.serverPort(), QStringLiteral("localhost"));
+    closedServer.close();
+
+    for (int i = 0; i < 3; ++i) {
+        QScopedPointer<QNetworkReply> reply(closedClient->get("/")->result());
+        ASSERT_TRUE(waitForReply(reply.data()));
+        EXPECT_EQ(QNetworkReply::ConnectionRefusedError, reply->error());
+        window = qMax(1.0, window / 2);
+        EXPECT_TRUE(waitFor([window]() {
+            return Proof::RestClient::hostConcurrencyLimit("localhost") == qFloor(window);
+        }));
+    }
+    EXPECT_TRUE(waitFor([]() { return !Proof::RestClient::schedulerStatistics().contains("localhost"); }));
+    EXPECT_EQ(1, Proof::RestClient::hostConcurrencyLimit("localhost"));
+
+    Proof::RestClient::setAdaptiveConcurrencyEnabled(false);
+    EXPECT_FALSE(Proof::RestClient::adaptiveConcurrencyEnabled());
+    EXPECT_EQ(Proof::RestClient::defaultHostConcurrencyLimit(), Proof::RestClient::hostConcurrencyLimit("localhost"));
+}
+
+TEST_F(RestClientSchedulerTest, priorities)
+{
+    ASSERT_NO_FATAL_FAILURE(startServer(QStringLiteral("localhost")));
+    Proof::RestClient::setHostConcurrencyLimit("localhost", 1);
+
+    // First one takes the only slot, the rest wait in queue. Slot is freed only by abort, so order is strict
+    auto first = restClient->get("/slow-method", QUrlQuery("tag=first"));
+    auto background = restClient->get("/slow-method", QUrlQuery("tag=background"), QString(),
+                                      Proof::RestRequestPriority::Background);
+    auto interactive = restClient->get("/slow-method", QUrlQuery("tag=interactive"), QString(),
+                                       Proof::RestRequestPriority::Interactive);
+
+    ASSERT_TRUE(waitForFuture(first));
+    ASSERT_TRUE(waitFor([this]() { return server->handlerCalls == 1; }));
+    EXPECT_FALSE(interactive->completed());
+    EXPECT_FALSE(background->completed());
+    abortReply(first->result());
+
+    ASSERT_TRUE(waitForFuture(interactive));
+    ASSERT_TRUE(waitFor([this]() { return server->handlerCalls == 2; }));
+    EXPECT_FALSE(background->completed());
+    abortReply(interactive->result());
+
+    ASSERT_TRUE(waitForFuture(background));
+    ASSERT_TRUE(waitFor([this]() { return server->handlerCalls == 3; }));
+    abortReply(background->result());
+
+    EXPECT_EQ(QStringList({"first", "interactive", "background"}), server->handledTags());
+    EXPECT_TRUE(waitFor([]() { return !Proof::RestClient::schedulerStatistics().contains("localhost"); }));
+}
+
+TEST_F(RestClientSchedulerTest, saturatedHostQueue)
+{
+    ASSERT_NO_FATAL_FAILURE(startServer(QStringLiteral("localhost")));
+    Proof::RestClient::setHostConcurrencyLimit("localhost", 1);
+
+    auto first = restClient->get("/slow-method", QUrlQuery("tag=first"));
+    auto second = restClient->get("/slow-method", QUrlQuery("tag=second"));
+    auto third = restClient->get("/slow-method", QUrlQuery("tag=third"));
+    ASSERT_TRUE(waitForFuture(first));
+    ASSERT_TRUE(waitFor([this]() { return server->handlerCalls == 1; }));
+
+    // Queue of saturated host doesn't hold requests to other hosts
+    auto otherHostClient = createRestClient(server->serverPort());
+    QScopedPointer<QNetworkReply> reply(otherHostClient->get("/test-method")->result());
+    ASSERT_TRUE(waitForReply(reply.data()));
+    EXPECT_EQ("rest_get_TestMethod", reply->readAll());
+    EXPECT_EQ(2, Proof::RestClient::schedulerStatistics()["localhost"].toMap()["queued"].toInt());
+    EXPECT_FALSE(second->completed());
+
+    // Requests of same host and priority are sent in order they were added
+    abortReply(first->result());
+    ASSERT_TRUE(waitForFuture(second));
+    ASSERT_TRUE(waitFor([this]() { return server->handledTags().count() == 2; }));
+    EXPECT_FALSE(third->completed());
+    abortReply(second->result());
+    ASSERT_TRUE(waitForFuture(third));
+    ASSERT_TRUE(waitFor([this]() { return server->handledTags().count() == 3; }));
+    abortReply(third->result());
+
+    EXPECT_EQ(QStringList({"first", "second", "third"}), server->handledTags());
+    EXPECT_TRUE(waitFor([]() { return !Proof::RestClient::schedulerStatistics().contains("localhost"); }));
+}
+
+TEST_F(RestClientSchedulerTest, canceledQueuedRequest)
+{
+    ASSERT_NO_FATAL_FAILURE(startServer(QStringLiteral("localhost")));
+    Proof::RestClient::setNetworkThreadsCount(2);
+    Proof::RestClient::setHostConcurrencyLimit("localhost", 1);
+
+    // Canceled request is skipped in thread of its client, for one of them it is not the scheduler thread
+    QVector<Proof::RestClientSP> clients = {createRestClient(server->serverPort(), QStringLiteral("localhost")),
+                                            createRestClient(server->serverPort(), QStringLiteral("localhost"))};
+    for (const auto &client : qAsConst(clients)) {
+        const int handledBefore = server->handlerCalls;
+        auto first = client->get("/slow-method", QUrlQuery("tag=first"));
+        auto canceled = client->get("/slow-method", QUrlQuery("tag=canceled"));
+        auto next = client->get("/slow-method", QUrlQuery("tag=next"));
+        ASSERT_TRUE(waitForFuture(first));
+        ASSERT_TRUE(waitFor([this, handledBefore]() { return server->handlerCalls == handledBefore + 1; }));
+
+        canceled.cancel();
+        abortReply(first->result());
+        ASSERT_TRUE(waitForFuture(next));
+        ASSERT_TRUE(waitFor([this, handledBefore]() { return server->handlerCalls == handledBefore + 2; }));
+        abortReply(next->result());
+        EXPECT_TRUE(waitFor([]() { return !Proof::RestClient::schedulerStatistics().contains("localhost"); }));
+    }
+    EXPECT_EQ(QStringList({"first", "next", "first", "next"}), server->handledTags());
+}
+
+TEST_F(RestClientSchedulerTest, networkThreads)
+{
+    ASSERT_NO_FATAL_FAILURE(startServer());
+    Proof::RestClient::setNetworkThreadsCount(2);
+    EXPECT_EQ(2, Proof::RestClient::networkThreadsCount());
+    QVector<Proof::RestClientSP> clients = {createRestClient(server->serverPort()),
+                                            createRestClient(server->serverPort())};
+    EXPECT_NE(clients[0]->thread(), clients[1]->thread());
+    EXPECT_NE(QThread::currentThread(), clients[0]->thread());
+    EXPECT_NE(QThread::currentThread(), clients[1]->thread());
+
+    for (const auto &client : qAsConst(clients)) {
+        QScopedPointer<QNetworkReply> reply(client->get("/test-method")->result());
+        EXPECT_EQ(client->thread(), reply->thread());
+        ASSERT_TRUE(waitForReply(reply.data()));
+        EXPECT_EQ("rest_get_TestMethod", reply->readAll());
+    }
+}
+
+class HeadersEchoRestServer : public Proof::AbstractRestServer
+{
+    Q_OBJECT
+public:
+    HeadersEchoRestServer() : Proof::AbstractRestServer(0) {}
+
+public slots:
+    void rest_get_Authorization(const Proof::RestConnection &connection, const QStringList &headers,
+                                const QStringList &, const QUrlQuery &, const QByteArray &)
+    {
+        auto it = std::find_if(headers.cbegin(), headers.cend(), [](const QString &header) {
+            return header.startsWith(QLatin1String("Authorization:"), Qt::CaseInsensitive);
+        });
+        sendAnswer(connection, it != headers.cend() ? it->section(':', 1).trimmed().toLatin1() : QByteArray(),
+                   "text/plain");
+    }
+};
+
+class RestClientHeadersTest : public RestServerFixture<HeadersEchoRestServer>
+{
+protected:
+    QByteArray receivedAuthorization()
+    {
+        QScopedPointer<QNetworkReply> reply(restClient->get("/authorization")->result());
+        return waitForReply(reply.data()) ? reply->readAll() : QByteArray("<timeout>");
+    }
+};
+
+// Headers are prepared once per client, so each change of auth properties must reach next request
+TEST_F(RestClientHeadersTest, authorizationChanges)
+{
+    ASSERT_NO_FATAL_FAILURE(startServer());
+    EXPECT_EQ("", receivedAuthorization());
+
+    restClient->setUserName("user");
+    restClient->setPassword("secret");
+    restClient->setAuthType(Proof::RestAuthType::Basic);
+    EXPECT_EQ("Basic " + QByteArray("user:secret").toBase64(), receivedAuthorization());
+    restClient->setUserName("other");
+    EXPECT_EQ("Basic " + QByteArray("other:secret").toBase64(), receivedAuthorization());
+
+    restClient->setToken("first-token");
+    restClient->setAuthType(Proof::RestAuthType::BearerToken);
+    EXPECT_EQ("Bearer first-token", receivedAuthorization());
+    restClient->setToken("second-token");
+    EXPECT_EQ("Bearer second-token", receivedAuthorization());
+
+    restClient->setAuthType(Proof::RestAuthType::NoAuth);
+    EXPECT_EQ("", receivedAuthorization());
+}
+
+class HttpCacheRestServer : public Proof::AbstractRestServer
+{
+    Q_OBJECT
+public:
+    HttpCacheRestServer() : Proof::AbstractRestServer(0) {}
+
+    std::atomic_int calls{0};
+    std::atomic_int notModifiedAnswers{0};
+
+public slots:
+    void rest_get_Fresh(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                        const QUrlQuery &, const QByteArray &)
+    {
+        ++calls;
+        sendAnswer(connection, "fresh", "text/plain", {{"Cache-Control", "max-age=60"}, {"ETag", "\"fresh-1\""}});
+    }
+
+    void rest_get_Validated(const Proof::RestConnection &connection, const QStringList &headers, const QStringList &,
+                            const QUrlQuery &, const QByteArray &)
+    {
+        ++calls;
+        QHash<QString, QString> answerHeaders{{"Cache-Control", "no-cache"}, {"ETag", "\"validated-1\""}};
+        bool revalidation = std::any_of(headers.cbegin(), headers.cend(), [](const QString &header) {
+            return header.startsWith(QLatin1String("If-None-Match:"), Qt::CaseInsensitive)
+                   && header.contains(QLatin1String("\"validated-1\""));
+        });
+        if (revalidation) {
+            ++notModifiedAnswers;
+            sendAnswer(connection, "", "text/plain", answerHeaders, 304, "Not Modified");
+        } else {
+            sendAnswer(connection, "validated", "text/plain", answerHeaders);
+        }
+    }
+
+    // Answer depends on credentials, but is cacheable by itself
+    void rest_get_Personal(const Proof::RestConnection &connection, const QStringList &headers, const QStringList &,
+                           const QUrlQuery &, const QByteArray &)
+    {
+        ++calls;
+        auto it = std::find_if(headers.cbegin(), headers.cend(), [](const QString &header) {
+            return header.startsWith(QLatin1String("Authorization:"), Qt::CaseInsensitive);
+        });
+        sendAnswer(connection, it != headers.cend() ? it->section(':', 1).trimmed().toLatin1() : QByteArray(),
+                   "text/plain", {{"Cache-Control", "max-age=60"}});
+    }
+};
+
+// Cache is shared by all clients, so it is dropped after each test
+class RestClientHttpCacheTest : public RestServerFixture<HttpCacheRestServer>
+{
+protected:
+    void TearDown() override
+    {
+        RestServerFixture<HttpCacheRestServer>::TearDown();
+        Proof::RestClient::setupHttpCache(0);
+    }
+
+    QByteArray fetch(const QString &method, const Proof::RestClientSP &client)
+    {
+        QScopedPointer<QNetworkReply> reply(client->get(method)->result());
+        EXPECT_TRUE(waitForReply(reply.data()));
+        EXPECT_EQ(200, reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
+        return reply->readAll();
+    }
+};
+
+TEST_F(RestClientHttpCacheTest, freshAndRevalidated)
+{
+    ASSERT_NO_FATAL_FAILURE(startServer());
+    Proof::RestClient::setupHttpCache(1024 * 1024);
+    restClient->setHttpCacheEnabled(true);
+
+    EXPECT_EQ("fresh", fetch("/fresh", restClient));
+    EXPECT_EQ("fresh", fetch("/fresh", restClient));
+    EXPECT_EQ(1, server->calls);
+
+    EXPECT_EQ("validated", fetch("/validated", restClient));
+    EXPECT_EQ("validated", fetch("/validated", restClient));
+    EXPECT_EQ(3, server->calls);
+    EXPECT_EQ(1, server->notModifiedAnswers);
+
+    QVariantMap statistics = Proof::RestClient::httpCacheStatistics();
+    EXPECT_EQ(2, statistics["hits"].toInt());
+    EXPECT_EQ(2, statistics["misses"].toInt());
+    EXPECT_EQ(1, statistics["revalidations"].toInt());
+    EXPECT_EQ(2, statistics["memory_entries"].toInt());
+
+    // Clients without cache go to network always
+    restClient->setHttpCacheEnabled(false);
+    EXPECT_EQ("fresh", fetch("/fresh", restClient));
+    EXPECT_EQ(4, server->calls);
+
+    Proof::RestClient::setupHttpCache(0);
+    EXPECT_TRUE(Proof::RestClient::httpCacheStatistics().isEmpty());
+}
+
+TEST_F(RestClientHttpCacheTest, differentCredentials)
+{
+    ASSERT_NO_FATAL_FAILURE(startServer());
+    Proof::RestClient::setupHttpCache(1024 * 1024);
+    QVector<Proof::RestClientSP> clients = {restClient, createRestClient(server->serverPort())};
+    clients[0]->setToken("first-token");
+    clients[1]->setToken("second-token");
+    for (const auto &client : qAsConst(clients)) {
+        client->setAuthType(Proof::RestAuthType::BearerToken);
+        client->setHttpCacheEnabled(true);
+    }
+
+    EXPECT_EQ("Bearer first-token", fetch("/personal", clients[0]));
+    EXPECT_EQ("Bearer second-token", fetch("/personal", clients[1]));
+    EXPECT_EQ("Bearer first-token", fetch("/personal", clients[0]));
+    EXPECT_EQ(3, server->calls);
+    EXPECT_EQ(0, Proof::RestClient::httpCacheStatistics()["memory_entries"].toInt());
+
+    // Entries stored without credentials are still used
+    clients[1]->setAuthType(Proof::RestAuthType::NoAuth);
+    EXPECT_EQ("", fetch("/personal", clients[1]));
+    EXPECT_EQ("", fetch("/personal", clients[0]));
+    EXPECT_EQ(4, server->calls);
+}
+
+class CountingRestServer : public SlowRestServer
+{
+    Q_OBJECT
+public:
+    CountingRestServer() : SlowRestServer() {}
+
+    std::atomic_int calls{0};
+
+public slots:
+    void rest_get_Counted(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                          const QUrlQuery &, const QByteArray &)
+    {
+        ++calls;
+        sendAnswer(connection, "counted", "text/plain");
+    }
+};
+
+class ExposedRestApi : public Proof::BaseRestApi
+{
+public:
+    explicit ExposedRestApi(const Proof::RestClientSP &restClient) : Proof::BaseRestApi(restClient) {}
+    using Proof::BaseRestApi::get;
+    using Proof::BaseRestApi::post;
+};
+
+using BaseRestApiCoalescingTest = RestServerFixture<CountingRestServer>;
+
+TEST_F(BaseRestApiCoalescingTest, identicalGets)
+{
+    ASSERT_NO_FATAL_FAILURE(startServer());
+    ExposedRestApi api(restClient);
+    EXPECT_FALSE(api.requestCoalescingEnabled());
+    api.setRequestCoalescingEnabled(true);
+    EXPECT_TRUE(api.requestCoalescingEnabled());
+
+    QVector<Proof::CancelableFuture<Proof::RestApiReply>> replies;
+    for (int i = 0; i < 3; ++i)
+        replies << api.get("/counted");
+    auto otherQueryReply = api.get("/counted", QUrlQuery("a=1"));
+    for (const auto &reply : qAsConst(replies)) {
+        ASSERT_TRUE(waitForFuture(reply));
+        ASSERT_TRUE(reply->succeeded());
+        EXPECT_EQ("counted", reply->result().data);
+    }
+    ASSERT_TRUE(waitForFuture(otherQueryReply));
+    EXPECT_TRUE(otherQueryReply->succeeded());
+    EXPECT_EQ(2, server->calls);
+
+    // Finished request is not reused
+    auto laterReply = api.get("/counted");
+    ASSERT_TRUE(waitForFuture(laterReply));
+    EXPECT_TRUE(laterReply->succeeded());
+    EXPECT_EQ(3, server->calls);
+
+    // Network request is aborted only after all waiters cancel
+    auto firstSlowReply = api.get("/slow-method");
+    auto secondSlowReply = api.get("/slow-method");
+    ASSERT_TRUE(waitFor([this]() { return server->handlerCalls > 0; }));
+    firstSlowReply.cancel();
+    EXPECT_TRUE(firstSlowReply->failed());
+    EXPECT_FALSE(secondSlowReply->completed());
+
+    secondSlowReply.cancel();
+    EXPECT_TRUE(secondSlowReply->failed());
+    EXPECT_TRUE(waitFor([this]() { return server->canceledHandlers > 0; }));
+    EXPECT_EQ(1, server->handlerCalls);
+}
+
+// Answers only when test releases it
+class HeldRestServer : public Proof::AbstractRestServer
+{
+    Q_OBJECT
+public:
+    HeldRestServer() : Proof::AbstractRestServer(0) {}
+
+    void release(const QByteArray &body)
+    {
+        QMutexLocker locker(&connectionsMutex);
+        for (const auto &connection : qAsConst(connections))
+            sendAnswer(connection, body, "text/plain");
+        connections.clear();
+    }
+
+    std::atomic_int calls{0};
+    std::atomic_int canceledCalls{0};
+
+public slots:
+    void rest_get_Held(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                       const QUrlQuery &, const QByteArray &)
+    {
+        connection.addCancelCallback([this]() { ++canceledCalls; });
+        QMutexLocker locker(&connectionsMutex);
+        connections << connection;
+        ++calls;
+    }
+
+private:
+    QMutex connectionsMutex;
+    QVector<Proof::RestConnection> connections;
+};
+
+class CoalescingProxyRestServer : public Proof::AbstractRestServer
+{
+    Q_OBJECT
+public:
+    CoalescingProxyRestServer() : Proof::AbstractRestServer(0) {}
+
+    QScopedPointer<ExposedRestApi> upstreamApi;
+    std::atomic_int calls{0};
+    std::atomic_int canceledCalls{0};
+
+public slots:
+    void rest_get_Proxy(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                        const QUrlQuery &, const QByteArray &)
+    {
+        connection.addCancelCallback([this]() { ++canceledCalls; });
+        upstreamApi->get("/held")->onSuccess([this, connection](const Proof::RestApiReply &reply) {
+            sendAnswer(connection, reply.data, "text/plain");
+        });
+        ++calls;
+    }
+};
+
+class BaseRestApiCoalescingCancellationTest : public RestServerFixture<CoalescingProxyRestServer>
+{
+protected:
+    void TearDown() override
+    {
+        RestServerFixture<CoalescingProxyRestServer>::TearDown();
+        upstream.reset();
+    }
+
+    QScopedPointer<HeldRestServer> upstream;
+};
+
+TEST_F(BaseRestApiCoalescingCancellationTest, firstWaiterDisconnect)
+{
+    upstream.reset(new HeldRestServer);
+    upstream->setPort(0);
+    upstream->startListen();
+    ASSERT_TRUE(waitFor([this]() { return upstream->isListening(); }));
+    server->upstreamApi.reset(new ExposedRestApi(createRestClient(upstream->serverPort())));
+    server->upstreamApi->setRequestCoalescingEnabled(true);
+    ASSERT_NO_FATAL_FAILURE(startServer());
+
+    QTcpSocket firstSocket;
+    firstSocket.connectToHost(QHostAddress::LocalHost, server->serverPort());
+    ASSERT_TRUE(firstSocket.waitForConnected(NETWORK_TEST_TIMEOUT));
+    firstSocket.write("GET /proxy HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+    firstSocket.waitForBytesWritten(1000);
+    ASSERT_TRUE(waitFor([this]() { return upstream->calls == 1; }));
+
+    QTcpSocket secondSocket;
+    secondSocket.connectToHost(QHostAddress::LocalHost, server->serverPort());
+    ASSERT_TRUE(secondSocket.waitForConnected(NETWORK_TEST_TIMEOUT));
+    secondSocket.write("GET /proxy HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+    secondSocket.waitForBytesWritten(1000);
+    ASSERT_TRUE(waitFor([this]() { return server->calls == 2; }));
+
+    // Upstream request was made from rest method of first client, but it is shared with second one
+    firstSocket.disconnectFromHost();
+    ASSERT_TRUE(waitFor([this]() { return server->canceledCalls == 1; }));
+    upstream->release("upstream answer");
+
+    QByteArray answer;
+    EXPECT_TRUE(waitFor([&answer, &secondSocket]() {
+        answer += secondSocket.readAll();
+        return answer.endsWith("upstream answer");
+    }));
+    EXPECT_TRUE(answer.startsWith("HTTP/1.1 200"));
+    EXPECT_EQ(1, upstream->calls);
+    EXPECT_EQ(0, upstream->canceledCalls);
+}
+
+class FlakyRestServer : public Proof::AbstractRestServer
+{
+    Q_OBJECT
+public:
+    FlakyRestServer() : Proof::AbstractRestServer(0) {}
+
+    QScopedPointer<ExposedRestApi> proxyApi;
+    std::atomic_int calls{0};
+    std::atomic_int failuresLeft{0};
+    std::atomic_int stalledCalls{0};
+    std::atomic_int stallsLeft{0};
+    std::atomic_int proxyFailures{0};
+
+public slots:
+    void rest_get_Flaky(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                        const QUrlQuery &, const QByteArray &)
+    {
+        answerFlaky(connection);
+    }
+
+    void rest_post_Flaky(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                         const QUrlQuery &, const QByteArray &)
+    {
+        answerFlaky(connection);
+    }
+
+    // Doesn't answer at all while there are stalls left
+    void rest_get_Stalled(const Proof::RestConnection &connection, const QStringList &, const QStringList &,
+                          const QUrlQuery &, const QByteArray &)
+    {
+        ++stalledCalls;
+        if (stallsLeft-- <= 0)
+            sendAnswer(connection, "done", "text/plain");
+    }
+
+    // Request to upstream is aborted if client of this one disconnects
+    void rest_get_Proxy(const Proof::RestConnection &, const QStringList &, const QStringList &, const QUrlQuery &,
+                        const QByteArray &)
+    {
+        proxyApi->get("/stalled")->onFailure([this](const Proof::Failure &) { ++proxyFailures; });
+    }
+
+private:
+    void answerFlaky(const Proof::RestConnection &connection)
+    {
+        ++calls;
+        if (failuresLeft-- > 0)
+            sendAnswer(connection, "busy", "text/plain", {{"Retry-After", "0"}}, 503, "Service Unavailable");
+        else
+            sendAnswer(connection, "done", "text/plain");
+    }
+};
+
+using BaseRestApiRetryTest = RestServerFixture<FlakyRestServer>;
+
+TEST_F(BaseRestApiRetryTest, transientFailures)
+{
+    ASSERT_NO_FATAL_FAILURE(startServer());
+    ExposedRestApi api(restClient);
+    EXPECT_EQ(0, api.retryPolicy().maxRetries);
+
+    // Retries are disabled by default
+    server->failuresLeft = 1;
+    auto reply = api.get("/flaky");
+    ASSERT_TRUE(waitForFuture(reply));
+    ASSERT_TRUE(reply->failed());
+    EXPECT_EQ(503, reply->failureReason().data.toInt());
+    EXPECT_EQ(1, server->calls);
+
+    Proof::RestRetryPolicy policy;
+    policy.maxRetries = 3;
+    policy.initialBackoffMsecs = 10;
+    policy.maxBackoffMsecs = 100;
+    api.setRetryPolicy(policy);
+    EXPECT_EQ(3, api.retryPolicy().maxRetries);
+
+    server->failuresLeft = 2;
+    reply = api.get("/flaky");
+    ASSERT_TRUE(waitForFuture(reply));
+    ASSERT_TRUE(reply->succeeded());
+    EXPECT_EQ("done", reply->result().data);
+    EXPECT_EQ(4, server->calls);
+
+    server->failuresLeft = 5;
+    reply = api.get("/flaky");
+    ASSERT_TRUE(waitForFuture(reply));
+    ASSERT_TRUE(reply->failed());
+    EXPECT_EQ(503, reply->failureReason().data.toInt());
+    EXPECT_EQ(8, server->calls);
+
+    // Non-idempotent requests are not retried by default
+    server->failuresLeft = 1;
+    reply = api.post("/flaky");
+    ASSERT_TRUE(waitForFuture(reply));
+    EXPECT_TRUE(reply->failed());
+    EXPECT_EQ(9, server->calls);
+
+    // No budget, no retries
+    policy.budgetRatio = 0.0;
+    policy.minRetriesPerWindow = 0;
+    api.setRetryPolicy(policy);
+    server->failuresLeft = 1;
+    reply = api.get("/flaky");
+    ASSERT_TRUE(waitForFuture(reply));
+    EXPECT_TRUE(reply->failed());
+    EXPECT_EQ(10, server->calls);
+    server->failuresLeft = 0;
+}
+
+TEST_F(BaseRestApiRetryTest, abortedReplies)
+{
+    ASSERT_NO_FATAL_FAILURE(startServer());
+    Proof::RestRetryPolicy policy;
+    policy.maxRetries = 3;
+    policy.initialBackoffMsecs = 10;
+    policy.maxBackoffMsecs = 100;
+    ExposedRestApi api(restClient);
+    api.setRetryPolicy(policy);
+
+    // Reply aborted because of client timeout is retried
+    restClient->setMsecsForTimeout(300);
+    server->stallsLeft = 1;
+    auto reply = api.get("/stalled");
+    ASSERT_TRUE(waitForFuture(reply));
+    ASSERT_TRUE(reply->succeeded());
+    EXPECT_EQ("done", reply->result().data);
+    EXPECT_EQ(2, server->stalledCalls);
+
+    // Reply aborted by anyone else is not
+    server->proxyApi.reset(new ExposedRestApi(createRestClient(server->serverPort())));
+    server->proxyApi->setRetryPolicy(policy);
+    server->stallsLeft = 1000;
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, server->serverPort());
+    ASSERT_TRUE(socket.waitForConnected(NETWORK_TEST_TIMEOUT));
+    socket.write("GET /proxy HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+    socket.waitForBytesWritten(1000);
+    ASSERT_TRUE(waitFor([this]() { return server->stalledCalls == 3; }));
+    socket.disconnectFromHost();
+    EXPECT_TRUE(waitFor([this]() { return server->proxyFailures == 1; }));
+    EXPECT_EQ(3, server->stalledCalls);
+    server->stallsLeft = 0;
+}
+
+#include "restclient_test.moc"
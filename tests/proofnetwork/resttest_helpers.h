@@ -0,0 +1,80 @@
+// clazy:skip
+
+#ifndef RESTTEST_HELPERS_H
+#define RESTTEST_HELPERS_H
+
+#include "proofnetwork/restclient.h"
+
+#include "gtest/proof/test_global.h"
+
+#include <QNetworkReply>
+#include <QScopedPointer>
+#include <QSignalSpy>
+#include <QTest>
+
+#include <functional>
+
+static const int NETWORK_TEST_TIMEOUT = 10000;
+
+// Port is not set if it is not positive
+inline Proof::RestClientSP createRestClient(int port, const QString &host = QStringLiteral("127.0.0.1"))
+{
+    auto restClient = Proof::RestClientSP::create();
+    restClient->setAuthType(Proof::RestAuthType::NoAuth);
+    restClient->setHost(host);
+    if (port > 0)
+        restClient->setPort(port);
+    restClient->setScheme(QStringLiteral("http"));
+    restClient->setClientName(QStringLiteral("Proof-test"));
+    return restClient;
+}
+
+// Reply lives in network thread, so its finished signal is caught by spy without running events loop of this thread
+inline bool waitForReply(QNetworkReply *reply, int timeout = NETWORK_TEST_TIMEOUT)
+{
+    QSignalSpy finishedSpy(reply, &QNetworkReply::finished);
+    return reply->isFinished() || finishedSpy.wait(timeout) || reply->isFinished();
+}
+
+// Runs events loop of this thread, so api objects living here can process replies
+template <typename T>
+bool waitForFuture(const T &future, int timeout = NETWORK_TEST_TIMEOUT)
+{
+    return QTest::qWaitFor([future]() { return future->completed(); }, timeout);
+}
+
+inline bool waitFor(const std::function<bool()> &condition, int timeout = NETWORK_TEST_TIMEOUT)
+{
+    return QTest::qWaitFor(condition, timeout);
+}
+
+// Server is created for each test and listens on free port. It can be configured in test body before startServer()
+template <typename Server>
+class RestServerFixture : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        server.reset(new Server);
+        server->setPort(0);
+    }
+
+    void TearDown() override
+    {
+        restClient.reset();
+        server.reset();
+    }
+
+    // Must be wrapped in ASSERT_NO_FATAL_FAILURE
+    void startServer(const QString &clientHost = QStringLiteral("127.0.0.1"))
+    {
+        server->startListen();
+        ASSERT_TRUE(waitFor([this]() { return server->isListening(); }));
+        restClient = createRestClient(server->serverPort(), clientHost);
+    }
+
+    QScopedPointer<Server> server;
+    Proof::RestClientSP restClient;
+};
+
+#endif // RESTTEST_HELPERS_H